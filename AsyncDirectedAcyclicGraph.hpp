@@ -0,0 +1,310 @@
+//
+//  AsyncDirectedAcyclicGraph.hpp - Front end which lets many threads
+//     submit changes to a DirectedAcyclicGraph without taking a lock.
+//     Requests go into a queue and a single writer thread applies them
+//     in batches, handing back the outcomes through std::future.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cassert>
+
+#include "DirectedAcyclicGraph.hpp"
+
+namespace nocycle {
+
+// The queue is Vyukov's intrusive multiple-producer single-consumer queue:
+// a producer swaps itself in as the tail with one atomic exchange and then
+// links the old tail to it, so submitting never blocks on other submitters
+// or on the writer.
+//
+// http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+//
+// The writer takes whatever has piled up (up to a maximum batch size) and
+// applies it in submission order.  Runs of edge insertions into the same
+// vertex share one cycle check search (see DirectedAcyclicGraph::SetEdgesTo).
+// No future in a batch is completed until the whole batch has been applied,
+// so a result is never seen before the changes ahead of it.
+//
+// The graph is handed in by reference, and must not be touched by anything
+// else between Start() and Stop().
+//
+class AsyncDirectedAcyclicGraph {
+  public:
+    typedef DirectedAcyclicGraph::VertexID VertexID;
+
+    enum Result {
+        resultApplied,
+        resultNoChange, // vertex already existed, edge already present or absent
+        resultWouldCauseCycle
+    };
+
+  private:
+    enum Operation {
+        operationCreateVertex,
+        operationAddEdge,
+        operationRemoveEdge,
+        operationCanReach
+    };
+
+    struct Request {
+        Operation operation;
+        VertexID fromVertex;
+        VertexID toVertex;
+        Result result;
+        bool answer;
+        std::promise<Result> resultPromise;
+        std::promise<bool> answerPromise; // only for operationCanReach
+    };
+
+    struct Node {
+        std::atomic<Node*> next;
+        Request request;
+    };
+
+  private:
+    DirectedAcyclicGraph& m_dag;
+
+    std::atomic<Node*> m_tail; // producers swap in here
+    Node* m_head; // only the writer touches this; it is always a spent node
+
+    std::atomic<bool> m_writerWaiting;
+    std::atomic<bool> m_stopping;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    std::thread m_writer;
+
+    size_t m_maxBatch;
+    std::atomic<size_t> m_batchesApplied;
+
+  private:
+    void Push(Node* node) {
+        node->next.store(NULL, std::memory_order_relaxed);
+        Node* previous = m_tail.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node);
+
+        // The writer sets m_writerWaiting before its last look at the queue,
+        // so either it sees this node or we see that it may be asleep
+        if (m_writerWaiting.load()) {
+            std::lock_guard<std::mutex> lock (m_wakeMutex);
+            m_wake.notify_one();
+        }
+    }
+
+    bool QueueEmpty() const {
+        return m_head->next.load() == NULL;
+    }
+
+    // The node after the head becomes the new head once its request has been
+    // moved out, and the old head is freed
+    bool Pop(Request& request) {
+        Node* next = m_head->next.load(std::memory_order_acquire);
+        if (next == NULL)
+            return false;
+        request = std::move(next->request);
+        delete m_head;
+        m_head = next;
+        return true;
+    }
+
+    // The future has to be taken before the push, since once the node is
+    // in the queue the writer may apply it and free it at any moment
+    Node* MakeNode(Operation operation, VertexID fromVertex, VertexID toVertex) {
+        assert(!m_stopping.load());
+        Node* node = new Node;
+        node->request.operation = operation;
+        node->request.fromVertex = fromVertex;
+        node->request.toVertex = toVertex;
+        return node;
+    }
+    std::future<Result> SubmitForResult(Operation operation, VertexID fromVertex, VertexID toVertex) {
+        Node* node = MakeNode(operation, fromVertex, toVertex);
+        std::future<Result> result = node->request.resultPromise.get_future();
+        Push(node);
+        return result;
+    }
+
+    void ApplyBatch(std::vector<Request>& batch) {
+        std::vector<VertexID> fromVertices;
+        std::vector<DirectedAcyclicGraph::EdgeInsertion> insertions;
+
+        size_t index = 0;
+        while (index < batch.size()) {
+            Request& request = batch[index];
+            switch (request.operation) {
+              case operationCreateVertex:
+                if (request.fromVertex >= m_dag.GetFirstInvalidVertexID())
+                    m_dag.GrowCapacityForMaxValidVertexID(request.fromVertex);
+                if (m_dag.VertexExists(request.fromVertex)) {
+                    request.result = resultNoChange;
+                } else {
+                    m_dag.CreateVertex(request.fromVertex);
+                    request.result = resultApplied;
+                }
+                index++;
+                break;
+
+              case operationAddEdge: {
+                size_t runEnd = index;
+                fromVertices.clear();
+                while ((runEnd < batch.size()) && (batch[runEnd].operation == operationAddEdge)
+                    && (batch[runEnd].toVertex == request.toVertex)) {
+                    fromVertices.push_back(batch[runEnd].fromVertex);
+                    runEnd++;
+                }
+                m_dag.SetEdgesTo(fromVertices, request.toVertex, insertions);
+                for (size_t runIndex = index; runIndex < runEnd; runIndex++) {
+                    switch (insertions[runIndex - index]) {
+                      case DirectedAcyclicGraph::edgeInserted:
+                        batch[runIndex].result = resultApplied;
+                        break;
+                      case DirectedAcyclicGraph::edgeAlreadyPresent:
+                        batch[runIndex].result = resultNoChange;
+                        break;
+                      case DirectedAcyclicGraph::edgeWouldCauseCycle:
+                        batch[runIndex].result = resultWouldCauseCycle;
+                        break;
+                      default:
+                        assert(false);
+                    }
+                }
+                index = runEnd;
+                break;
+              }
+
+              case operationRemoveEdge:
+                request.result = m_dag.ClearEdge(request.fromVertex, request.toVertex) ? resultApplied : resultNoChange;
+                index++;
+                break;
+
+              case operationCanReach:
+                request.answer = m_dag.CanReach(request.fromVertex, request.toVertex);
+                request.result = resultNoChange;
+                index++;
+                break;
+
+              default:
+                assert(false);
+            }
+        }
+
+        for (index = 0; index < batch.size(); index++) {
+            if (batch[index].operation == operationCanReach)
+                batch[index].answerPromise.set_value(batch[index].answer);
+            else
+                batch[index].resultPromise.set_value(batch[index].result);
+        }
+        m_batchesApplied++;
+    }
+
+    void WriterLoop() {
+        std::vector<Request> batch;
+        Request request;
+        while (true) {
+            batch.clear();
+            while ((batch.size() < m_maxBatch) && Pop(request))
+                batch.push_back(std::move(request));
+
+            if (!batch.empty()) {
+                ApplyBatch(batch);
+                continue;
+            }
+
+            // Nothing is queued, so stopping now won't strand any futures
+            if (m_stopping.load())
+                return;
+
+            std::unique_lock<std::mutex> lock (m_wakeMutex);
+            m_writerWaiting.store(true);
+            m_wake.wait(lock, [&]() { return !QueueEmpty() || m_stopping.load(); });
+            m_writerWaiting.store(false);
+        }
+    }
+
+  public:
+    std::future<Result> SubmitCreateVertex(VertexID vertex) {
+        return SubmitForResult(operationCreateVertex, vertex, vertex);
+    }
+    std::future<Result> SubmitAddEdge(VertexID fromVertex, VertexID toVertex) {
+        return SubmitForResult(operationAddEdge, fromVertex, toVertex);
+    }
+    std::future<Result> SubmitRemoveEdge(VertexID fromVertex, VertexID toVertex) {
+        return SubmitForResult(operationRemoveEdge, fromVertex, toVertex);
+    }
+    std::future<bool> SubmitCanReach(VertexID fromVertex, VertexID toVertex) {
+        Node* node = MakeNode(operationCanReach, fromVertex, toVertex);
+        std::future<bool> answer = node->request.answerPromise.get_future();
+        Push(node);
+        return answer;
+    }
+
+    void SetMaxBatch(size_t maxBatch) {
+        assert(maxBatch > 0);
+        assert(!m_writer.joinable());
+        m_maxBatch = maxBatch;
+    }
+    size_t BatchesApplied() const {
+        return m_batchesApplied.load();
+    }
+
+    void Start() {
+        assert(!m_writer.joinable());
+        m_stopping.store(false);
+        m_writer = std::thread(&AsyncDirectedAcyclicGraph::WriterLoop, this);
+    }
+
+    // Everything submitted before Stop() is applied before it returns
+    void Stop() {
+        if (!m_writer.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock (m_wakeMutex);
+            m_stopping.store(true);
+        }
+        m_wake.notify_one();
+        m_writer.join();
+    }
+
+  public:
+    AsyncDirectedAcyclicGraph(DirectedAcyclicGraph& dag, size_t maxBatch = 1024) :
+        m_dag (dag),
+        m_head (new Node),
+        m_writerWaiting (false),
+        m_stopping (false),
+        m_maxBatch (maxBatch),
+        m_batchesApplied (0)
+    {
+        m_head->next.store(NULL);
+        m_tail.store(m_head);
+        Start();
+    }
+    virtual ~AsyncDirectedAcyclicGraph() {
+        Stop();
+        Request request;
+        while (Pop(request)) {
+        }
+        delete m_head;
+    }
+
+  private:
+    AsyncDirectedAcyclicGraph(const AsyncDirectedAcyclicGraph&);
+    AsyncDirectedAcyclicGraph& operator= (const AsyncDirectedAcyclicGraph&);
+};
+
+} // end namespace nocycle
@@ -272,6 +272,12 @@ class BoostOrientedGraph : public BoostBaseGraph  {
         if (!ClearEdge(fromVertex, toVertex))
             assert(false);
     }
+    bool ReverseEdge(VertexID fromVertex, VertexID toVertex) {
+        if (!ClearEdge(fromVertex, toVertex))
+            return false;
+        BoostOrientedGraph::AddEdge(toVertex, fromVertex);
+        return true;
+    }
     bool operator == (const OrientedGraph & og) const {
         if (og.GetFirstInvalidVertexID() != boost::num_vertices(*this))
             return false;
@@ -489,6 +495,26 @@ class BoostDirectedAcyclicGraph : public BoostOrientedGraph {
         if (!SetEdge(fromVertex, toVertex))
             assert(false);
     }
+    bool ReverseEdge(VertexID fromVertex, VertexID toVertex) {
+        // Boost has no notion of flipping an edge, so remove it and try adding
+        // the reverse...putting the original back if that would be a cycle.
+        if (!EdgeExists(fromVertex, toVertex))
+            return false;
+      #if DIRECTEDACYCLICGRAPH_USER_TRISTATE
+        Nstate<3> userTristate = GetTristateForConnection(fromVertex, toVertex);
+      #endif
+        ClearEdge(fromVertex, toVertex);
+        try {
+            AddEdge(toVertex, fromVertex);
+        } catch (bad_cycle& e) {
+            BoostOrientedGraph::AddEdge(fromVertex, toVertex);
+          #if DIRECTEDACYCLICGRAPH_USER_TRISTATE
+            SetTristateForConnection(fromVertex, toVertex, userTristate);
+          #endif
+            throw;
+        }
+        return true;
+    }
     bool operator == (const DirectedAcyclicGraph & dag) const {
         if (static_cast<const BoostOrientedGraph&>(*this) != static_cast<const OrientedGraph&>(dag))
             return false;
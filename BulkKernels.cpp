@@ -0,0 +1,647 @@
+//
+//  BulkKernels.cpp - Vectorized loops for the operations which touch
+//     whole buffers at once: decoding packed tristates, skipping words
+//     that are all zero, combining bitset rows and counting bits.  Each
+//     has scalar, SSE4.2, AVX2 and AVX-512 versions, and the best one
+//     the running CPU supports is picked the first time one is used.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#include "BulkKernels.hpp"
+
+#include <cassert>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+    #define BULKKERNELS_X86 1
+    #include <immintrin.h>
+#else
+    #define BULKKERNELS_X86 0
+#endif
+
+namespace nocycle {
+
+std::atomic<const BulkKernels::Table*> BulkKernels::s_activeTable (NULL);
+
+namespace {
+
+const unsigned tritsInPacked = BulkKernels::tritsInPacked;
+
+//
+// SCALAR
+//
+
+void DecodeTritsScalar(const uint32_t* packed, size_t numWords, uint32_t* ones, uint32_t* twos) {
+    for (size_t index = 0; index < numWords; index++) {
+        uint32_t value = packed[index];
+        uint32_t onesMask = 0;
+        uint32_t twosMask = 0;
+        for (unsigned digit = 0; (digit < tritsInPacked) && (value != 0); digit++) {
+            uint32_t quotient = value / 3;
+            uint32_t trit = value - quotient * 3;
+            onesMask |= static_cast<uint32_t>(trit == 1) << digit;
+            twosMask |= static_cast<uint32_t>(trit == 2) << digit;
+            value = quotient;
+        }
+        ones[index] = onesMask;
+        twos[index] = twosMask;
+    }
+}
+
+size_t CountNonzeroTritsScalar(const uint32_t* packed, size_t numWords) {
+    size_t count = 0;
+    for (size_t index = 0; index < numWords; index++) {
+        uint32_t value = packed[index];
+        for (unsigned digit = 0; (digit < tritsInPacked) && (value != 0); digit++) {
+            if (value % 3 != 0)
+                count++;
+            value = value / 3;
+        }
+    }
+    return count;
+}
+
+size_t SkipZeroPackedScalar(const uint32_t* packed, size_t numWords) {
+    size_t index = 0;
+    while ((index < numWords) && (packed[index] == 0))
+        index++;
+    return index;
+}
+
+size_t SkipZeroWordsScalar(const uint64_t* words, size_t numWords) {
+    size_t index = 0;
+    while ((index < numWords) && (words[index] == 0))
+        index++;
+    return index;
+}
+
+void OrWordsScalar(uint64_t* target, const uint64_t* source, size_t numWords) {
+    for (size_t index = 0; index < numWords; index++)
+        target[index] |= source[index];
+}
+
+void AndWordsScalar(uint64_t* target, const uint64_t* source, size_t numWords) {
+    for (size_t index = 0; index < numWords; index++)
+        target[index] &= source[index];
+}
+
+void AndNotWordsScalar(uint64_t* target, const uint64_t* source, size_t numWords) {
+    for (size_t index = 0; index < numWords; index++)
+        target[index] &= ~source[index];
+}
+
+size_t PopcountWordsScalar(const uint64_t* words, size_t numWords) {
+    size_t count = 0;
+    for (size_t index = 0; index < numWords; index++)
+        count += static_cast<size_t>(__builtin_popcountll(words[index]));
+    return count;
+}
+
+#if BULKKERNELS_X86
+
+// Dividing by 3 is a multiply by 0xAAAAAAAB and a shift right by 33.  There
+// is no instruction for the high half of a 32-bit multiply, so the even and
+// odd lanes are done as 64-bit products and put back together.  Decoding stops
+// once every lane is down to zero, as most words in a sparse graph start out.
+//
+// http://www.hackersdelight.org/divcMore.pdf
+
+const int divideBy3Magic = static_cast<int>(0xAAAAAAABu);
+
+//
+// SSE4.2
+//
+
+__attribute__((target("sse4.2,popcnt")))
+inline __m128i DivideBy3SSE42(__m128i value) {
+    const __m128i magic = _mm_set1_epi32(divideBy3Magic);
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(value, magic), 33);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(value, 32), magic), 33);
+    return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+__attribute__((target("sse4.2,popcnt")))
+inline void DecodeFourSSE42(const uint32_t* packed, __m128i& ones, __m128i& twos) {
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed));
+    __m128i bit = one;
+    ones = _mm_setzero_si128();
+    twos = _mm_setzero_si128();
+    for (unsigned digit = 0; (digit < tritsInPacked) && !_mm_testz_si128(value, value); digit++) {
+        __m128i quotient = DivideBy3SSE42(value);
+        __m128i trit = _mm_sub_epi32(value, _mm_add_epi32(quotient, _mm_add_epi32(quotient, quotient)));
+        ones = _mm_or_si128(ones, _mm_and_si128(_mm_cmpeq_epi32(trit, one), bit));
+        twos = _mm_or_si128(twos, _mm_and_si128(_mm_cmpeq_epi32(trit, two), bit));
+        bit = _mm_add_epi32(bit, bit);
+        value = quotient;
+    }
+}
+
+__attribute__((target("sse4.2,popcnt")))
+void DecodeTritsSSE42(const uint32_t* packed, size_t numWords, uint32_t* ones, uint32_t* twos) {
+    size_t index = 0;
+    for (; index + 4 <= numWords; index += 4) {
+        __m128i onesMask, twosMask;
+        DecodeFourSSE42(packed + index, onesMask, twosMask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(ones + index), onesMask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(twos + index), twosMask);
+    }
+    DecodeTritsScalar(packed + index, numWords - index, ones + index, twos + index);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+size_t CountNonzeroTritsSSE42(const uint32_t* packed, size_t numWords) {
+    size_t count = 0;
+    size_t index = 0;
+    for (; index + 4 <= numWords; index += 4) {
+        __m128i onesMask, twosMask;
+        DecodeFourSSE42(packed + index, onesMask, twosMask);
+        __m128i nonzero = _mm_or_si128(onesMask, twosMask);
+        count += static_cast<size_t>(__builtin_popcountll(static_cast<uint64_t>(_mm_extract_epi64(nonzero, 0))));
+        count += static_cast<size_t>(__builtin_popcountll(static_cast<uint64_t>(_mm_extract_epi64(nonzero, 1))));
+    }
+    return count + CountNonzeroTritsScalar(packed + index, numWords - index);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+size_t SkipZeroPackedSSE42(const uint32_t* packed, size_t numWords) {
+    size_t index = 0;
+    for (; index + 4 <= numWords; index += 4) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + index));
+        if (!_mm_testz_si128(value, value))
+            break;
+    }
+    return index + SkipZeroPackedScalar(packed + index, numWords - index);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+size_t SkipZeroWordsSSE42(const uint64_t* words, size_t numWords) {
+    size_t index = 0;
+    for (; index + 2 <= numWords; index += 2) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + index));
+        if (!_mm_testz_si128(value, value))
+            break;
+    }
+    return index + SkipZeroWordsScalar(words + index, numWords - index);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+void OrWordsSSE42(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 2 <= numWords; index += 2) {
+        __m128i* into = reinterpret_cast<__m128i*>(target + index);
+        __m128i from = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + index));
+        _mm_storeu_si128(into, _mm_or_si128(_mm_loadu_si128(into), from));
+    }
+    OrWordsScalar(target + index, source + index, numWords - index);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+void AndWordsSSE42(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 2 <= numWords; index += 2) {
+        __m128i* into = reinterpret_cast<__m128i*>(target + index);
+        __m128i from = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + index));
+        _mm_storeu_si128(into, _mm_and_si128(_mm_loadu_si128(into), from));
+    }
+    AndWordsScalar(target + index, source + index, numWords - index);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+void AndNotWordsSSE42(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 2 <= numWords; index += 2) {
+        __m128i* into = reinterpret_cast<__m128i*>(target + index);
+        __m128i from = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + index));
+        _mm_storeu_si128(into, _mm_andnot_si128(from, _mm_loadu_si128(into)));
+    }
+    AndNotWordsScalar(target + index, source + index, numWords - index);
+}
+
+// SSE4.2 doesn't have a vector popcount, but it comes with the scalar one
+__attribute__((target("sse4.2,popcnt")))
+size_t PopcountWordsSSE42(const uint64_t* words, size_t numWords) {
+    size_t count = 0;
+    for (size_t index = 0; index < numWords; index++)
+        count += static_cast<size_t>(__builtin_popcountll(words[index]));
+    return count;
+}
+
+//
+// AVX2
+//
+
+__attribute__((target("avx2,popcnt")))
+inline __m256i DivideBy3AVX2(__m256i value) {
+    const __m256i magic = _mm256_set1_epi32(divideBy3Magic);
+    __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(value, magic), 33);
+    __m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(value, 32), magic), 33);
+    return _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+}
+
+__attribute__((target("avx2,popcnt")))
+inline void DecodeEightAVX2(const uint32_t* packed, __m256i& ones, __m256i& twos) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+    __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(packed));
+    __m256i bit = one;
+    ones = _mm256_setzero_si256();
+    twos = _mm256_setzero_si256();
+    for (unsigned digit = 0; (digit < tritsInPacked) && !_mm256_testz_si256(value, value); digit++) {
+        __m256i quotient = DivideBy3AVX2(value);
+        __m256i trit = _mm256_sub_epi32(value, _mm256_add_epi32(quotient, _mm256_add_epi32(quotient, quotient)));
+        ones = _mm256_or_si256(ones, _mm256_and_si256(_mm256_cmpeq_epi32(trit, one), bit));
+        twos = _mm256_or_si256(twos, _mm256_and_si256(_mm256_cmpeq_epi32(trit, two), bit));
+        bit = _mm256_add_epi32(bit, bit);
+        value = quotient;
+    }
+}
+
+// Wojciech Mula's popcount: look up the count for each nibble with a byte
+// shuffle, then sum the bytes of each 64-bit lane
+//
+// http://0x80.pl/articles/sse-popcount.html
+//
+__attribute__((target("avx2,popcnt")))
+inline __m256i PopcountLanesAVX2(__m256i value) {
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+    );
+    const __m256i lowNibbles = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_and_si256(value, lowNibbles);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(value, 4), lowNibbles);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2,popcnt")))
+inline size_t SumLanesAVX2(__m256i lanes) {
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(lanes), _mm256_extracti128_si256(lanes, 1));
+    return static_cast<size_t>(_mm_extract_epi64(sum, 0) + _mm_extract_epi64(sum, 1));
+}
+
+__attribute__((target("avx2,popcnt")))
+void DecodeTritsAVX2(const uint32_t* packed, size_t numWords, uint32_t* ones, uint32_t* twos) {
+    size_t index = 0;
+    for (; index + 8 <= numWords; index += 8) {
+        __m256i onesMask, twosMask;
+        DecodeEightAVX2(packed + index, onesMask, twosMask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ones + index), onesMask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(twos + index), twosMask);
+    }
+    DecodeTritsSSE42(packed + index, numWords - index, ones + index, twos + index);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t CountNonzeroTritsAVX2(const uint32_t* packed, size_t numWords) {
+    __m256i total = _mm256_setzero_si256();
+    size_t index = 0;
+    for (; index + 8 <= numWords; index += 8) {
+        __m256i onesMask, twosMask;
+        DecodeEightAVX2(packed + index, onesMask, twosMask);
+        total = _mm256_add_epi64(total, PopcountLanesAVX2(_mm256_or_si256(onesMask, twosMask)));
+    }
+    return SumLanesAVX2(total) + CountNonzeroTritsSSE42(packed + index, numWords - index);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t SkipZeroPackedAVX2(const uint32_t* packed, size_t numWords) {
+    size_t index = 0;
+    for (; index + 8 <= numWords; index += 8) {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(packed + index));
+        if (!_mm256_testz_si256(value, value))
+            break;
+    }
+    return index + SkipZeroPackedScalar(packed + index, numWords - index);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t SkipZeroWordsAVX2(const uint64_t* words, size_t numWords) {
+    size_t index = 0;
+    for (; index + 4 <= numWords; index += 4) {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + index));
+        if (!_mm256_testz_si256(value, value))
+            break;
+    }
+    return index + SkipZeroWordsScalar(words + index, numWords - index);
+}
+
+__attribute__((target("avx2,popcnt")))
+void OrWordsAVX2(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 4 <= numWords; index += 4) {
+        __m256i* into = reinterpret_cast<__m256i*>(target + index);
+        __m256i from = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + index));
+        _mm256_storeu_si256(into, _mm256_or_si256(_mm256_loadu_si256(into), from));
+    }
+    OrWordsScalar(target + index, source + index, numWords - index);
+}
+
+__attribute__((target("avx2,popcnt")))
+void AndWordsAVX2(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 4 <= numWords; index += 4) {
+        __m256i* into = reinterpret_cast<__m256i*>(target + index);
+        __m256i from = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + index));
+        _mm256_storeu_si256(into, _mm256_and_si256(_mm256_loadu_si256(into), from));
+    }
+    AndWordsScalar(target + index, source + index, numWords - index);
+}
+
+__attribute__((target("avx2,popcnt")))
+void AndNotWordsAVX2(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 4 <= numWords; index += 4) {
+        __m256i* into = reinterpret_cast<__m256i*>(target + index);
+        __m256i from = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + index));
+        _mm256_storeu_si256(into, _mm256_andnot_si256(from, _mm256_loadu_si256(into)));
+    }
+    AndNotWordsScalar(target + index, source + index, numWords - index);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t PopcountWordsAVX2(const uint64_t* words, size_t numWords) {
+    __m256i total = _mm256_setzero_si256();
+    size_t index = 0;
+    for (; index + 4 <= numWords; index += 4) {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + index));
+        total = _mm256_add_epi64(total, PopcountLanesAVX2(value));
+    }
+    return SumLanesAVX2(total) + PopcountWordsSSE42(words + index, numWords - index);
+}
+
+//
+// AVX-512 (foundation and byte/word instructions, as on Skylake-SP and later)
+//
+
+// GCC 12's intrinsics start many operations from _mm512_undefined_epi32(),
+// which -O3 then reports as "maybe uninitialized" once they're inlined here
+// (bogus: every lane gets written).  So that warning is off for this part.
+//
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+inline __m512i DivideBy3AVX512(__m512i value) {
+    const __m512i magic = _mm512_set1_epi32(divideBy3Magic);
+    __m512i even = _mm512_srli_epi64(_mm512_mul_epu32(value, magic), 33);
+    __m512i odd = _mm512_srli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(value, 32), magic), 33);
+    return _mm512_or_si512(even, _mm512_slli_epi64(odd, 32));
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+inline void DecodeSixteenAVX512(const uint32_t* packed, __m512i& ones, __m512i& twos) {
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i two = _mm512_set1_epi32(2);
+    __m512i value = _mm512_loadu_si512(packed);
+    __m512i bit = one;
+    ones = _mm512_setzero_si512();
+    twos = _mm512_setzero_si512();
+    for (unsigned digit = 0; (digit < tritsInPacked) && (_mm512_test_epi32_mask(value, value) != 0); digit++) {
+        __m512i quotient = DivideBy3AVX512(value);
+        __m512i trit = _mm512_sub_epi32(value, _mm512_add_epi32(quotient, _mm512_add_epi32(quotient, quotient)));
+        ones = _mm512_mask_or_epi32(ones, _mm512_cmpeq_epi32_mask(trit, one), ones, bit);
+        twos = _mm512_mask_or_epi32(twos, _mm512_cmpeq_epi32_mask(trit, two), twos, bit);
+        bit = _mm512_add_epi32(bit, bit);
+        value = quotient;
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+inline __m512i PopcountLanesAVX512(__m512i value) {
+    const __m512i lookup = _mm512_broadcast_i32x4(_mm_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+    ));
+    const __m512i lowNibbles = _mm512_set1_epi8(0x0F);
+    __m512i low = _mm512_and_si512(value, lowNibbles);
+    __m512i high = _mm512_and_si512(_mm512_srli_epi16(value, 4), lowNibbles);
+    __m512i counts = _mm512_add_epi8(_mm512_shuffle_epi8(lookup, low), _mm512_shuffle_epi8(lookup, high));
+    return _mm512_sad_epu8(counts, _mm512_setzero_si512());
+}
+
+// (_mm512_reduce_add_epi64 would do, but GCC 12 warns about its insides)
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+inline size_t SumLanesAVX512(__m512i lanes) {
+    uint64_t sums[8];
+    _mm512_storeu_si512(sums, lanes);
+    size_t total = 0;
+    for (unsigned lane = 0; lane < 8; lane++)
+        total += static_cast<size_t>(sums[lane]);
+    return total;
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+void DecodeTritsAVX512(const uint32_t* packed, size_t numWords, uint32_t* ones, uint32_t* twos) {
+    size_t index = 0;
+    for (; index + 16 <= numWords; index += 16) {
+        __m512i onesMask, twosMask;
+        DecodeSixteenAVX512(packed + index, onesMask, twosMask);
+        _mm512_storeu_si512(ones + index, onesMask);
+        _mm512_storeu_si512(twos + index, twosMask);
+    }
+    DecodeTritsAVX2(packed + index, numWords - index, ones + index, twos + index);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+size_t CountNonzeroTritsAVX512(const uint32_t* packed, size_t numWords) {
+    __m512i total = _mm512_setzero_si512();
+    size_t index = 0;
+    for (; index + 16 <= numWords; index += 16) {
+        __m512i onesMask, twosMask;
+        DecodeSixteenAVX512(packed + index, onesMask, twosMask);
+        total = _mm512_add_epi64(total, PopcountLanesAVX512(_mm512_or_si512(onesMask, twosMask)));
+    }
+    return SumLanesAVX512(total)
+        + CountNonzeroTritsAVX2(packed + index, numWords - index);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+size_t SkipZeroPackedAVX512(const uint32_t* packed, size_t numWords) {
+    size_t index = 0;
+    for (; index + 16 <= numWords; index += 16) {
+        __m512i value = _mm512_loadu_si512(packed + index);
+        if (_mm512_test_epi32_mask(value, value) != 0)
+            break;
+    }
+    return index + SkipZeroPackedScalar(packed + index, numWords - index);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+size_t SkipZeroWordsAVX512(const uint64_t* words, size_t numWords) {
+    size_t index = 0;
+    for (; index + 8 <= numWords; index += 8) {
+        __m512i value = _mm512_loadu_si512(words + index);
+        if (_mm512_test_epi64_mask(value, value) != 0)
+            break;
+    }
+    return index + SkipZeroWordsScalar(words + index, numWords - index);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+void OrWordsAVX512(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 8 <= numWords; index += 8) {
+        __m512i from = _mm512_loadu_si512(source + index);
+        _mm512_storeu_si512(target + index, _mm512_or_si512(_mm512_loadu_si512(target + index), from));
+    }
+    OrWordsAVX2(target + index, source + index, numWords - index);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+void AndWordsAVX512(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 8 <= numWords; index += 8) {
+        __m512i from = _mm512_loadu_si512(source + index);
+        _mm512_storeu_si512(target + index, _mm512_and_si512(_mm512_loadu_si512(target + index), from));
+    }
+    AndWordsAVX2(target + index, source + index, numWords - index);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+void AndNotWordsAVX512(uint64_t* target, const uint64_t* source, size_t numWords) {
+    size_t index = 0;
+    for (; index + 8 <= numWords; index += 8) {
+        __m512i from = _mm512_loadu_si512(source + index);
+        _mm512_storeu_si512(target + index, _mm512_andnot_si512(from, _mm512_loadu_si512(target + index)));
+    }
+    AndNotWordsAVX2(target + index, source + index, numWords - index);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+size_t PopcountWordsAVX512(const uint64_t* words, size_t numWords) {
+    __m512i total = _mm512_setzero_si512();
+    size_t index = 0;
+    for (; index + 8 <= numWords; index += 8)
+        total = _mm512_add_epi64(total, PopcountLanesAVX512(_mm512_loadu_si512(words + index)));
+    return SumLanesAVX512(total)
+        + PopcountWordsAVX2(words + index, numWords - index);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic pop
+#endif
+
+#endif // BULKKERNELS_X86
+
+} // end anonymous namespace
+
+
+//
+// DISPATCH
+//
+
+const BulkKernels::Table& BulkKernels::TableForPath(Path path) {
+    static const Table scalar = {
+        pathScalar,
+        DecodeTritsScalar, CountNonzeroTritsScalar,
+        SkipZeroPackedScalar, SkipZeroWordsScalar,
+        OrWordsScalar, AndWordsScalar, AndNotWordsScalar, PopcountWordsScalar
+    };
+  #if BULKKERNELS_X86
+    static const Table sse42 = {
+        pathSSE42,
+        DecodeTritsSSE42, CountNonzeroTritsSSE42,
+        SkipZeroPackedSSE42, SkipZeroWordsSSE42,
+        OrWordsSSE42, AndWordsSSE42, AndNotWordsSSE42, PopcountWordsSSE42
+    };
+    static const Table avx2 = {
+        pathAVX2,
+        DecodeTritsAVX2, CountNonzeroTritsAVX2,
+        SkipZeroPackedAVX2, SkipZeroWordsAVX2,
+        OrWordsAVX2, AndWordsAVX2, AndNotWordsAVX2, PopcountWordsAVX2
+    };
+    static const Table avx512 = {
+        pathAVX512,
+        DecodeTritsAVX512, CountNonzeroTritsAVX512,
+        SkipZeroPackedAVX512, SkipZeroWordsAVX512,
+        OrWordsAVX512, AndWordsAVX512, AndNotWordsAVX512, PopcountWordsAVX512
+    };
+  #endif
+
+    switch (path) {
+      #if BULKKERNELS_X86
+        case pathSSE42:
+            return sse42;
+        case pathAVX2:
+            return avx2;
+        case pathAVX512:
+            return avx512;
+      #endif
+        case pathScalar:
+        default:
+            return scalar;
+    }
+}
+
+bool BulkKernels::PathSupported(Path path) {
+    switch (path) {
+      case pathScalar:
+        return true;
+
+    #if BULKKERNELS_X86
+      // The cpu checks for AVX also make sure the OS saves the wider registers
+      case pathSSE42:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+      case pathAVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+      case pathAVX512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+            && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    #endif
+
+      default:
+        return false;
+    }
+}
+
+BulkKernels::Path BulkKernels::BestPath() {
+    for (int path = numPaths - 1; path > pathScalar; path--) {
+        if (PathSupported(static_cast<Path>(path)))
+            return static_cast<Path>(path);
+    }
+    return pathScalar;
+}
+
+const char* BulkKernels::PathName(Path path) {
+    switch (path) {
+      case pathScalar:
+        return "scalar";
+      case pathSSE42:
+        return "sse4.2";
+      case pathAVX2:
+        return "avx2";
+      case pathAVX512:
+        return "avx512";
+      default:
+        assert(false);
+        return "unknown";
+    }
+}
+
+void BulkKernels::SetPath(Path path) {
+    assert(PathSupported(path));
+    s_activeTable.store(&TableForPath(path), std::memory_order_release);
+}
+
+// If two threads get here at once they'll agree on the table, and if a
+// SetPath() got in first then it wins
+const BulkKernels::Table* BulkKernels::Resolve() {
+    const Table* expected = NULL;
+    s_activeTable.compare_exchange_strong(expected, &TableForPath(BestPath()));
+    return s_activeTable.load(std::memory_order_acquire);
+}
+
+} // end namespace nocycle
@@ -0,0 +1,120 @@
+//
+//  BulkKernels.hpp - Vectorized loops for the operations which touch
+//     whole buffers at once: decoding packed tristates, skipping words
+//     that are all zero, combining bitset rows and counting bits.  Each
+//     has scalar, SSE4.2, AVX2 and AVX-512 versions, and the best one
+//     the running CPU supports is picked the first time one is used.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint>
+
+namespace nocycle {
+
+// The choice is made at runtime rather than with compiler switches, so one
+// build runs at full speed on any x86 machine and still works on ones which
+// lack the newer instructions.  The kernels are reached through a table of
+// function pointers, one table per instruction set.  (GCC's target_clones
+// would do the same thing through ifunc, but gives no way to find out which
+// version got picked, or to force one for testing.)
+//
+// Anything that isn't x86-64 built with GCC or Clang only has the scalar path.
+//
+class BulkKernels {
+  public:
+    enum Path {
+        pathScalar,
+        pathSSE42,
+        pathAVX2,
+        pathAVX512,
+        numPaths
+    };
+
+    // Tristates are packed 20 to a 32-bit word, least significant first
+    static const unsigned tritsInPacked = 20;
+
+  private:
+    struct Table {
+        Path path;
+
+        // For each packed word, bit N of ones (twos) is set if trit N is 1 (2)
+        void (*decodeTrits)(const uint32_t* packed, size_t numWords, uint32_t* ones, uint32_t* twos);
+        size_t (*countNonzeroTrits)(const uint32_t* packed, size_t numWords);
+
+        // Index of the first nonzero word, or numWords if they are all zero
+        size_t (*skipZeroPacked)(const uint32_t* packed, size_t numWords);
+        size_t (*skipZeroWords)(const uint64_t* words, size_t numWords);
+
+        void (*orWords)(uint64_t* target, const uint64_t* source, size_t numWords);
+        void (*andWords)(uint64_t* target, const uint64_t* source, size_t numWords);
+        void (*andNotWords)(uint64_t* target, const uint64_t* source, size_t numWords);
+        size_t (*popcountWords)(const uint64_t* words, size_t numWords);
+    };
+
+    // Starts out NULL (constant initialized, so it's safe to use the kernels
+    // from other static initializers) and is filled in by Resolve()
+    static std::atomic<const Table*> s_activeTable;
+
+  private:
+    static const Table& TableForPath(Path path);
+    static const Table* Resolve();
+
+    static const Table& Active() {
+        const Table* table = s_activeTable.load(std::memory_order_acquire);
+        return (table != NULL) ? *table : *Resolve();
+    }
+
+  public:
+    static bool PathSupported(Path path);
+    static Path BestPath(); // the path that is used unless SetPath() says otherwise
+    static const char* PathName(Path path);
+
+    static Path ActivePath() {
+        return Active().path;
+    }
+
+    // For tests and benchmarks which want to compare the paths.  The path
+    // has to be supported by the CPU.
+    static void SetPath(Path path);
+
+  public:
+    static void DecodeTrits(const uint32_t* packed, size_t numWords, uint32_t* ones, uint32_t* twos) {
+        Active().decodeTrits(packed, numWords, ones, twos);
+    }
+    static size_t CountNonzeroTrits(const uint32_t* packed, size_t numWords) {
+        return Active().countNonzeroTrits(packed, numWords);
+    }
+    static size_t SkipZeroPacked(const uint32_t* packed, size_t numWords) {
+        return Active().skipZeroPacked(packed, numWords);
+    }
+    static size_t SkipZeroWords(const uint64_t* words, size_t numWords) {
+        return Active().skipZeroWords(words, numWords);
+    }
+    static void OrWords(uint64_t* target, const uint64_t* source, size_t numWords) {
+        Active().orWords(target, source, numWords);
+    }
+    static void AndWords(uint64_t* target, const uint64_t* source, size_t numWords) {
+        Active().andWords(target, source, numWords);
+    }
+    static void AndNotWords(uint64_t* target, const uint64_t* source, size_t numWords) {
+        Active().andNotWords(target, source, numWords);
+    }
+    static size_t PopcountWords(const uint64_t* words, size_t numWords) {
+        return Active().popcountWords(words, numWords);
+    }
+};
+
+} // end namespace nocycle
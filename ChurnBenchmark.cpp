@@ -0,0 +1,222 @@
+//
+//  ChurnBenchmark.cpp - Long running soak of a DirectedAcyclicGraph whose
+//      vertices keep arriving and dying, sampling the process RSS, how
+//      much buffer is held against how much the live vertices need, and
+//      operation latency as it goes.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+//  Each step a vertex arrives, taking the next free ID as they climb
+//  toward ID_SPACE (and then wrap around), with edges out to some live
+//  vertices.  Once the population is full, a random live vertex dies for
+//  each one that arrives.  A few edges are toggled and a few CanReach
+//  questions are asked each step too, and some of the answers are checked
+//  against a plain search, so stale closure data would show up as wrong.
+//
+//  The whole thing is run once destroying vertices with compaction and
+//  once without, so what compactIfDestroy gives back can be compared.
+//
+//  usage: ChurnBenchmark [steps [cleaningBudget]]
+//
+
+const unsigned NUM_LIVE_VERTICES = 256;
+const unsigned ID_SPACE = NUM_LIVE_VERTICES * 4;
+const unsigned EDGES_PER_ARRIVAL = 4;
+const unsigned EDGE_TOGGLES_PER_STEP = 2;
+const unsigned QUERIES_PER_STEP = 4;
+const unsigned CHECK_EVERY_NTH_QUERY = 4;
+const unsigned NUM_SAMPLES = 20;
+const unsigned DEFAULT_STEPS = 20000;
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#if defined(__linux__)
+    #include <unistd.h> // sysconf
+#endif
+
+#include "DirectedAcyclicGraph.hpp"
+#include "LatencyHistogram.hpp"
+
+using nocycle::DirectedAcyclicGraph;
+using nocycle::LatencyHistogram;
+
+typedef DirectedAcyclicGraph::VertexID VertexID;
+
+// 0 where there's no /proc to ask
+static size_t ResidentSetBytes() {
+  #if defined(__linux__)
+    std::ifstream statm ("/proc/self/statm");
+    size_t totalPages = 0;
+    size_t residentPages = 0;
+    statm >> totalPages >> residentPages;
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  #else
+    return 0;
+  #endif
+}
+
+// Tristates an OrientedGraph needs for IDs [0..numVertices-1], which is
+// what the live vertices would take if their IDs were packed together
+static size_t TristatesForVertices(size_t numVertices) {
+    return numVertices * (numVertices + 1) / 2;
+}
+
+template<class Work>
+static void Timed(LatencyHistogram& histogram, Work work) {
+    auto start = std::chrono::steady_clock::now();
+    work();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    histogram.Add(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+}
+
+static void Soak(unsigned numSteps, bool compactIfDestroy, size_t cleaningBudget) {
+    std::mt19937 random (1);
+
+    DirectedAcyclicGraph dag (0);
+  #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+    dag.SetCleaningBudget(cleaningBudget);
+  #else
+    (void)cleaningBudget;
+  #endif
+
+    std::vector<VertexID> live;
+    VertexID nextID = 0;
+
+    size_t cyclesRefused = 0;
+    size_t answersChecked = 0;
+    size_t answersWrong = 0;
+    LatencyHistogram operations;
+    LatencyHistogram queries;
+
+    auto pickLive = [&]() {
+        return live[random() % live.size()];
+    };
+
+    std::cout << (compactIfDestroy ? "Destroying with compaction:" : "Destroying without compaction:") << std::endl;
+    std::cout << std::setw(8) << "step" << std::setw(7) << "live"
+        << std::setw(9) << "firstID" << std::setw(10) << "trits"
+        << std::setw(10) << "packed" << std::setw(9) << "capKB"
+        << std::setw(9) << "rssKB" << std::setw(9) << "op p50"
+        << std::setw(9) << "op p99" << std::setw(10) << "reach p99"
+        << std::setw(9) << "backlog" << std::setw(7) << "wrong" << std::endl;
+
+    unsigned stepsPerSample = std::max(numSteps / NUM_SAMPLES, 1u);
+    for (unsigned step = 1; step <= numSteps; step++) {
+
+        // Arrival, at the first free ID from where the last one went
+        while ((nextID < dag.GetFirstInvalidVertexID()) && dag.VertexExists(nextID))
+            nextID = (nextID + 1) % ID_SPACE;
+        VertexID vertex = nextID;
+        nextID = (nextID + 1) % ID_SPACE;
+        Timed(operations, [&]() {
+            if (vertex >= dag.GetFirstInvalidVertexID())
+                dag.GrowCapacityForMaxValidVertexID(vertex);
+            dag.CreateVertex(vertex);
+
+            // Nothing points to the new vertex yet, so these can't make a cycle
+            for (unsigned index = 0; (index < EDGES_PER_ARRIVAL) && !live.empty(); index++)
+                dag.SetEdge(vertex, pickLive());
+        });
+        live.push_back(vertex);
+
+        // Departure
+        if (live.size() > NUM_LIVE_VERTICES) {
+            size_t index = random() % live.size();
+            VertexID dying = live[index];
+            live[index] = live.back();
+            live.pop_back();
+            Timed(operations, [&]() {
+                if (compactIfDestroy)
+                    dag.DestroyVertex(dying);
+                else
+                    dag.DestroyVertexDontCompact(dying);
+            });
+        }
+
+        for (unsigned index = 0; index < EDGE_TOGGLES_PER_STEP; index++) {
+            VertexID fromVertex = pickLive();
+            VertexID toVertex = pickLive();
+            if (fromVertex == toVertex)
+                continue;
+            Timed(operations, [&]() {
+                if (dag.EdgeExists(fromVertex, toVertex)) {
+                    dag.ClearEdge(fromVertex, toVertex);
+                } else if (!dag.EdgeExists(toVertex, fromVertex)) {
+                    try {
+                        dag.SetEdge(fromVertex, toVertex);
+                    } catch (nocycle::bad_cycle&) {
+                        cyclesRefused++;
+                    }
+                }
+            });
+        }
+
+        for (unsigned index = 0; index < QUERIES_PER_STEP; index++) {
+            VertexID fromVertex = pickLive();
+            VertexID toVertex = pickLive();
+            if (fromVertex == toVertex)
+                continue;
+            bool answer = false;
+            Timed(queries, [&]() {
+                answer = dag.CanReach(fromVertex, toVertex);
+            });
+            if ((step * QUERIES_PER_STEP + index) % CHECK_EVERY_NTH_QUERY == 0) {
+                answersChecked++;
+                if (answer != dag.OrientedGraph::CanReach(fromVertex, toVertex))
+                    answersWrong++;
+            }
+        }
+
+        if (step % stepsPerSample == 0) {
+            LatencyHistogram all = operations;
+            all.Merge(queries);
+            size_t backlog = 0;
+          #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+            backlog = dag.DirtyBacklog();
+          #endif
+            std::cout << std::fixed << std::setprecision(2)
+                << std::setw(8) << step << std::setw(7) << live.size()
+                << std::setw(9) << dag.GetFirstInvalidVertexID()
+                << std::setw(10) << TristatesForVertices(dag.GetFirstInvalidVertexID())
+                << std::setw(10) << TristatesForVertices(live.size())
+                << std::setw(9) << dag.BufferCapacityBytes() / 1024
+                << std::setw(9) << ResidentSetBytes() / 1024
+                << std::setw(9) << all.PercentileMicroseconds(0.5)
+                << std::setw(9) << all.PercentileMicroseconds(0.99)
+                << std::setw(10) << queries.PercentileMicroseconds(0.99)
+                << std::setw(9) << backlog << std::setw(7) << answersWrong << std::endl;
+            operations.Clear();
+            queries.Clear();
+        }
+    }
+
+    std::cout << "Refused " << cyclesRefused << " cycles, checked " << answersChecked
+        << " answers and found " << answersWrong << " wrong" << std::endl << std::endl;
+}
+
+int main (int argc, char * const argv[]) {
+    unsigned numSteps = (argc > 1) ? static_cast<unsigned>(atoi(argv[1])) : DEFAULT_STEPS;
+    size_t cleaningBudget = (argc > 2) ? static_cast<size_t>(atoi(argv[2])) : 0;
+
+    std::cout << numSteps << " steps, " << NUM_LIVE_VERTICES << " live vertices with IDs below "
+        << ID_SPACE << ", cleaning budget " << cleaningBudget << std::endl;
+    std::cout << "(latencies in microseconds, trits is the buffer length in tristates"
+        << " and packed what the live vertices would need with consecutive IDs)" << std::endl << std::endl;
+
+    Soak(numSteps, true, cleaningBudget);
+    Soak(numSteps, false, cleaningBudget);
+    return 0;
+}
@@ -0,0 +1,241 @@
+//
+//  ClosureBenchmark.cpp - Runs the same random workload against the
+//      DirectedAcyclicGraph as configured and against a CountingClosure
+//      kept beside a plain OrientedGraph, timing edge additions, edge
+//      removals and reachability questions on each side.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+//  Configure with DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY to compare the
+//  counting closure against the tristate closure.  (Under other settings
+//  the DAG side is whatever those settings give, e.g. plain searches.)
+//
+//  The vertices are created one at a time with the capacity growing to
+//  fit, then each step toggles a few random edges (refusing the ones that
+//  would make a cycle) and asks a few CanReach questions.  Both sides see
+//  the same choices, so their answers are compared as they go.
+//
+//  usage: ClosureBenchmark [numVertices [steps]]
+//
+
+const unsigned DEFAULT_NUM_VERTICES = 256;
+const unsigned DEFAULT_STEPS = 2000;
+const unsigned INITIAL_EDGES_PER_VERTEX = 2;
+const unsigned EDGE_TOGGLES_PER_STEP = 2;
+const unsigned QUERIES_PER_STEP = 4;
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "DirectedAcyclicGraph.hpp"
+#include "CountingClosure.hpp"
+#include "LatencyHistogram.hpp"
+
+using nocycle::DirectedAcyclicGraph;
+using nocycle::OrientedGraph;
+using nocycle::CountingClosure;
+using nocycle::VertexBitset;
+using nocycle::LatencyHistogram;
+
+typedef DirectedAcyclicGraph::VertexID VertexID;
+
+static const char* ConfiguredClosureName() {
+  #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+    return "tristate closure";
+  #elif DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+    return "counting closure (DAG)";
+  #else
+    return "DAG, no closure";
+  #endif
+}
+
+class ConfiguredSide {
+  private:
+    DirectedAcyclicGraph m_dag;
+
+  public:
+    void Grow(VertexID vertex) {
+        m_dag.GrowCapacityForMaxValidVertexID(vertex);
+        m_dag.CreateVertex(vertex);
+    }
+    bool EdgeExists(VertexID fromVertex, VertexID toVertex) const {
+        return m_dag.EdgeExists(fromVertex, toVertex);
+    }
+    bool AddEdge(VertexID fromVertex, VertexID toVertex) {
+        try {
+            m_dag.SetEdge(fromVertex, toVertex);
+        } catch (nocycle::bad_cycle&) {
+            return false;
+        }
+        return true;
+    }
+    void RemoveEdge(VertexID fromVertex, VertexID toVertex) {
+        m_dag.ClearEdge(fromVertex, toVertex);
+    }
+    bool CanReach(VertexID fromVertex, VertexID toVertex) {
+        return m_dag.CanReach(fromVertex, toVertex);
+    }
+    size_t BufferCapacityBytes() const {
+        return m_dag.BufferCapacityBytes();
+    }
+
+  public:
+    ConfiguredSide() : m_dag (0) {
+    }
+};
+
+// The counting closure refuses cycles by itself, so the graph beside it
+// only has to hold the edges (for recomputing rows that saturated)
+class CountingSide {
+  private:
+    OrientedGraph m_graph;
+    CountingClosure m_counting;
+
+  public:
+    void Grow(VertexID vertex) {
+        m_graph.GrowCapacityForMaxValidVertexID(vertex);
+        m_graph.CreateVertex(vertex);
+        m_counting.Resize(m_graph.GetFirstInvalidVertexID());
+    }
+    bool EdgeExists(VertexID fromVertex, VertexID toVertex) const {
+        return m_graph.EdgeExists(fromVertex, toVertex);
+    }
+    bool AddEdge(VertexID fromVertex, VertexID toVertex) {
+        if (m_counting.Reaches(toVertex, fromVertex))
+            return false;
+        m_graph.SetEdge(fromVertex, toVertex);
+        m_counting.AddEdge(fromVertex, toVertex);
+        return true;
+    }
+    void RemoveEdge(VertexID fromVertex, VertexID toVertex) {
+        m_graph.ClearEdge(fromVertex, toVertex);
+        m_counting.RemoveEdge(fromVertex, toVertex, [&](VertexID vertex, auto callback) {
+            VertexBitset children = m_graph.NeighborsForVertex(vertex, OrientedGraph::searchOutgoing);
+            children.ForEach(callback);
+        });
+    }
+    bool CanReach(VertexID fromVertex, VertexID toVertex) {
+        return m_counting.Reaches(fromVertex, toVertex);
+    }
+    size_t BufferCapacityBytes() const {
+        return m_graph.BufferCapacityBytes() + m_counting.BufferCapacityBytes();
+    }
+
+  public:
+    CountingSide() : m_graph (0) {
+    }
+};
+
+template<class Work>
+static void Timed(LatencyHistogram& histogram, Work work) {
+    auto start = std::chrono::steady_clock::now();
+    work();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    histogram.Add(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+// The answers (and whether each edge was refused) go into the transcript,
+// so the two sides can be checked against each other afterward
+template<class Side>
+static void Run(const char* name, unsigned numVertices, unsigned numSteps, std::vector<bool>& transcript) {
+    std::mt19937 random (1);
+    Side side;
+    LatencyHistogram adds;
+    LatencyHistogram removes;
+    LatencyHistogram queries;
+
+    auto start = std::chrono::steady_clock::now();
+    for (VertexID vertex = 0; vertex < numVertices; vertex++)
+        side.Grow(vertex);
+    double growMilliseconds = MillisecondsSince(start);
+
+    auto toggle = [&](VertexID fromVertex, VertexID toVertex) {
+        if (fromVertex == toVertex)
+            return;
+        if (side.EdgeExists(fromVertex, toVertex)) {
+            Timed(removes, [&]() {
+                side.RemoveEdge(fromVertex, toVertex);
+            });
+        } else if (!side.EdgeExists(toVertex, fromVertex)) {
+            bool added = false;
+            Timed(adds, [&]() {
+                added = side.AddEdge(fromVertex, toVertex);
+            });
+            transcript.push_back(added);
+        }
+    };
+
+    for (VertexID vertex = 0; vertex < numVertices; vertex++) {
+        for (unsigned index = 0; index < INITIAL_EDGES_PER_VERTEX; index++)
+            toggle(vertex, random() % numVertices);
+    }
+
+    for (unsigned step = 0; step < numSteps; step++) {
+        for (unsigned index = 0; index < EDGE_TOGGLES_PER_STEP; index++)
+            toggle(random() % numVertices, random() % numVertices);
+
+        for (unsigned index = 0; index < QUERIES_PER_STEP; index++) {
+            VertexID fromVertex = random() % numVertices;
+            VertexID toVertex = random() % numVertices;
+            if (fromVertex == toVertex)
+                continue;
+            bool answer = false;
+            Timed(queries, [&]() {
+                answer = side.CanReach(fromVertex, toVertex);
+            });
+            transcript.push_back(answer);
+        }
+    }
+    double totalMilliseconds = MillisecondsSince(start);
+
+    std::cout << std::fixed << std::setprecision(2)
+        << std::setw(24) << name << std::setw(10) << growMilliseconds
+        << std::setw(9) << adds.PercentileMicroseconds(0.5)
+        << std::setw(9) << adds.PercentileMicroseconds(0.99)
+        << std::setw(9) << removes.PercentileMicroseconds(0.5)
+        << std::setw(9) << removes.PercentileMicroseconds(0.99)
+        << std::setw(11) << queries.PercentileMicroseconds(0.5)
+        << std::setw(11) << queries.PercentileMicroseconds(0.99)
+        << std::setw(10) << totalMilliseconds
+        << std::setw(9) << side.BufferCapacityBytes() / 1024 << std::endl;
+}
+
+int main (int argc, char * const argv[]) {
+    unsigned numVertices = (argc > 1) ? static_cast<unsigned>(atoi(argv[1])) : DEFAULT_NUM_VERTICES;
+    unsigned numSteps = (argc > 2) ? static_cast<unsigned>(atoi(argv[2])) : DEFAULT_STEPS;
+
+    std::cout << numVertices << " vertices, " << numSteps << " steps"
+        << " (latencies in microseconds, grow and total in milliseconds)" << std::endl << std::endl;
+    std::cout << std::setw(24) << "" << std::setw(10) << "grow"
+        << std::setw(9) << "add p50" << std::setw(9) << "add p99"
+        << std::setw(9) << "rem p50" << std::setw(9) << "rem p99"
+        << std::setw(11) << "reach p50" << std::setw(11) << "reach p99"
+        << std::setw(10) << "total" << std::setw(9) << "capKB" << std::endl;
+
+    std::vector<bool> configuredTranscript;
+    std::vector<bool> countingTranscript;
+    Run<ConfiguredSide>(ConfiguredClosureName(), numVertices, numSteps, configuredTranscript);
+    Run<CountingSide>("counting closure", numVertices, numSteps, countingTranscript);
+
+    if (configuredTranscript != countingTranscript) {
+        std::cout << std::endl << "FAILURE: The two sides disagreed about reachability." << std::endl;
+        return 1;
+    }
+    return 0;
+}
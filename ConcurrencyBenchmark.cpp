@@ -0,0 +1,338 @@
+//
+//  ConcurrencyBenchmark.cpp - Runs mixes of reader and writer threads
+//      against an OrientedGraph and a DirectedAcyclicGraph, for thread
+//      counts from one up to all of the cores, and reports throughput,
+//      latency percentiles and how well each mix scales.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+//  The graphs don't lock anything themselves, so readers share a
+//  std::shared_mutex and writers take it exclusively, which is what a
+//  program using nocycle from several threads has to do today.  The
+//  DirectedAcyclicGraph is also run behind AsyncDirectedAcyclicGraph,
+//  where every operation goes through the writer thread's queue.
+//
+//  usage: ConcurrencyBenchmark [maxThreads [secondsPerRun]]
+//
+
+const unsigned NUM_GRAPH_NODES = 1024;
+const unsigned NUM_INITIAL_EDGES = NUM_GRAPH_NODES * 4;
+const double DEFAULT_SECONDS_PER_RUN = 0.25;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "OrientedGraph.hpp"
+#include "DirectedAcyclicGraph.hpp"
+#include "AsyncDirectedAcyclicGraph.hpp"
+#include "LatencyHistogram.hpp"
+
+using nocycle::OrientedGraph;
+using nocycle::DirectedAcyclicGraph;
+using nocycle::AsyncDirectedAcyclicGraph;
+using nocycle::LatencyHistogram;
+
+typedef OrientedGraph::VertexID VertexID;
+
+// Reads from a tiled buffer move tiles around in its cache, and CanReach
+// on a DirectedAcyclicGraph cleans or fills whatever caches are compiled
+// in, so in those builds the "reads" have to be exclusive too
+const bool graphReadsAreShared = !NSTATE_TILED_FILE_STORAGE;
+const bool dagCanReachIsShared = graphReadsAreShared
+    && !DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+    && !DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+    && !DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+    && !DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES;
+
+struct ThreadResult {
+    LatencyHistogram reads;
+    LatencyHistogram writes;
+    size_t sink;
+};
+
+struct RunResult {
+    double seconds;
+    size_t sink;
+    LatencyHistogram reads;
+    LatencyHistogram writes;
+};
+
+// What each target does for one read or one write, picked by the thread's
+// random number generator.  All edges point from lower to higher IDs, so
+// a write just toggles one such edge, and the DAG never sees a cycle.
+class Target {
+  public:
+    virtual const char* Name() const = 0;
+    virtual size_t Read(std::mt19937& random) = 0;
+    virtual void Write(std::mt19937& random) = 0;
+    virtual void Finish() { }
+
+    static void PickPair(std::mt19937& random, VertexID& lowVertex, VertexID& highVertex) {
+        lowVertex = static_cast<VertexID>(random() % NUM_GRAPH_NODES);
+        do {
+            highVertex = static_cast<VertexID>(random() % NUM_GRAPH_NODES);
+        } while (highVertex == lowVertex);
+        if (lowVertex > highVertex)
+            std::swap(lowVertex, highVertex);
+    }
+
+  public:
+    virtual ~Target() { }
+};
+
+// Reads are HasLinkage, a walk over the outgoing edges, and CanReach in
+// equal parts
+template<class Graph>
+class LockedTarget : public Target {
+  private:
+    const char* m_name;
+    Graph& m_graph;
+    bool m_canReachIsShared;
+    std::shared_mutex m_mutex;
+
+    template<class Work>
+    size_t ReadLocked(bool shared, Work work) {
+        if (shared) {
+            std::shared_lock<std::shared_mutex> lock (m_mutex);
+            return work();
+        }
+        std::unique_lock<std::shared_mutex> lock (m_mutex);
+        return work();
+    }
+
+  public:
+    const char* Name() const {
+        return m_name;
+    }
+    size_t Read(std::mt19937& random) {
+        VertexID fromVertex;
+        VertexID toVertex;
+        PickPair(random, fromVertex, toVertex);
+        switch (random() % 3) {
+          case 0:
+            return ReadLocked(graphReadsAreShared, [&]() {
+                return static_cast<size_t>(m_graph.HasLinkage(fromVertex, toVertex));
+            });
+          case 1:
+            return ReadLocked(graphReadsAreShared, [&]() {
+                return m_graph.OutgoingEdgesForVertex(fromVertex).size();
+            });
+          default:
+            return ReadLocked(m_canReachIsShared, [&]() {
+                return static_cast<size_t>(m_graph.CanReach(fromVertex, toVertex));
+            });
+        }
+    }
+    void Write(std::mt19937& random) {
+        VertexID fromVertex;
+        VertexID toVertex;
+        PickPair(random, fromVertex, toVertex);
+        std::unique_lock<std::shared_mutex> lock (m_mutex);
+        if (m_graph.EdgeExists(fromVertex, toVertex))
+            m_graph.ClearEdge(fromVertex, toVertex);
+        else
+            m_graph.SetEdge(fromVertex, toVertex);
+    }
+
+  public:
+    LockedTarget(const char* name, Graph& graph, bool canReachIsShared) :
+        m_name (name),
+        m_graph (graph),
+        m_canReachIsShared (canReachIsShared)
+    {
+    }
+};
+
+// Only CanReach can be asked of the queue, so that is the only read, and
+// every operation waits for its future
+class AsyncTarget : public Target {
+  private:
+    AsyncDirectedAcyclicGraph m_async;
+
+  public:
+    const char* Name() const {
+        return "async dag";
+    }
+    size_t Read(std::mt19937& random) {
+        VertexID fromVertex;
+        VertexID toVertex;
+        PickPair(random, fromVertex, toVertex);
+        return static_cast<size_t>(m_async.SubmitCanReach(fromVertex, toVertex).get());
+    }
+    void Write(std::mt19937& random) {
+        VertexID fromVertex;
+        VertexID toVertex;
+        PickPair(random, fromVertex, toVertex);
+        if (m_async.SubmitAddEdge(fromVertex, toVertex).get() == AsyncDirectedAcyclicGraph::resultNoChange)
+            m_async.SubmitRemoveEdge(fromVertex, toVertex).get();
+    }
+    void Finish() {
+        m_async.Stop();
+    }
+
+  public:
+    AsyncTarget(DirectedAcyclicGraph& dag) :
+        m_async (dag)
+    {
+    }
+};
+
+// Every thread waits until all are ready, then runs operations until told
+// to stop; writePercent of them are writes
+static RunResult Run(Target& target, unsigned numThreads, unsigned writePercent, double seconds) {
+    std::vector<ThreadResult> threadResults (numThreads);
+    std::atomic<unsigned> ready (0);
+    std::atomic<bool> go (false);
+    std::atomic<bool> stop (false);
+
+    std::vector<std::thread> threads;
+    for (unsigned threadIndex = 0; threadIndex < numThreads; threadIndex++) {
+        threads.push_back(std::thread([&, threadIndex]() {
+            ThreadResult& result = threadResults[threadIndex];
+            result.sink = 0;
+            std::mt19937 random (threadIndex * 7919 + writePercent);
+            ready++;
+            while (!go.load())
+                std::this_thread::yield();
+            while (!stop.load(std::memory_order_relaxed)) {
+                bool write = (random() % 100) < writePercent;
+                auto start = std::chrono::steady_clock::now();
+                if (write)
+                    target.Write(random);
+                else
+                    result.sink += target.Read(random);
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                uint64_t nanoseconds = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                if (write)
+                    result.writes.Add(nanoseconds);
+                else
+                    result.reads.Add(nanoseconds);
+            }
+        }));
+    }
+
+    while (ready.load() < numThreads)
+        std::this_thread::yield();
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true);
+    for (unsigned threadIndex = 0; threadIndex < numThreads; threadIndex++)
+        threads[threadIndex].join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    RunResult result;
+    result.seconds = std::chrono::duration<double>(elapsed).count();
+    result.sink = 0;
+    for (unsigned threadIndex = 0; threadIndex < numThreads; threadIndex++) {
+        result.sink += threadResults[threadIndex].sink;
+        result.reads.Merge(threadResults[threadIndex].reads);
+        result.writes.Merge(threadResults[threadIndex].writes);
+    }
+    return result;
+}
+
+template<class Graph>
+void AddInitialEdges(Graph& graph) {
+    std::mt19937 random (1);
+    for (VertexID vertex = 0; vertex < NUM_GRAPH_NODES; vertex++)
+        graph.CreateVertex(vertex);
+    for (unsigned index = 0; index < NUM_INITIAL_EDGES; index++) {
+        VertexID fromVertex;
+        VertexID toVertex;
+        Target::PickPair(random, fromVertex, toVertex);
+        graph.SetEdge(fromVertex, toVertex);
+    }
+}
+
+// Scaling efficiency is throughput over the one thread throughput times
+// the number of threads, so 1.00 is perfect scaling
+static void Sweep(Target& target, const std::vector<unsigned>& threadCounts, double seconds, size_t& sink) {
+    const unsigned writePercents[] = {0, 5, 20, 50};
+
+    for (unsigned writePercent : writePercents) {
+        std::cout << target.Name() << ", " << writePercent << "% writes:" << std::endl;
+        std::cout << std::setw(8) << "threads" << std::setw(12) << "kops/s"
+            << std::setw(8) << "eff" << std::setw(10) << "p50 us"
+            << std::setw(12) << "read p99" << std::setw(12) << "write p99"
+            << std::setw(12) << "p99.9" << std::endl;
+
+        double singleThroughput = 0;
+        for (unsigned numThreads : threadCounts) {
+            RunResult result = Run(target, numThreads, writePercent, seconds);
+            sink += result.sink;
+            LatencyHistogram all = result.reads;
+            all.Merge(result.writes);
+            double throughput = static_cast<double>(all.Total()) / result.seconds;
+            if (numThreads == threadCounts[0])
+                singleThroughput = throughput / numThreads;
+
+            std::cout << std::fixed
+                << std::setw(8) << numThreads
+                << std::setprecision(1) << std::setw(12) << throughput / 1000
+                << std::setprecision(2) << std::setw(8) << throughput / (singleThroughput * numThreads)
+                << std::setprecision(2) << std::setw(10) << all.PercentileMicroseconds(0.5)
+                << std::setw(12) << result.reads.PercentileMicroseconds(0.99)
+                << std::setw(12) << result.writes.PercentileMicroseconds(0.99)
+                << std::setw(12) << all.PercentileMicroseconds(0.999) << std::endl;
+        }
+        std::cout << std::endl;
+    }
+}
+
+int main (int argc, char * const argv[]) {
+    unsigned maxThreads = std::thread::hardware_concurrency();
+    if (argc > 1)
+        maxThreads = static_cast<unsigned>(atoi(argv[1]));
+    if (maxThreads == 0)
+        maxThreads = 1;
+    double seconds = (argc > 2) ? atof(argv[2]) : DEFAULT_SECONDS_PER_RUN;
+
+    // Powers of two, and then all of the cores if that isn't one
+    std::vector<unsigned> threadCounts;
+    for (unsigned numThreads = 1; numThreads < maxThreads; numThreads *= 2)
+        threadCounts.push_back(numThreads);
+    threadCounts.push_back(maxThreads);
+
+    std::cout << NUM_GRAPH_NODES << " vertices, " << NUM_INITIAL_EDGES << " edges to start, "
+        << seconds << "s per run, up to " << maxThreads << " threads" << std::endl;
+    std::cout << "Reads are " << (graphReadsAreShared ? "shared" : "exclusive")
+        << ", DAG CanReach is " << (dagCanReachIsShared ? "shared" : "exclusive")
+        << " in this build" << std::endl << std::endl;
+
+    size_t sink = 0;
+
+    OrientedGraph graph (NUM_GRAPH_NODES);
+    AddInitialEdges(graph);
+    LockedTarget<OrientedGraph> graphTarget ("graph", graph, graphReadsAreShared);
+    Sweep(graphTarget, threadCounts, seconds, sink);
+
+    DirectedAcyclicGraph dag (NUM_GRAPH_NODES);
+    AddInitialEdges(dag);
+    LockedTarget<DirectedAcyclicGraph> dagTarget ("dag", dag, dagCanReachIsShared);
+    Sweep(dagTarget, threadCounts, seconds, sink);
+
+    AsyncTarget asyncTarget (dag);
+    Sweep(asyncTarget, threadCounts, seconds, sink);
+    asyncTarget.Finish();
+
+    std::cout << "(checksum " << sink << ")" << std::endl;
+    return 0;
+}
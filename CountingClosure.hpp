@@ -0,0 +1,223 @@
+//
+//  CountingClosure.hpp - Transitive closure of a directed acyclic graph
+//     which counts the paths between each pair of vertices instead of
+//     just recording whether there are any.  Removing an edge subtracts
+//     the paths that went through it, so reachability stays exact after
+//     deletions...there is never any "dirty" data to clean.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <utility> // pair
+#include <cstdint>
+#include <cassert>
+
+namespace nocycle {
+
+// This is the counting approach of King and Sagert (where a vertex can reach
+// another exactly when the count of paths between them is nonzero), with
+// one 32-bit count per ordered pair.  An edge from U to V adds or takes away
+// Paths(X, U) * Paths(V, Y) for every X reaching U and Y reachable from V.
+//
+// http://www.cs.uvic.ca/~val/Publications/ALG0.pdf (King and Sagert, "A Fully
+// Dynamic Algorithm for Maintaining the Transitive Closure")
+//
+// Path counts can grow exponentially, so they saturate rather than wrap.  A
+// saturated count can't have anything subtracted from it, so a removal that
+// touches one recomputes the affected rows from the rows of their children.
+// Rows are recomputed in order of how much they could reach before the
+// removal; a vertex always reaches strictly more than its children do, so
+// their rows are finished first.
+//
+class CountingClosure {
+  public:
+    typedef unsigned VertexID;
+    typedef uint32_t Count;
+    static const Count saturated = UINT32_MAX;
+
+  private:
+    std::vector<Count> m_counts; // row for the source, column for the target
+    size_t m_size;
+    size_t m_stride; // distance between rows, at least m_size
+
+  private:
+    Count& At(VertexID fromVertex, VertexID toVertex) {
+        return m_counts[fromVertex * m_stride + toVertex];
+    }
+    const Count& At(VertexID fromVertex, VertexID toVertex) const {
+        return m_counts[fromVertex * m_stride + toVertex];
+    }
+
+    static Count SaturatingAdd(Count left, Count right) {
+        return (left > saturated - right) ? saturated : left + right;
+    }
+    static Count SaturatingMultiply(Count left, Count right) {
+        uint64_t product = static_cast<uint64_t>(left) * right;
+        return (product >= saturated) ? saturated : static_cast<Count>(product);
+    }
+
+    // A vertex has exactly one (empty) path to itself
+    Count Paths(VertexID fromVertex, VertexID toVertex) const {
+        return (fromVertex == toVertex) ? 1 : At(fromVertex, toVertex);
+    }
+
+    void AncestorsAndDescendants(
+        VertexID fromVertex,
+        VertexID toVertex,
+        std::vector<VertexID>& ancestors,
+        std::vector<VertexID>& descendants
+    ) const {
+        for (VertexID vertex = 0; vertex < m_size; vertex++) {
+            if (Paths(vertex, fromVertex) != 0)
+                ancestors.push_back(vertex);
+            if (Paths(toVertex, vertex) != 0)
+                descendants.push_back(vertex);
+        }
+    }
+
+    size_t RowReach(VertexID vertex) const {
+        size_t reach = 0;
+        for (VertexID other = 0; other < m_size; other++) {
+            if (At(vertex, other) != 0)
+                reach++;
+        }
+        return reach;
+    }
+
+    template<class ForEachChild>
+    void RecomputeRow(VertexID vertex, ForEachChild forEachChild) {
+        for (VertexID other = 0; other < m_size; other++)
+            At(vertex, other) = 0;
+        forEachChild(vertex, [&](VertexID child) {
+            for (VertexID other = 0; other < m_size; other++)
+                At(vertex, other) = SaturatingAdd(At(vertex, other), Paths(child, other));
+        });
+    }
+
+  public:
+    // Keeps the counts among vertices below the new size.  Graphs tend to
+    // grow a vertex at a time, so the table is only reallocated when the
+    // size passes the stride (which then doubles) or falls under a quarter
+    // of it.  That copies the table O(log N) times as a graph grows to N
+    // vertices, for up to four times the memory a snug table would take.
+    void Resize(size_t size) {
+        if ((size > m_stride) || (size * 4 < m_stride)) {
+            size_t stride = (size > m_stride) ? std::max(size, m_stride * 2) : size;
+            std::vector<Count> counts (stride * stride, 0);
+            size_t keep = std::min(size, m_size);
+            for (size_t fromIndex = 0; fromIndex < keep; fromIndex++) {
+                const Count* row = m_counts.data() + fromIndex * m_stride;
+                std::copy(row, row + keep, counts.data() + fromIndex * stride);
+            }
+            m_counts.swap(counts);
+            m_stride = stride;
+        } else {
+            // Everything outside the m_size square is kept at zero, so there
+            // is nothing to do when growing into the stride...but shrinking
+            // has to zero what it leaves behind.
+            for (size_t fromIndex = 0; fromIndex < m_size; fromIndex++) {
+                size_t toIndex = (fromIndex < size) ? size : 0;
+                for (; toIndex < m_size; toIndex++)
+                    m_counts[fromIndex * m_stride + toIndex] = 0;
+            }
+        }
+        m_size = size;
+    }
+
+    size_t BufferCapacityBytes() const {
+        return m_counts.capacity() * sizeof(Count);
+    }
+
+    void ClearVertex(VertexID vertex) {
+        assert(vertex < m_size);
+        for (VertexID other = 0; other < m_size; other++) {
+            At(vertex, other) = 0;
+            At(other, vertex) = 0;
+        }
+    }
+
+    bool Reaches(VertexID fromVertex, VertexID toVertex) const {
+        return At(fromVertex, toVertex) != 0;
+    }
+    Count PathCount(VertexID fromVertex, VertexID toVertex) const {
+        return At(fromVertex, toVertex);
+    }
+
+    void AddEdge(VertexID fromVertex, VertexID toVertex) {
+        std::vector<VertexID> ancestors;
+        std::vector<VertexID> descendants;
+        AncestorsAndDescendants(fromVertex, toVertex, ancestors, descendants);
+
+        for (size_t ancestorIndex = 0; ancestorIndex < ancestors.size(); ancestorIndex++) {
+            VertexID ancestor = ancestors[ancestorIndex];
+            Count pathsIn = Paths(ancestor, fromVertex);
+            for (size_t descendantIndex = 0; descendantIndex < descendants.size(); descendantIndex++) {
+                VertexID descendant = descendants[descendantIndex];
+                Count through = SaturatingMultiply(pathsIn, Paths(toVertex, descendant));
+                At(ancestor, descendant) = SaturatingAdd(At(ancestor, descendant), through);
+            }
+        }
+    }
+
+    // The graph the children come from must already be without the edge.
+    // (Paths into fromVertex and out of toVertex can't use the edge, since
+    // that would take a cycle, so those counts are good to use either way.)
+    template<class ForEachChild>
+    void RemoveEdge(VertexID fromVertex, VertexID toVertex, ForEachChild forEachChild) {
+        std::vector<VertexID> ancestors;
+        std::vector<VertexID> descendants;
+        AncestorsAndDescendants(fromVertex, toVertex, ancestors, descendants);
+
+        std::vector<std::pair<size_t, VertexID> > recompute; // (reach, vertex)
+        for (size_t ancestorIndex = 0; ancestorIndex < ancestors.size(); ancestorIndex++) {
+            VertexID ancestor = ancestors[ancestorIndex];
+            Count pathsIn = Paths(ancestor, fromVertex);
+
+            bool exact = (pathsIn != saturated);
+            for (size_t descendantIndex = 0; exact && (descendantIndex < descendants.size()); descendantIndex++) {
+                VertexID descendant = descendants[descendantIndex];
+                if ((Paths(toVertex, descendant) == saturated) || (At(ancestor, descendant) == saturated))
+                    exact = false;
+            }
+            if (!exact) {
+                recompute.push_back(std::make_pair(RowReach(ancestor), ancestor));
+                continue;
+            }
+
+            for (size_t descendantIndex = 0; descendantIndex < descendants.size(); descendantIndex++) {
+                VertexID descendant = descendants[descendantIndex];
+                uint64_t through = static_cast<uint64_t>(pathsIn) * Paths(toVertex, descendant);
+                assert(through <= At(ancestor, descendant));
+                At(ancestor, descendant) -= static_cast<Count>(through);
+            }
+        }
+
+        std::sort(recompute.begin(), recompute.end());
+        for (size_t index = 0; index < recompute.size(); index++)
+            RecomputeRow(recompute[index].second, forEachChild);
+    }
+
+  public:
+    CountingClosure(const size_t initial_size = 0) :
+        m_size (0),
+        m_stride (0)
+    {
+        Resize(initial_size);
+    }
+    virtual ~CountingClosure() {
+    }
+};
+
+} // end namespace nocycle
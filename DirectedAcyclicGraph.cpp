@@ -20,9 +20,11 @@
 #include <iostream>
 #include "BoostImplementation.hpp"
 #include "RandomEdgePicker.hpp"
+#include "AsyncDirectedAcyclicGraph.hpp"
 
 const unsigned NUM_TEST_NODES = 128;
 const float REMOVE_PROBABILITY = 1.0/8.0; // one in eight
+const float REVERSE_PROBABILITY = 1.0/16.0; // one in sixteen
 
 namespace nocycle {
 
@@ -131,6 +133,642 @@ bool DirectedAcyclicGraph::SelfTest() {
         }
     }
 
+    if (true) { // Reversals, one of which would be a transitive cycle
+        DirectedAcyclicGraph dag(5);
+
+        for (DirectedAcyclicGraph::VertexID vertex = 0; vertex < 5; vertex++)
+            dag.CreateVertex(vertex);
+
+        dag.SetEdge(0, 1);
+        dag.SetEdge(1, 2);
+        dag.SetEdge(0, 2);
+        dag.SetEdge(3, 2);
+        dag.SetEdge(1, 4);
+        try {
+            dag.ReverseEdge(0, 2);
+            std::cout << "FAILURE: Reversal of 0->2 did not catch cycle 2->0->1->2." << std::endl;
+            return false;
+        } catch (bad_cycle& e) {
+        }
+        if (!dag.EdgeExists(0, 2) || dag.EdgeExists(2, 0)) {
+            std::cout << "FAILURE: Reversal that caused a cycle modified the graph." << std::endl;
+            return false;
+        }
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        for (DirectedAcyclicGraph::VertexID vertex = 0; vertex < 5; vertex++) {
+            if (dag.m_canreach.GetVertexType(vertex) != canreachClean) {
+                std::cout << "FAILURE: Refused reversal of 0->2 left vertex #" << vertex << " dirty." << std::endl;
+                return false;
+            }
+        }
+      #endif
+        try {
+            dag.ReverseEdge(1, 2);
+        } catch (bad_cycle& e) {
+            std::cout << "FAILURE: False cycle found reversing 1->2 with 0->2 in graph." << std::endl;
+            return false;
+        }
+        if (!dag.CanReach(2, 1) || dag.CanReach(1, 2)) {
+            std::cout << "FAILURE: Reachability not updated after reversing 1->2." << std::endl;
+            return false;
+        }
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        // only 0 went through the edge, everything else is patched in place
+        for (DirectedAcyclicGraph::VertexID vertex = 1; vertex < 5; vertex++) {
+            if (dag.m_canreach.GetVertexType(vertex) != canreachClean) {
+                std::cout << "FAILURE: Reversal of 1->2 left vertex #" << vertex << " dirty." << std::endl;
+                return false;
+            }
+        }
+      #endif
+        if (!dag.CanReach(3, 1) || !dag.CanReach(3, 4) || !dag.CanReach(2, 4) || dag.CanReach(0, 3)) {
+            std::cout << "FAILURE: Reach through reversed 2->1 not patched in." << std::endl;
+            return false;
+        }
+    }
+
+    if (true) { // Destroying a vertex takes the paths through it along
+        DirectedAcyclicGraph dag(4);
+
+        for (DirectedAcyclicGraph::VertexID vertex = 0; vertex < 4; vertex++)
+            dag.CreateVertex(vertex);
+        dag.SetEdge(0, 1);
+        dag.SetEdge(1, 2);
+        dag.SetEdge(2, 3);
+        if (!dag.CanReach(0, 3)) {
+            std::cout << "FAILURE: 0 can't reach 3 along 0->1->2->3." << std::endl;
+            return false;
+        }
+
+        dag.DestroyVertexDontCompact(1);
+        if (dag.CanReach(0, 2) || dag.CanReach(0, 3)) {
+            std::cout << "FAILURE: 0 still reaches past destroyed vertex 1." << std::endl;
+            return false;
+        }
+        if (!dag.CanReach(2, 3)) {
+            std::cout << "FAILURE: Destroying vertex 1 lost 2->3." << std::endl;
+            return false;
+        }
+        try {
+            dag.SetEdge(3, 0);
+        } catch (bad_cycle& e) {
+            std::cout << "FAILURE: False cycle 3->0 through destroyed vertex 1." << std::endl;
+            return false;
+        }
+    }
+
+  #if DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+    if (true) { // Hot source cache admits on the second query, patches on insert, drops on removal
+        DirectedAcyclicGraph dag(4);
+
+        dag.CreateVertex(0);
+        dag.CreateVertex(1);
+        dag.CreateVertex(2);
+        dag.CreateVertex(3);
+
+        dag.SetEdge(0, 1);
+        dag.SetEdge(1, 2);
+        dag.SetHotSourceCacheCapacity(1);
+
+        // (only "yes" answers are counted, since descendant signatures may
+        // turn a "no" away before it gets to the cache)
+        size_t hitsBefore = dag.GetHotSourceCache().Hits();
+        bool answers = dag.CanReach(0, 2) && dag.CanReach(0, 2) && dag.CanReach(0, 2) && dag.CanReach(0, 1);
+        if (!answers || (dag.GetHotSourceCache().Hits() != hitsBefore + 2)) {
+            std::cout << "FAILURE: Hot source cache did not start answering for vertex 0." << std::endl;
+            return false;
+        }
+        if (dag.CanReach(0, 3)) {
+            std::cout << "FAILURE: Hot source cache says 0 reaches unconnected vertex 3." << std::endl;
+            return false;
+        }
+        hitsBefore = dag.GetHotSourceCache().Hits(); // that "no" may or may not have been a hit
+
+        dag.SetEdge(2, 3);
+        if (!dag.CanReach(0, 3) || (dag.GetHotSourceCache().Hits() != hitsBefore + 1)) {
+            std::cout << "FAILURE: Hot source cache entry not patched when 2->3 was added." << std::endl;
+            return false;
+        }
+
+        dag.RemoveEdge(1, 2);
+        if (dag.CanReach(0, 3) || (dag.GetHotSourceCache().Hits() != hitsBefore + 1)) {
+            std::cout << "FAILURE: Hot source cache entry still used after 1->2 was removed." << std::endl;
+            return false;
+        }
+    }
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+    if (true) { // Path counts through layers, past saturation and back, and destroying a vertex
+        // 34 layers of 2 vertices, each connected to both in the next layer,
+        // gives 2^32 paths from a vertex in the first layer to one in the last
+        const VertexID numLayers = 34;
+        DirectedAcyclicGraph dag(numLayers * 2);
+        for (VertexID vertex = 0; vertex < numLayers * 2; vertex++)
+            dag.CreateVertex(vertex);
+        for (VertexID layer = 0; layer + 1 < numLayers; layer++) {
+            for (VertexID fromVertex = layer * 2; fromVertex < layer * 2 + 2; fromVertex++) {
+                dag.AddEdge(fromVertex, (layer + 1) * 2);
+                dag.AddEdge(fromVertex, (layer + 1) * 2 + 1);
+            }
+        }
+        const CountingClosure& counting = dag.GetCountingClosure();
+        if ((counting.PathCount(0, numLayers * 2 - 1) != CountingClosure::saturated)
+            || (counting.PathCount(numLayers * 2 - 8, numLayers * 2 - 1) != 4)) {
+            std::cout << "FAILURE: Counting closure has the wrong number of paths through the layers." << std::endl;
+            return false;
+        }
+
+        // Cutting the second layer down to one vertex halves the count, which
+        // a saturated count can't do by subtraction
+        dag.RemoveEdge(0, 3);
+        dag.RemoveEdge(1, 3);
+        dag.DestroyVertexDontCompact(3);
+        if ((counting.PathCount(0, numLayers * 2 - 1) != (static_cast<CountingClosure::Count>(1) << 31))
+            || (counting.PathCount(2, numLayers * 2 - 1) != (static_cast<CountingClosure::Count>(1) << 31))) {
+            std::cout << "FAILURE: Counting closure wrong after rows were recomputed." << std::endl;
+            return false;
+        }
+
+        // Same again in the middle, with the edges going away along with it
+        dag.DestroyVertexDontCompact(numLayers);
+        if (counting.PathCount(0, numLayers * 2 - 1) != (static_cast<CountingClosure::Count>(1) << 30)) {
+            std::cout << "FAILURE: Counting closure wrong after destroying a vertex with edges." << std::endl;
+            return false;
+        }
+        for (VertexID vertexFrom = 0; vertexFrom < numLayers * 2; vertexFrom++) {
+            if (!dag.VertexExists(vertexFrom))
+                continue;
+            VertexBitset descendants = dag.Descendants(vertexFrom);
+            for (VertexID vertexTo = 0; vertexTo < numLayers * 2; vertexTo++) {
+                if ((vertexFrom == vertexTo) || !dag.VertexExists(vertexTo))
+                    continue;
+                if (counting.Reaches(vertexFrom, vertexTo) != descendants.Test(vertexTo)) {
+                    std::cout << "FAILURE: Counting closure wrong about " << vertexFrom << "->" << vertexTo << " after destroying vertices." << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (true) { // Resizing within the stride and past it keeps the counts that survive
+        CountingClosure counting (3);
+        counting.AddEdge(0, 1);
+        counting.AddEdge(1, 2);
+        counting.Resize(2);
+        counting.Resize(3);
+        if ((counting.PathCount(0, 1) != 1) || counting.Reaches(0, 2) || counting.Reaches(1, 2)) {
+            std::cout << "FAILURE: Counting closure kept counts for a vertex it shrank away." << std::endl;
+            return false;
+        }
+        counting.AddEdge(1, 2);
+        counting.Resize(100);
+        if ((counting.PathCount(0, 2) != 1) || counting.Reaches(2, 99) || counting.Reaches(99, 0)) {
+            std::cout << "FAILURE: Counting closure lost counts when its table was reallocated." << std::endl;
+            return false;
+        }
+    }
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+    if (true) { // Random churn with a small cleaning budget, checked against plain searches
+        const VertexID numBudgetVertices = 48;
+        for (size_t eagerThreshold = 0; eagerThreshold <= 64; eagerThreshold += 64) {
+            DirectedAcyclicGraph dag(numBudgetVertices);
+            for (VertexID vertex = 0; vertex < numBudgetVertices; vertex++)
+                dag.CreateVertex(vertex);
+            dag.SetCleaningBudget(2);
+            dag.SetEagerCleanThreshold(eagerThreshold);
+
+            for (unsigned step = 0; step < 4000; step++) {
+                VertexID vertexA = static_cast<VertexID>(rand()) % numBudgetVertices;
+                VertexID vertexB = static_cast<VertexID>(rand()) % numBudgetVertices;
+                if (vertexA == vertexB)
+                    continue;
+
+                if (dag.EdgeExists(vertexA, vertexB) && (rand() % 3 == 0)) {
+                    dag.RemoveEdge(vertexA, vertexB);
+                } else if (!dag.HasLinkage(vertexA, vertexB)) {
+                    bool causedCycle = dag.OrientedGraph::CanReach(vertexB, vertexA);
+                    if (dag.InsertionWouldCauseCycle(vertexA, vertexB) != causedCycle) {
+                        std::cout << "FAILURE: Cycle check on " << vertexA << "->" << vertexB << " wrong with a cleaning budget." << std::endl;
+                        return false;
+                    }
+                    if (!causedCycle)
+                        dag.AddEdge(vertexA, vertexB);
+                }
+
+                if (dag.CanReach(vertexA, vertexB) != dag.OrientedGraph::CanReach(vertexA, vertexB)) {
+                    std::cout << "FAILURE: CanReach(" << vertexA << ", " << vertexB << ") wrong with a cleaning budget." << std::endl;
+                    return false;
+                }
+            }
+            if (dag.DirtyBacklog() > numBudgetVertices * numBudgetVertices) {
+                std::cout << "FAILURE: Dirty vertex queue grew without bound." << std::endl;
+                return false;
+            }
+        }
+    }
+
+    if (true) { // A small removal is cleaned right away only under the eager threshold
+        for (size_t eagerThreshold = 0; eagerThreshold <= 64; eagerThreshold += 64) {
+            DirectedAcyclicGraph dag(4);
+            for (VertexID vertex = 0; vertex < 4; vertex++)
+                dag.CreateVertex(vertex);
+            dag.SetEagerCleanThreshold(eagerThreshold);
+            dag.SetEdge(0, 1);
+            dag.SetEdge(1, 2);
+            dag.SetEdge(2, 3);
+            dag.SetEdge(0, 2);
+
+            dag.RemoveEdge(1, 2); // 0 and 1 could reach 2 and 3 through it
+            bool clean = (dag.m_canreach.GetVertexType(0) == canreachClean)
+                && (dag.m_canreach.GetVertexType(1) == canreachClean);
+            if (clean != (eagerThreshold != 0)) {
+                std::cout << "FAILURE: Removing 1->2 with eager threshold " << eagerThreshold
+                    << " left the rows of 0 and 1 " << (clean ? "clean." : "dirty.") << std::endl;
+                return false;
+            }
+            if (dag.CanReach(1, 2) || dag.CanReach(1, 3) || !dag.CanReach(0, 3)) {
+                std::cout << "FAILURE: Reachability wrong after removing 1->2 with eager threshold " << eagerThreshold << "." << std::endl;
+                return false;
+            }
+        }
+    }
+  #endif
+
+    if (true) { // Asynchronous submissions, in order from one thread and spread over several
+        DirectedAcyclicGraph dag(0);
+        std::vector<std::future<AsyncDirectedAcyclicGraph::Result> > results;
+        {
+            AsyncDirectedAcyclicGraph async (dag);
+            for (VertexID vertex = 0; vertex < 6; vertex++)
+                async.SubmitCreateVertex(vertex);
+            results.push_back(async.SubmitAddEdge(0, 1));
+            results.push_back(async.SubmitAddEdge(1, 2));
+            results.push_back(async.SubmitAddEdge(3, 2));
+            results.push_back(async.SubmitAddEdge(2, 0));
+            results.push_back(async.SubmitAddEdge(1, 2));
+            results.push_back(async.SubmitRemoveEdge(3, 2));
+            results.push_back(async.SubmitRemoveEdge(3, 2));
+            std::future<bool> reaches = async.SubmitCanReach(0, 2);
+            if (!reaches.get()) {
+                std::cout << "FAILURE: Asynchronous CanReach(0, 2) did not see the earlier insertions." << std::endl;
+                return false;
+            }
+        }
+        AsyncDirectedAcyclicGraph::Result expected[] = {
+            AsyncDirectedAcyclicGraph::resultApplied,
+            AsyncDirectedAcyclicGraph::resultApplied,
+            AsyncDirectedAcyclicGraph::resultApplied,
+            AsyncDirectedAcyclicGraph::resultWouldCauseCycle,
+            AsyncDirectedAcyclicGraph::resultNoChange,
+            AsyncDirectedAcyclicGraph::resultApplied,
+            AsyncDirectedAcyclicGraph::resultNoChange
+        };
+        for (size_t index = 0; index < results.size(); index++) {
+            if (results[index].get() != expected[index]) {
+                std::cout << "FAILURE: Asynchronous submission #" << index << " had the wrong result." << std::endl;
+                return false;
+            }
+        }
+
+        // Low to high edges from four threads at once can never make a cycle
+        const VertexID numAsyncVertices = 32;
+        DirectedAcyclicGraph dagShared(numAsyncVertices);
+        for (VertexID vertex = 0; vertex < numAsyncVertices; vertex++)
+            dagShared.CreateVertex(vertex);
+        {
+            AsyncDirectedAcyclicGraph async (dagShared, 16);
+            std::vector<std::thread> submitters;
+            std::vector<int> allApplied (4, 1); // not vector<bool>, threads write neighboring entries
+            for (unsigned threadIndex = 0; threadIndex < 4; threadIndex++) {
+                submitters.push_back(std::thread([&, threadIndex]() {
+                    std::vector<std::future<AsyncDirectedAcyclicGraph::Result> > threadResults;
+                    for (VertexID fromVertex = 0; fromVertex < numAsyncVertices; fromVertex++) {
+                        for (VertexID toVertex = fromVertex + 1; toVertex < numAsyncVertices; toVertex++) {
+                            if ((fromVertex + toVertex) % 4 == threadIndex)
+                                threadResults.push_back(async.SubmitAddEdge(fromVertex, toVertex));
+                        }
+                    }
+                    for (size_t index = 0; index < threadResults.size(); index++) {
+                        if (threadResults[index].get() != AsyncDirectedAcyclicGraph::resultApplied)
+                            allApplied[threadIndex] = 0;
+                    }
+                }));
+            }
+            for (unsigned threadIndex = 0; threadIndex < 4; threadIndex++) {
+                submitters[threadIndex].join();
+                if (!allApplied[threadIndex]) {
+                    std::cout << "FAILURE: Asynchronous insertion from thread #" << threadIndex << " was not applied." << std::endl;
+                    return false;
+                }
+            }
+        }
+        for (VertexID fromVertex = 0; fromVertex < numAsyncVertices; fromVertex++) {
+            for (VertexID toVertex = fromVertex + 1; toVertex < numAsyncVertices; toVertex++) {
+                if (!dagShared.EdgeExists(fromVertex, toVertex)) {
+                    std::cout << "FAILURE: Asynchronous insertion of " << fromVertex << "->" << toVertex << " lost." << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (true) { // Sub-DAGs answer reachability for paths inside them, convex or not
+        const VertexID numSubgraphVertices = 64;
+        DirectedAcyclicGraph dag(numSubgraphVertices);
+        for (VertexID vertex = 0; vertex < numSubgraphVertices; vertex++)
+            dag.CreateVertex(vertex);
+        for (unsigned index = 0; index < numSubgraphVertices * 3; index++) {
+            VertexID vertexA = static_cast<VertexID>(rand()) % numSubgraphVertices;
+            VertexID vertexB = static_cast<VertexID>(rand()) % numSubgraphVertices;
+            if ((vertexA != vertexB) && !dag.HasLinkage(vertexA, vertexB) && !dag.InsertionWouldCauseCycle(vertexA, vertexB))
+                dag.AddEdge(vertexA, vertexB);
+        }
+
+        std::set<VertexID> chosenSets[2];
+        VertexBitset below = dag.Descendants(5); // closed downward, so convex
+        below.ForEach([&](VertexID vertex) { chosenSets[0].insert(vertex); });
+        chosenSets[0].insert(5);
+        for (unsigned index = 0; index < 30; index++)
+            chosenSets[1].insert(static_cast<VertexID>(rand()) % numSubgraphVertices);
+
+        for (unsigned which = 0; which < 2; which++) {
+            std::vector<VertexID> remap;
+            DirectedAcyclicGraph subgraph = dag.ExtractSubgraph(chosenSets[which], &remap);
+            VertexID numChosen = static_cast<VertexID>(chosenSets[which].size());
+            for (VertexID vertexA = 0; vertexA < numChosen; vertexA++) {
+                for (VertexID vertexB = 0; vertexB < numChosen; vertexB++) {
+                    if (vertexA == vertexB)
+                        continue;
+                    bool reaches = subgraph.OrientedGraph::CanReach(vertexA, vertexB);
+                    if (subgraph.CanReach(vertexA, vertexB) != reaches) {
+                        std::cout << "FAILURE: Sub-DAG " << which << " says " << vertexA << "->" << vertexB
+                            << " is " << (reaches ? "not " : "") << "reachable." << std::endl;
+                        return false;
+                    }
+                    if (!subgraph.HasLinkage(vertexA, vertexB) && (subgraph.InsertionWouldCauseCycle(vertexA, vertexB) != subgraph.OrientedGraph::CanReach(vertexB, vertexA))) {
+                        std::cout << "FAILURE: Sub-DAG " << which << " got the cycle check for " << vertexA << "->" << vertexB << " wrong." << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    if (true) { // Merging keeps every edge that isn't on a cycle of the union
+        const VertexID numMergeVertices = 48;
+        DirectedAcyclicGraph dags[2] = {
+            DirectedAcyclicGraph(numMergeVertices),
+            DirectedAcyclicGraph(numMergeVertices)
+        };
+        for (unsigned which = 0; which < 2; which++) {
+            for (VertexID vertex = 0; vertex < numMergeVertices; vertex++)
+                dags[which].CreateVertex(vertex);
+            for (unsigned index = 0; index < numMergeVertices * 2; index++) {
+                VertexID vertexA = static_cast<VertexID>(rand()) % numMergeVertices;
+                VertexID vertexB = static_cast<VertexID>(rand()) % numMergeVertices;
+                if ((vertexA != vertexB) && !dags[which].HasLinkage(vertexA, vertexB) && !dags[which].InsertionWouldCauseCycle(vertexA, vertexB))
+                    dags[which].AddEdge(vertexA, vertexB);
+            }
+        }
+
+        // The second graph's vertices land half on top of the first's, and
+        // half on new IDs past the end (with one left out)
+        const VertexID leftOutVertex = 40;
+        std::vector<VertexID> remap (numMergeVertices);
+        for (VertexID vertex = 0; vertex < numMergeVertices; vertex++)
+            remap[vertex] = vertex + numMergeVertices / 2;
+        remap[leftOutVertex] = std::numeric_limits<VertexID>::max();
+
+        // Adjacency of the union, to check each left out edge against
+        std::vector<std::vector<VertexID> > unionChildren (numMergeVertices * 2);
+        for (unsigned which = 0; which < 2; which++) {
+            dags[which].ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+                if (which == 0)
+                    unionChildren[fromVertex].push_back(toVertex);
+                else if ((fromVertex != leftOutVertex) && (toVertex != leftOutVertex))
+                    unionChildren[remap[fromVertex]].push_back(remap[toVertex]);
+            });
+        }
+
+        DirectedAcyclicGraph merged (dags[0]);
+        std::vector<std::pair<VertexID, VertexID> > conflicts = merged.Merge(dags[1], &remap);
+        std::set<std::pair<VertexID, VertexID> > conflictSet (conflicts.begin(), conflicts.end());
+
+        if (merged.VertexExists(leftOutVertex + numMergeVertices / 2) || !merged.VertexExists(numMergeVertices * 3 / 2 - 1)) {
+            std::cout << "FAILURE: Merge() didn't create the right vertices." << std::endl;
+            return false;
+        }
+        bool edgesOk = true;
+        dags[0].ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+            edgesOk = edgesOk && merged.EdgeExists(fromVertex, toVertex);
+        });
+        dags[1].ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+            if ((fromVertex == leftOutVertex) || (toVertex == leftOutVertex))
+                return;
+            std::pair<VertexID, VertexID> edge (remap[fromVertex], remap[toVertex]);
+            edgesOk = edgesOk && (merged.EdgeExists(edge.first, edge.second) != (conflictSet.count(edge) != 0));
+        });
+        if (!edgesOk) {
+            std::cout << "FAILURE: Merge() lost an edge, or kept one it reported as a conflict." << std::endl;
+            return false;
+        }
+
+        for (std::set<std::pair<VertexID, VertexID> >::iterator conflictIter = conflictSet.begin(); conflictIter != conflictSet.end(); conflictIter++) {
+            // Search the union from the target for the source
+            std::vector<bool> seen (numMergeVertices * 2, false);
+            std::vector<VertexID> pending (1, conflictIter->second);
+            bool closesCycle = false;
+            while (!pending.empty() && !closesCycle) {
+                VertexID vertex = pending.back();
+                pending.pop_back();
+                for (size_t index = 0; index < unionChildren[vertex].size(); index++) {
+                    VertexID child = unionChildren[vertex][index];
+                    closesCycle = closesCycle || (child == conflictIter->first);
+                    if (!seen[child]) {
+                        seen[child] = true;
+                        pending.push_back(child);
+                    }
+                }
+            }
+            if (!closesCycle) {
+                std::cout << "FAILURE: Merge() reported " << conflictIter->first << "->" << conflictIter->second
+                    << " as a conflict but it isn't on a cycle." << std::endl;
+                return false;
+            }
+        }
+
+        for (VertexID vertexA = 0; vertexA < merged.GetFirstInvalidVertexID(); vertexA++) {
+            for (VertexID vertexB = 0; vertexB < merged.GetFirstInvalidVertexID(); vertexB++) {
+                if ((vertexA == vertexB) || !merged.VertexExists(vertexA) || !merged.VertexExists(vertexB))
+                    continue;
+                if (merged.CanReach(vertexA, vertexB) != merged.OrientedGraph::CanReach(vertexA, vertexB)) {
+                    std::cout << "FAILURE: Merged DAG got reachability of " << vertexA << "->" << vertexB << " wrong." << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (true) { // Contracting vertices moves their edges, and refuses to make a cycle
+        const VertexID numContractVertices = 40;
+        DirectedAcyclicGraph dag(numContractVertices);
+        for (VertexID vertex = 0; vertex < numContractVertices; vertex++)
+            dag.CreateVertex(vertex);
+        for (unsigned index = 0; index < numContractVertices * 2; index++) {
+            VertexID vertexA = static_cast<VertexID>(rand()) % numContractVertices;
+            VertexID vertexB = static_cast<VertexID>(rand()) % numContractVertices;
+            if ((vertexA != vertexB) && !dag.HasLinkage(vertexA, vertexB) && !dag.InsertionWouldCauseCycle(vertexA, vertexB))
+                dag.AddEdge(vertexA, vertexB);
+        }
+
+        unsigned contracted = 0;
+        unsigned refused = 0;
+        for (unsigned attempt = 0; attempt < numContractVertices; attempt++) {
+            VertexID keep = static_cast<VertexID>(rand()) % numContractVertices;
+            VertexID remove = static_cast<VertexID>(rand()) % numContractVertices;
+            if ((keep == remove) || !dag.VertexExists(keep) || !dag.VertexExists(remove))
+                continue;
+
+            // A cycle comes from a path between the two through a third vertex
+            bool expectCycle = false;
+            for (VertexID other = 0; other < numContractVertices; other++) {
+                if ((other == keep) || (other == remove) || !dag.VertexExists(other))
+                    continue;
+                if ((dag.OrientedGraph::CanReach(keep, other) && dag.OrientedGraph::CanReach(other, remove))
+                    || (dag.OrientedGraph::CanReach(remove, other) && dag.OrientedGraph::CanReach(other, keep)))
+                    expectCycle = true;
+            }
+
+            std::vector<bool> expectOutgoing (numContractVertices, false);
+            std::vector<bool> expectIncoming (numContractVertices, false);
+            for (VertexID other = 0; other < numContractVertices; other++) {
+                if ((other == keep) || (other == remove) || !dag.VertexExists(other))
+                    continue;
+                expectOutgoing[other] = dag.EdgeExists(keep, other) || dag.EdgeExists(remove, other);
+                expectIncoming[other] = dag.EdgeExists(other, keep) || dag.EdgeExists(other, remove);
+            }
+
+            size_t edgesBefore = dag.EdgeCount();
+            try {
+                dag.ContractVertices(keep, remove);
+            } catch (bad_cycle& e) {
+                if (!expectCycle || (dag.EdgeCount() != edgesBefore) || !dag.VertexExists(remove)) {
+                    std::cout << "FAILURE: Contracting " << remove << " into " << keep << " was refused wrongly, or changed the graph." << std::endl;
+                    return false;
+                }
+                refused++;
+                continue;
+            }
+            if (expectCycle || dag.VertexExists(remove)) {
+                std::cout << "FAILURE: Contracting " << remove << " into " << keep << " should have been refused." << std::endl;
+                return false;
+            }
+            contracted++;
+
+            for (VertexID other = 0; other < numContractVertices; other++) {
+                if ((other == keep) || !dag.VertexExists(other))
+                    continue;
+                if ((dag.EdgeExists(keep, other) != expectOutgoing[other]) || (dag.EdgeExists(other, keep) != expectIncoming[other])) {
+                    std::cout << "FAILURE: Contracting " << remove << " into " << keep << " got the edge with " << other << " wrong." << std::endl;
+                    return false;
+                }
+            }
+            for (VertexID vertexA = 0; vertexA < numContractVertices; vertexA++) {
+                for (VertexID vertexB = 0; vertexB < numContractVertices; vertexB++) {
+                    if ((vertexA == vertexB) || !dag.VertexExists(vertexA) || !dag.VertexExists(vertexB))
+                        continue;
+                    if (dag.CanReach(vertexA, vertexB) != dag.OrientedGraph::CanReach(vertexA, vertexB)) {
+                        std::cout << "FAILURE: After contracting " << remove << " into " << keep << ", reachability of "
+                            << vertexA << "->" << vertexB << " is wrong." << std::endl;
+                        return false;
+                    }
+                }
+            }
+          #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+            if (!dag.IsInternallyConsistent()) {
+                std::cout << "FAILURE: Closure inconsistent after contracting " << remove << " into " << keep << "." << std::endl;
+                return false;
+            }
+          #endif
+        }
+        if ((contracted == 0) || (refused == 0)) {
+            std::cout << "FAILURE: Contraction test never got to both contract and refuse." << std::endl;
+            return false;
+        }
+    }
+
+  #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY && !DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK
+    if (true) { // Contraction only grows the closure, so it leaves clean rows clean
+        DirectedAcyclicGraph dag(4);
+        for (VertexID vertex = 0; vertex < 4; vertex++)
+            dag.CreateVertex(vertex);
+        dag.SetEdge(3, 0);
+        dag.SetEdge(0, 2);
+        dag.ContractVertices(1, 2);
+        if ((dag.m_canreach.GetVertexType(3) != canreachClean) || (dag.m_canreach.GetVertexType(0) != canreachClean)) {
+            std::cout << "FAILURE: Contracting 2 into 1 dirtied the rows of what reached 2." << std::endl;
+            return false;
+        }
+        if (!dag.CanReach(3, 1) || !dag.EdgeExists(0, 1)) {
+            std::cout << "FAILURE: Contracting 2 into 1 lost 3->0->1." << std::endl;
+            return false;
+        }
+    }
+  #endif
+
+    if (true) { // Transitive reduction of a diamond with a shortcut across it
+        DirectedAcyclicGraph dag(4);
+
+        dag.CreateVertex(0);
+        dag.CreateVertex(1);
+        dag.CreateVertex(2);
+        dag.CreateVertex(3);
+
+        dag.SetEdge(0, 1);
+        dag.SetEdge(0, 2);
+        dag.SetEdge(1, 3);
+        dag.SetEdge(2, 3);
+        dag.SetEdge(0, 3);
+
+        if (!dag.IsEdgeRedundant(0, 3) || dag.IsEdgeRedundant(0, 1) || dag.IsEdgeRedundant(2, 3)) {
+            std::cout << "FAILURE: IsEdgeRedundant() wrong about the diamond's edges." << std::endl;
+            return false;
+        }
+
+        std::vector<std::vector<VertexID> > levels;
+        dag.ForEachLevel([&](const std::vector<VertexID>& level) {
+            levels.push_back(level);
+        });
+        if ((levels.size() != 3) || (levels[0].size() != 1) || (levels[1].size() != 2) || (levels[2].size() != 1)
+            || (levels[0][0] != 0) || (levels[2][0] != 3)) {
+            std::cout << "FAILURE: ForEachLevel() did not give {0}, {1, 2}, {3} for the diamond." << std::endl;
+            return false;
+        }
+
+        VertexBitset commonAncestors = dag.CommonAncestors(1, 2);
+        VertexBitset lowestCommonAncestors = dag.LowestCommonAncestors(1, 3);
+        VertexBitset commonDescendants = dag.CommonDescendants(1, 2);
+        if ((commonAncestors.Count() != 1) || !commonAncestors.Test(0)
+            || (lowestCommonAncestors.Count() != 1) || !lowestCommonAncestors.Test(1)
+            || (commonDescendants.Count() != 1) || !commonDescendants.Test(3)) {
+            std::cout << "FAILURE: Common ancestors or descendants wrong for the diamond." << std::endl;
+            return false;
+        }
+
+        std::vector<std::pair<VertexID, VertexID> > redundant = dag.TransitiveReduction();
+        if ((redundant.size() != 1) || (redundant[0] != std::make_pair(VertexID(0), VertexID(3)))) {
+            std::cout << "FAILURE: Transitive reduction did not find 0->3 as the only redundant edge." << std::endl;
+            return false;
+        }
+        if (dag.EdgeExists(0, 3) || !dag.CanReach(0, 3)) {
+            std::cout << "FAILURE: Transitive reduction did not remove 0->3 while keeping it reachable." << std::endl;
+            return false;
+        }
+    }
+
     // Here is the fuzz testing approach with a lot of random adds and removes.
     // http://en.wikipedia.org/wiki/Fuzz_testing
     // (If this fails, try recompiling with DIRECTEDACYCLICGRAPH_CONSISTENCY_CHECK set to 1,
@@ -142,6 +780,7 @@ bool DirectedAcyclicGraph::SelfTest() {
         unsigned numCyclesCaught = 0;
         unsigned numInsertions = 0;
         unsigned numDeletions = 0;
+        unsigned numReversals = 0;
 
         DAGType dag (NUM_TEST_NODES);
         BoostDirectedAcyclicGraph bdag (NUM_TEST_NODES);
@@ -159,6 +798,7 @@ bool DirectedAcyclicGraph::SelfTest() {
             DAGType::VertexID vertexDest;
 
             bool removeEdge = (dag.NumEdges() > 0) && ((rand() % 10000) < (REMOVE_PROBABILITY * 10000));
+            bool reverseEdge = !removeEdge && (dag.NumEdges() > 0) && ((rand() % 10000) < (REVERSE_PROBABILITY * 10000));
 
             if (removeEdge) {
                 dag.GetRandomEdge(vertexSource, vertexDest);
@@ -167,6 +807,42 @@ bool DirectedAcyclicGraph::SelfTest() {
                 dag.RemoveEdge(vertexSource, vertexDest);
                 numDeletions++;
 
+            } else if (reverseEdge) {
+                dag.GetRandomEdge(vertexSource, vertexDest);
+
+                bool causedCycleInBoost = false;
+                try {
+                    bdag.ReverseEdge(vertexSource, vertexDest);
+                } catch (bad_cycle& e) {
+                    causedCycleInBoost = true;
+                }
+
+                bool causedCycle = false;
+                try {
+                    dag.ReverseEdge(vertexSource, vertexDest);
+                } catch (bad_cycle& e) {
+                    causedCycle = true;
+                }
+
+                if (causedCycle != causedCycleInBoost) {
+                    std::cout << "FAILURE: Reversal of edge that " << (causedCycleInBoost ? "caused a cycle" : "did not cause a cycle") <<
+                    " in Boost " << (causedCycle ? "caused a cycle" : "did not cause a cycle") << " in the DirectedAcyclicGraph implementation." << std::endl;
+                    return false;
+                }
+
+              #if DIRECTEDACYCLICGRAPH_USER_TRISTATE
+                if (!causedCycle) {
+                    Nstate<3> randomTristate (static_cast<unsigned>(rand()) % 3);
+                    bdag.SetTristateForConnection(vertexDest, vertexSource, randomTristate);
+                    dag.SetTristateForConnection(vertexDest, vertexSource, randomTristate);
+                }
+              #endif
+
+                if (causedCycle)
+                    numCyclesCaught++;
+                else
+                    numReversals++;
+
             } else {
                 dag.GetRandomNonEdge(vertexSource, vertexDest);
 
@@ -210,7 +886,7 @@ bool DirectedAcyclicGraph::SelfTest() {
             index++;
         }
 
-        std::cout << "NOTE: Inserted " << numInsertions << ", Deleted " << numDeletions << ", and Caught " << numCyclesCaught << " cycles." << std::endl;
+        std::cout << "NOTE: Inserted " << numInsertions << ", Deleted " << numDeletions << ", Reversed " << numReversals << ", and Caught " << numCyclesCaught << " cycles." << std::endl;
 
         // Graphs should be identical after this
         if (bdag != dag) {
@@ -218,6 +894,218 @@ bool DirectedAcyclicGraph::SelfTest() {
             return false;
         }
 
+        // Every edge in the fuzzed graph must point forward in a topological order
+        std::vector<VertexID> order = dag.TopologicalOrder();
+        std::vector<size_t> orderPosition (NUM_TEST_NODES, 0);
+        for (size_t position = 0; position < order.size(); position++)
+            orderPosition[order[position]] = position;
+        if (order.size() != NUM_TEST_NODES) {
+            std::cout << "FAILURE: TopologicalOrder() did not include every vertex." << std::endl;
+            return false;
+        }
+        for (VertexID vertex = 0; vertex < NUM_TEST_NODES; vertex++) {
+            std::set<VertexID> outgoing = dag.OutgoingEdgesForVertex(vertex);
+            std::set<VertexID>::iterator outgoingIter = outgoing.begin();
+            while (outgoingIter != outgoing.end()) {
+                if (orderPosition[*outgoingIter++] <= orderPosition[vertex]) {
+                    std::cout << "FAILURE: TopologicalOrder() put a vertex before one that reaches it." << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        // The cursors must produce the same vertices as the eager versions, and
+        // the topological one in the very same order
+        TopologicalCursor topologicalCursor = dag.TopologicalOrderCursor();
+        for (size_t position = 0; position <= order.size(); position++) {
+            VertexID vertex;
+            bool more = topologicalCursor.Next(vertex);
+            if (more != (position < order.size()) || (more && (vertex != order[position]))) {
+                std::cout << "FAILURE: TopologicalOrderCursor() differs from TopologicalOrder()." << std::endl;
+                return false;
+            }
+        }
+        for (VertexID vertex = 0; vertex < NUM_TEST_NODES; vertex++) {
+            for (int pass = 0; pass < 2; pass++) {
+                VertexBitset expected = pass == 0 ? dag.Descendants(vertex) : dag.Ancestors(vertex);
+                ReachCursor reachCursor = pass == 0 ? dag.DescendantCursor(vertex) : dag.AncestorCursor(vertex);
+                VertexBitset produced (NUM_TEST_NODES);
+                size_t producedCount = 0;
+                VertexID reachVertex;
+                while (reachCursor.Next(reachVertex)) {
+                    produced.Set(reachVertex);
+                    producedCount++;
+                }
+                produced.AndNotWith(expected);
+                if (produced.Any() || (producedCount != expected.Count())) {
+                    std::cout << "FAILURE: " << (pass == 0 ? "DescendantCursor(" : "AncestorCursor(") << vertex <<
+                        ") differs from the eager search." << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        // Common ancestors and descendants of random pairs must agree with asking
+        // CanReach about every vertex.  The first query may see dirty closure
+        // data, the second (after CanReach cleaned it up) may not.
+        for (unsigned index = 0; index < NUM_TEST_NODES; index++) {
+            VertexID vertexA = static_cast<VertexID>(rand()) % NUM_TEST_NODES;
+            VertexID vertexB = static_cast<VertexID>(rand()) % NUM_TEST_NODES;
+
+            VertexBitset ancestorsBefore = dag.CommonAncestors(vertexA, vertexB);
+            VertexBitset descendantsBefore = dag.CommonDescendants(vertexA, vertexB);
+            VertexBitset lowestBefore = dag.LowestCommonAncestors(vertexA, vertexB);
+
+            VertexBitset ancestorsExpected (NUM_TEST_NODES);
+            VertexBitset descendantsExpected (NUM_TEST_NODES);
+            for (VertexID vertex = 0; vertex < NUM_TEST_NODES; vertex++) {
+                bool reachesA = (vertex == vertexA) || dag.CanReach(vertex, vertexA);
+                bool reachesB = (vertex == vertexB) || dag.CanReach(vertex, vertexB);
+                if (reachesA && reachesB)
+                    ancestorsExpected.Set(vertex);
+                bool reachedByA = (vertex == vertexA) || dag.CanReach(vertexA, vertex);
+                bool reachedByB = (vertex == vertexB) || dag.CanReach(vertexB, vertex);
+                if (reachedByA && reachedByB)
+                    descendantsExpected.Set(vertex);
+            }
+            VertexBitset lowestExpected (NUM_TEST_NODES);
+            ancestorsExpected.ForEach([&](VertexID ancestor) {
+                bool reachesOther = false;
+                ancestorsExpected.ForEach([&](VertexID other) {
+                    if ((other != ancestor) && dag.CanReach(ancestor, other))
+                        reachesOther = true;
+                });
+                if (!reachesOther)
+                    lowestExpected.Set(ancestor);
+            });
+
+            VertexBitset ancestorsAfter = dag.CommonAncestors(vertexA, vertexB);
+            VertexBitset descendantsAfter = dag.CommonDescendants(vertexA, vertexB);
+            VertexBitset lowestAfter = dag.LowestCommonAncestors(vertexA, vertexB);
+
+            for (VertexID vertex = 0; vertex < NUM_TEST_NODES; vertex++) {
+                if ((ancestorsBefore.Test(vertex) != ancestorsExpected.Test(vertex))
+                    || (ancestorsAfter.Test(vertex) != ancestorsExpected.Test(vertex))
+                    || (descendantsBefore.Test(vertex) != descendantsExpected.Test(vertex))
+                    || (descendantsAfter.Test(vertex) != descendantsExpected.Test(vertex))
+                    || (lowestBefore.Test(vertex) != lowestExpected.Test(vertex))
+                    || (lowestAfter.Test(vertex) != lowestExpected.Test(vertex))) {
+                    std::cout << "FAILURE: Common ancestors or descendants of " << vertexA << " and " << vertexB <<
+                        " wrong about vertex #" << vertex << std::endl;
+                    return false;
+                }
+            }
+        }
+
+      #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+        // Labels built from scratch (with several landmarks searched at once)
+        // must agree with searching the graph, and not need double checking
+        dag.SetSearchThreads(4);
+        dag.RebuildReachabilityLabels();
+        if (dag.GetReachabilityLabels().IsStale()) {
+            std::cout << "FAILURE: Reachability labels still stale after a rebuild." << std::endl;
+            return false;
+        }
+        for (VertexID vertexFrom = 0; vertexFrom < NUM_TEST_NODES; vertexFrom++) {
+            VertexBitset descendants = dag.Descendants(vertexFrom);
+            for (VertexID vertexTo = 0; vertexTo < NUM_TEST_NODES; vertexTo++) {
+                if (vertexFrom == vertexTo)
+                    continue;
+                if (dag.GetReachabilityLabels().Query(vertexFrom, vertexTo) != descendants.Test(vertexTo)) {
+                    std::cout << "FAILURE: Rebuilt reachability labels wrong about " << vertexFrom << "->" << vertexTo << std::endl;
+                    return false;
+                }
+            }
+        }
+        dag.SetSearchThreads(1);
+      #endif
+
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        // Path counts never go stale, so they must agree with a search exactly
+        for (VertexID vertexFrom = 0; vertexFrom < NUM_TEST_NODES; vertexFrom++) {
+            VertexBitset descendants = dag.Descendants(vertexFrom);
+            for (VertexID vertexTo = 0; vertexTo < NUM_TEST_NODES; vertexTo++) {
+                if ((vertexFrom != vertexTo) && (dag.GetCountingClosure().Reaches(vertexFrom, vertexTo) != descendants.Test(vertexTo))) {
+                    std::cout << "FAILURE: Counting closure wrong about " << vertexFrom << "->" << vertexTo << std::endl;
+                    return false;
+                }
+            }
+        }
+      #endif
+
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        // Signatures may say "maybe" when the answer is no, but after all the
+        // churn above they must never say "no" when the answer is yes
+        for (VertexID vertexFrom = 0; vertexFrom < NUM_TEST_NODES; vertexFrom++) {
+            VertexBitset descendants = dag.Descendants(vertexFrom);
+            for (VertexID vertexTo = 0; vertexTo < NUM_TEST_NODES; vertexTo++) {
+                if (descendants.Test(vertexTo) && !dag.MightReach(vertexFrom, vertexTo)) {
+                    std::cout << "FAILURE: Descendant signatures ruled out " << vertexFrom << "->" << vertexTo << std::endl;
+                    return false;
+                }
+            }
+        }
+      #endif
+
+      #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+        // The sketch of a set doesn't depend on the order things were added to
+        // it, so the fuzzed graph's sketches (rebuilt lazily after all those
+        // deletions) must be identical to those of a graph that only had the
+        // final edges added.  The estimates should also be near the truth.
+        DirectedAcyclicGraph fresh (NUM_TEST_NODES);
+        for (VertexID vertex = 0; vertex < NUM_TEST_NODES; vertex++)
+            fresh.CreateVertex(vertex);
+        dag.ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+            fresh.AddEdge(fromVertex, toVertex);
+        });
+        for (VertexID vertex = 0; vertex < NUM_TEST_NODES; vertex++) {
+            size_t descendantCount = dag.Descendants(vertex).Count();
+            size_t ancestorCount = dag.Ancestors(vertex).Count();
+            size_t approximateDescendants = dag.ApproximateDescendantCount(vertex);
+            size_t approximateAncestors = dag.ApproximateAncestorCount(vertex);
+            if ((approximateDescendants != fresh.ApproximateDescendantCount(vertex))
+                || (approximateAncestors != fresh.ApproximateAncestorCount(vertex))) {
+                std::cout << "FAILURE: Reach sketches for vertex #" << vertex << " differ from a freshly built graph." << std::endl;
+                return false;
+            }
+            size_t descendantSlack = 2 + descendantCount / 2;
+            size_t ancestorSlack = 2 + ancestorCount / 2;
+            if ((approximateDescendants + descendantSlack < descendantCount)
+                || (approximateDescendants > descendantCount + descendantSlack)
+                || (approximateAncestors + ancestorSlack < ancestorCount)
+                || (approximateAncestors > ancestorCount + ancestorSlack)) {
+                std::cout << "FAILURE: Reach sketch estimates for vertex #" << vertex << " are far off." << std::endl;
+                return false;
+            }
+        }
+      #endif
+
+        // The reduction of the fuzzed graph must reach everything the original
+        // did, and have nothing left to reduce
+        DirectedAcyclicGraph reduced = dag;
+        size_t numRedundant = 0;
+        reduced.ForEachRedundantEdge([&](VertexID fromVertex, VertexID toVertex) {
+            numRedundant++;
+        });
+        if (reduced.TransitiveReduction().size() != numRedundant) {
+            std::cout << "FAILURE: ForEachRedundantEdge() and TransitiveReduction() disagree." << std::endl;
+            return false;
+        }
+        for (VertexID vertexFrom = 0; vertexFrom < NUM_TEST_NODES; vertexFrom++) {
+            for (VertexID vertexTo = 0; vertexTo < NUM_TEST_NODES; vertexTo++) {
+                if (vertexFrom == vertexTo)
+                    continue;
+                if (reduced.CanReach(vertexFrom, vertexTo) != dag.CanReach(vertexFrom, vertexTo)) {
+                    std::cout << "FAILURE: Transitive reduction changed reachability of " << vertexFrom << "->" << vertexTo << std::endl;
+                    return false;
+                }
+            }
+        }
+        if (!reduced.TransitiveReduction(false).empty()) {
+            std::cout << "FAILURE: Transitive reduction left redundant edges behind." << std::endl;
+            return false;
+        }
+
     }
 
     return true;
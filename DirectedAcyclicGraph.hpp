@@ -18,9 +18,19 @@
 #include "NocycleConfig.hpp"
 
 #include "OrientedGraph.hpp"
+#include "VertexBitset.hpp"
+#include "ReachSketch.hpp"
+#include "HotSourceCache.hpp"
+#include "ReachabilityLabels.hpp"
+#include "CountingClosure.hpp"
 
 #include <set>
 #include <stack>
+#include <deque>
+#include <vector>
+#include <utility> // pair
+#include <algorithm> // sort
+#include <cstdint>
 
 namespace nocycle {
 
@@ -71,6 +81,61 @@ class DirectedAcyclicGraph : public OrientedGraph {
     // would be reachable if the physical edge were removed.
   private:
     OrientedGraph m_canreach;
+
+    // With a cleaning budget, vertices whose canreach data goes dirty are
+    // queued, and each call cleans a bounded number of them instead of
+    // cleaning everything a query touches on the spot.  0 means no budget.
+    std::deque<VertexID> m_dirtyQueue;
+    size_t m_cleaningBudget;
+
+    // ClearEdge cleans right away when (vertices that could reach the edge)
+    // times (vertices it led to) is at most this
+    size_t m_eagerCleanThreshold;
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+    // Sidestructure for approximate descendant and ancestor counts
+    //
+    // Each vertex has a sketch of itself plus everything it can reach, and
+    // another of itself plus everything that can reach it.  These are indexed
+    // by the SearchDirection they look in.  Adding an edge only grows what
+    // is reachable, so it is merged in eagerly.  Removing one might shrink
+    // it, but a sketch can't take things out...so the vertices whose sketch
+    // may be too big are marked dirty and rebuilt when next asked for.  If a
+    // vertex is dirty then so is everything upstream of it in that direction.
+  private:
+    std::vector<ReachSketch> m_sketches[2];
+    std::vector<bool> m_sketchDirty[2];
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+    // Sidestructure caching the descendants of frequently queried vertices,
+    // for when caching the whole closure would cost too much memory
+  private:
+    HotSourceCache m_hotSources;
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+    // Sidestructure answering CanReach from a 2-hop labeling, for when caching
+    // the whole closure would cost too much memory
+  private:
+    ReachabilityLabels m_labels;
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+    // Sidestructure of path counts between every pair of vertices, which
+    // answers CanReach exactly with no cleaning after deletions
+  private:
+    CountingClosure m_counting;
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+    // Sidestructure of one 64-bit Bloom filter per vertex, of itself and all
+    // it can reach.  If A can reach B then B's signature is a subset of A's,
+    // so a bit set in B's that isn't set in A's proves A can't reach B.
+  private:
+    std::vector<uint64_t> m_signatures;
+    size_t m_signatureRemovals;
   #endif
 
   public:
@@ -78,8 +143,14 @@ class DirectedAcyclicGraph : public OrientedGraph {
         OrientedGraph(initial_size)
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
         , m_canreach (initial_size)
+        , m_cleaningBudget (0)
+        , m_eagerCleanThreshold (0)
+      #endif
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        , m_signatureRemovals (0)
       #endif
     {
+        NoteCapacityChanged(initial_size);
     }
 
     virtual ~DirectedAcyclicGraph() {
@@ -179,6 +250,12 @@ class DirectedAcyclicGraph : public OrientedGraph {
             assert (false);
     }
 
+    void MarkReachDirty(VertexID vertex) {
+        if ((m_cleaningBudget != 0) && (m_canreach.GetVertexType(vertex) == canreachClean))
+            m_dirtyQueue.push_back(vertex);
+        m_canreach.SetVertexType(vertex, canreachMayHaveFalsePositives);
+    }
+
     // The "incoming reach" is all incoming edges, and for all non-incoming edges that
     // are also not outgoing edges... the data contained in the canreach graph.
     // (Note: includes vertex, as being able to "reach" itself)
@@ -304,6 +381,17 @@ class DirectedAcyclicGraph : public OrientedGraph {
 public:
   #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
     bool CanReach(VertexID fromVertex, VertexID toVertex) {
+        return CanReachEx(fromVertex, toVertex, false);
+    }
+
+  private:
+    // The canreach data stays transitively closed even where it is dirty, and
+    // SetEdgeKnownAcyclic relies on that: if toVertex's row has no entry for
+    // fromVertex, nothing in it leads back to fromVertex.  So the cycle check
+    // for an insertion can't just see past a false positive with a search,
+    // it has to clean it out.
+    bool CanReachEx(VertexID fromVertex, VertexID toVertex, bool cleanFalsePositive) {
+        SpendCleaningBudget();
 
         // If there is a physical edge, then we are using the canreach data for other purposes
         bool forwardEdge, reverseEdge;
@@ -332,6 +420,14 @@ public:
           case canreachMayHaveFalsePositives:
             if (!m_canreach.EdgeExists(fromVertex, toVertex))
                 return false;
+            if (m_cleaningBudget != 0) {
+                // Answer with a search instead of cleaning the whole row, and
+                // leave the cleaning to the queue when possible
+                if (CanReachThroughDirty(fromVertex, toVertex))
+                    return true;
+                if (!cleanFalsePositive)
+                    return false;
+            }
             CleanUpReachability(fromVertex, toVertex);
             return m_canreach.EdgeExists(fromVertex, toVertex);
 
@@ -345,35 +441,180 @@ public:
     }
   #else
     bool CanReach(VertexID fromVertex, VertexID toVertex) {
-        // Simply do a depth-first search to determine reachability
-        // Using LIFO stack instead of recursion...
         assert(fromVertex != toVertex);
 
-        std::set<VertexID> visitedVertices;
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        if (!MightReach(fromVertex, toVertex))
+            return false;
+      #endif
+
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        return m_counting.Reaches(fromVertex, toVertex);
+      #endif
+
+      #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+        if (m_labels.NeedsRebuild())
+            RebuildReachabilityLabels();
+        if (!m_labels.Query(fromVertex, toVertex))
+            return false;
+        if (!m_labels.IsStale())
+            return true;
+        // a removal may have made this "yes" wrong, so check it
+      #endif
+
+      #if DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+        const VertexBitset* descendants = m_hotSources.Lookup(fromVertex);
+        if (descendants)
+            return descendants->Test(toVertex);
+
+        // A full search costs more than one that stops at toVertex, so only
+        // pay for it when the cache will keep the result
+        if (m_hotSources.WantsToAdmit(fromVertex))
+            return m_hotSources.Admit(fromVertex, Descendants(fromVertex)).Test(toVertex);
+      #endif
+
+        return CanReachByTraversal(fromVertex, toVertex);
+    }
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+    //
+    // INCREMENTAL CLEANING
+    //
+    // A dirty vertex is only cleaned off the queue once none of its children
+    // are dirty, so CleanUpReachability never recurses and each row cleaned
+    // costs about one scan.  The budget counts rows scanned, including the
+    // scans that find dirty children (those go to the front of the queue).
+    //
+  private:
+    void SpendCleaningBudget() {
+        size_t spent = 0;
+        while ((spent < m_cleaningBudget) && !m_dirtyQueue.empty()) {
+            VertexID vertex = m_dirtyQueue.front();
+            if (!VertexExists(vertex) || (m_canreach.GetVertexType(vertex) == canreachClean)) {
+                m_dirtyQueue.pop_front();
+                continue;
+            }
+
+            bool dirtyChild = false;
+            ForEachNeighborUntil(vertex, searchOutgoing, [&](VertexID child) {
+                if (m_canreach.GetVertexType(child) == canreachMayHaveFalsePositives) {
+                    m_dirtyQueue.push_front(child);
+                    dirtyChild = true;
+                }
+                return false;
+            });
+            spent++;
+            if (dirtyChild)
+                continue;
+
+            m_dirtyQueue.pop_front();
+            CleanUpReachability(vertex, vertex);
+            spent++;
+        }
+    }
+
+    // Depth-first search over the physical edges, but a clean vertex answers
+    // for everything below it from its canreach row, and a dirty one whose
+    // row says no can be skipped too (dirty rows have no false negatives).
+    bool CanReachThroughDirty(VertexID fromVertex, VertexID toVertex) {
+        VertexBitset visited (GetFirstInvalidVertexID());
         std::stack<VertexID> searchStack;
+        visited.Set(fromVertex);
         searchStack.push(fromVertex);
-
         while (!searchStack.empty()) {
             VertexID searchVertex = searchStack.top();
             searchStack.pop();
+            bool found = ForEachNeighborUntil(searchVertex, searchOutgoing, [&](VertexID child) {
+                if (child == toVertex)
+                    return true;
+                if (visited.Test(child))
+                    return false;
+                visited.Set(child);
 
-            std::set<VertexID> outgoing = OutgoingEdgesForVertex(searchVertex);
-            std::set<VertexID>::iterator outgoingIter = outgoing.begin();
-            while (outgoingIter != outgoing.end()) {
-                VertexID outgoingVertex = (*outgoingIter++);
-                if (outgoingVertex == toVertex)
+                bool forwardEdge, reverseEdge;
+                if (HasLinkage(child, toVertex, &forwardEdge, &reverseEdge))
+                    return forwardEdge;
+                if (!m_canreach.EdgeExists(child, toVertex))
+                    return false;
+                if (m_canreach.GetVertexType(child) == canreachClean)
                     return true;
-                if (visitedVertices.find(outgoingVertex) != visitedVertices.end())
-                    continue;
-                visitedVertices.insert(outgoingVertex);
-                searchStack.push(outgoingVertex);
+                searchStack.push(child);
+                return false;
+            });
+            if (found)
+                return true;
+        }
+        return false;
+    }
+
+  public:
+    // How many rows of canreach data a call may clean (0, the default, means
+    // clean whatever a query needs right when it needs it).  With a budget,
+    // a query on a dirty vertex searches instead of waiting for it to clean.
+    void SetCleaningBudget(size_t rowsPerCall) {
+        if ((m_cleaningBudget == 0) && (rowsPerCall != 0)) {
+            for (VertexID vertex = 0; vertex < GetFirstInvalidVertexID(); vertex++) {
+                if (VertexExists(vertex) && (m_canreach.GetVertexType(vertex) == canreachMayHaveFalsePositives))
+                    m_dirtyQueue.push_back(vertex);
             }
         }
+        if (rowsPerCall == 0)
+            m_dirtyQueue.clear();
+        m_cleaningBudget = rowsPerCall;
+    }
+    size_t GetCleaningBudget() const {
+        return m_cleaningBudget;
+    }
+    size_t DirtyBacklog() const {
+        return m_dirtyQueue.size();
+    }
 
-        return false;
+    // 0 (the default) makes ClearEdge always leave the cleaning for later
+    void SetEagerCleanThreshold(size_t pairs) {
+        m_eagerCleanThreshold = pairs;
+    }
+    size_t GetEagerCleanThreshold() const {
+        return m_eagerCleanThreshold;
     }
   #endif
 
+  private:
+    // Search the physical edges to determine reachability.  If vertexIgnoreEdge
+    // is given then the direct edge from fromVertex to it is not followed, which
+    // answers whether that edge could be removed without losing reachability.
+    bool CanReachByTraversal(VertexID fromVertex, VertexID toVertex, const VertexID* vertexIgnoreEdge = NULL) const {
+        assert(fromVertex != toVertex);
+        return SearchFrom(fromVertex, searchOutgoing, &toVertex, vertexIgnoreEdge).Test(toVertex);
+    }
+
+    // Would toVertex still be reachable from fromVertex if the physical edge
+    // between them were taken away?  If the reach-without-link tristate is
+    // being cached then it can answer this, but only trust a "yes" when the
+    // vertex is clean (dirty reachability has false positives).  Cleaning the
+    // vertex fixes up the tristates of all its edges, not just this one.
+    bool CanReachWithoutEdge(VertexID fromVertex, VertexID toVertex) {
+        assert(EdgeExists(fromVertex, toVertex));
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK
+        ExtraTristate extra = static_cast<ExtraTristate>(static_cast<unsigned char>(GetTristateForConnection(fromVertex, toVertex)));
+        if (extra == notReachableWithoutEdge)
+            return false;
+        if (m_canreach.GetVertexType(fromVertex) == canreachMayHaveFalsePositives) {
+            CleanUpReachability(fromVertex, toVertex);
+            extra = static_cast<ExtraTristate>(static_cast<unsigned char>(GetTristateForConnection(fromVertex, toVertex)));
+        }
+        return extra == isReachableWithoutEdge;
+      #elif DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        // Some other child reaching toVertex is the other way there
+        return ForEachNeighborUntil(fromVertex, searchOutgoing, [&](VertexID child) {
+            return (child != toVertex) && CanReach(child, toVertex);
+        });
+      #else
+        return CanReachByTraversal(fromVertex, toVertex, &toVertex);
+      #endif
+    }
+
   public:
     // This expands the buffer vector so that it can accommodate the existence and
     // connection data for vertexL.  Any new vertices added will not exist yet and not
@@ -383,25 +624,85 @@ public:
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
         m_canreach.SetCapacityForMaxValidVertexID(vertexL);
       #endif
+        NoteCapacityChanged(GetFirstInvalidVertexID());
     }
     void SetCapacitySoVertexIsFirstInvalidID(VertexID vertexL) {
         OrientedGraph::SetCapacitySoVertexIsFirstInvalidID(vertexL);
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
         m_canreach.SetCapacityForMaxValidVertexID(vertexL);
       #endif
+        NoteCapacityChanged(GetFirstInvalidVertexID());
     }
     void GrowCapacityForMaxValidVertexID(VertexID vertexL) {
         OrientedGraph::GrowCapacityForMaxValidVertexID(vertexL);
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
         m_canreach.SetCapacityForMaxValidVertexID(vertexL);
       #endif
+        NoteCapacityChanged(GetFirstInvalidVertexID());
     }
     void ShrinkCapacitySoVertexIsFirstInvalidID(VertexID vertexL) {
         OrientedGraph::ShrinkCapacitySoVertexIsFirstInvalidID(vertexL);
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
         m_canreach.ShrinkCapacitySoVertexIsFirstInvalidID(vertexL);
       #endif
+        NoteCapacityChanged(GetFirstInvalidVertexID());
+    }
+
+    size_t BufferCapacityBytes() const {
+        size_t capacity = OrientedGraph::BufferCapacityBytes();
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        capacity += m_canreach.BufferCapacityBytes();
+      #endif
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        capacity += m_counting.BufferCapacityBytes();
+      #endif
+        return capacity;
+    }
+
+  #if NSTATE_MMAP_STORAGE
+    size_t ReleaseZeroPages() {
+        size_t released = OrientedGraph::ReleaseZeroPages();
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        released += m_canreach.ReleaseZeroPages();
+      #endif
+        return released;
+    }
+    size_t ResidentBytes() const {
+        size_t resident = OrientedGraph::ResidentBytes();
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        resident += m_canreach.ResidentBytes();
+      #endif
+        return resident;
+    }
+  #endif
+
+  #if NSTATE_TILED_FILE_STORAGE
+    // The reachability cache gets a tile cache of its own, the same size
+    void SetTileCacheSize(size_t cacheTiles, size_t readahead = 1) {
+        OrientedGraph::SetTileCacheSize(cacheTiles, readahead);
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        m_canreach.SetTileCacheSize(cacheTiles, readahead);
+      #endif
+    }
+    void FlushTiles() {
+        OrientedGraph::FlushTiles();
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        m_canreach.FlushTiles();
+      #endif
+    }
+    TiledFileBuffer<PackedTypeForNstate>::Stats TileCacheStats() const {
+        TiledFileBuffer<PackedTypeForNstate>::Stats stats = OrientedGraph::TileCacheStats();
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        TiledFileBuffer<PackedTypeForNstate>::Stats reach = m_canreach.TileCacheStats();
+        stats.hits += reach.hits;
+        stats.misses += reach.misses;
+        stats.prefetchHits += reach.prefetchHits;
+        stats.prefetched += reach.prefetched;
+        stats.writeBacks += reach.writeBacks;
+      #endif
+        return stats;
     }
+  #endif
 
     //
     // CREATION OVERRIDES
@@ -412,6 +713,7 @@ public:
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
         m_canreach.CreateVertexEx(vertexE, canreachClean);
       #endif
+        NoteVertexCreated(vertexE);
     }
     inline void CreateVertex(VertexID vertexE) {
         return CreateVertexEx(vertexE, vertexTypeOne);
@@ -420,8 +722,11 @@ public:
     //
     // DESTRUCTION OVERRIDES
     //
-  public:
-    inline void DestroyVertexEx(VertexID vertex, VertexType& vertexType, bool compactIfDestroy = true, unsigned* incomingEdgeCount = NULL, unsigned* outgoingEdgeCount = NULL ) {
+  private:
+    // Leaves the rows of whatever could reach the vertex as they were, for
+    // callers that know nothing stops being reachable (see ContractVertices)
+    void DestroyVertexKeepingReach(VertexID vertex, VertexType& vertexType, bool compactIfDestroy, unsigned* incomingEdgeCount = NULL, unsigned* outgoingEdgeCount = NULL) {
+        NoteVertexDestroyed(vertex);
         OrientedGraph::DestroyVertexEx(vertex, vertexType, compactIfDestroy, incomingEdgeCount, outgoingEdgeCount);
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
         unsigned incomingEdgeCanreach;
@@ -430,6 +735,21 @@ public:
         m_canreach.DestroyVertexEx(vertex, vertexTypeCanreach, compactIfDestroy, &incomingEdgeCanreach, &outgoingEdgeCanreach);
       #endif
     }
+
+  public:
+    inline void DestroyVertexEx(VertexID vertex, VertexType& vertexType, bool compactIfDestroy = true, unsigned* incomingEdgeCount = NULL, unsigned* outgoingEdgeCount = NULL ) {
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        // Paths through the vertex go away with it, so what could reach it
+        // may now have false positives (as when ClearEdge takes an edge out)
+        std::set<VertexID> canreachVertex = IncomingReachForVertexIncludingSelf(vertex);
+        canreachVertex.erase(vertex);
+      #endif
+        DestroyVertexKeepingReach(vertex, vertexType, compactIfDestroy, incomingEdgeCount, outgoingEdgeCount);
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        for (std::set<VertexID>::iterator iter = canreachVertex.begin(); iter != canreachVertex.end(); iter++)
+            MarkReachDirty(*iter);
+      #endif
+    }
     inline void DestroyVertex(VertexID vertex, unsigned* incomingEdgeCount = NULL, unsigned* outgoingEdgeCount = NULL) {
         VertexType vertexType;
         return DestroyVertexEx(vertex, vertexType, true /* compactIfDestroy */, incomingEdgeCount, outgoingEdgeCount);
@@ -487,7 +807,11 @@ public:
     // SetEdge throws exceptions on cycle.  To avoid having to write exception handling,
     // use this routine before calling SetEdge.
     inline bool InsertionWouldCauseCycle(VertexID fromVertex, VertexID toVertex) {
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        return CanReachEx(toVertex, fromVertex, true);
+      #else
         return CanReach(toVertex, fromVertex);
+      #endif
     }
 
     bool SetEdge(VertexID fromVertex, VertexID toVertex) {
@@ -500,6 +824,57 @@ public:
             throw bc;
         }
 
+        return SetEdgeKnownAcyclic(fromVertex, toVertex);
+    }
+    void AddEdge(VertexID fromVertex, VertexID toVertex) {
+        if (!SetEdge(fromVertex, toVertex))
+            assert(false);
+    }
+
+    enum EdgeInsertion {
+        edgeInserted,
+        edgeAlreadyPresent,
+        edgeWouldCauseCycle
+    };
+
+    // Tries fromVertex->toVertex for each of fromVertices in turn, reporting
+    // the ones that would make a cycle instead of throwing.  Edges into
+    // toVertex can't change what toVertex reaches (unless they close a cycle,
+    // and those are refused), so without the closure one search out from
+    // toVertex answers all of the cycle checks.
+    void SetEdgesTo(const std::vector<VertexID>& fromVertices, VertexID toVertex, std::vector<EdgeInsertion>& results) {
+        results.clear();
+      #if !DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        bool shareSearch = fromVertices.size() > 1;
+        VertexBitset toReaches;
+        if (shareSearch)
+            toReaches = Descendants(toVertex);
+      #endif
+
+        for (size_t index = 0; index < fromVertices.size(); index++) {
+            VertexID fromVertex = fromVertices[index];
+            assert(fromVertex != toVertex);
+          #if DIRECTEDACYCLICGRAPH_CONSISTENCY_CHECK
+            ConsistencyCheck cc (*this);
+          #endif
+
+          #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+            bool wouldCauseCycle = InsertionWouldCauseCycle(fromVertex, toVertex);
+          #else
+            bool wouldCauseCycle = shareSearch ? toReaches.Test(fromVertex) : InsertionWouldCauseCycle(fromVertex, toVertex);
+          #endif
+            if (wouldCauseCycle)
+                results.push_back(edgeWouldCauseCycle);
+            else if (SetEdgeKnownAcyclic(fromVertex, toVertex))
+                results.push_back(edgeInserted);
+            else
+                results.push_back(edgeAlreadyPresent);
+        }
+    }
+
+  private:
+    // The caller must already know that toVertex can't reach fromVertex
+    bool SetEdgeKnownAcyclic(VertexID fromVertex, VertexID toVertex) {
       #if DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK
         // this may have false positives, for the moment let's union the "false positive tristate"
         // with the rest of the "false positive" reachability data...
@@ -522,6 +897,17 @@ public:
       #endif
 
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        AddReachForNewEdge(fromVertex, toVertex);
+      #endif
+
+        NoteEdgeAdded(fromVertex, toVertex);
+        return true;
+    }
+
+  #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+    // Gives everything that canreach fromVertex the reach of toVertex, once
+    // the physical edge between them is in place
+    void AddReachForNewEdge(VertexID fromVertex, VertexID toVertex) {
         // All the vertices that toVertex "canreach", including itself
         // (Note: may contain false positives if vertexTypeTo == canreachMayHaveFalsePositives)
         std::set<OrientedGraph::VertexID> toCanreach = OutgoingReachForVertexIncludingSelf(toVertex);
@@ -604,21 +990,16 @@ public:
                         if ((vertexTypeCanreachFrom == canreachClean) && (vertexTypeTo == canreachClean) && (vertexTypeFrom == canreachClean))
                             m_canreach.SetVertexType(canreachFromVertex,  canreachClean);
                         else
-                            m_canreach.SetVertexType(canreachFromVertex, canreachMayHaveFalsePositives);
+                            MarkReachDirty(canreachFromVertex);
                         SetReachEdge(canreachFromVertex, toCanreachVertex);
                     }
                 }
             }
         }
-      #endif
-
-        return true;
-    }
-    void AddEdge(VertexID fromVertex, VertexID toVertex) {
-        if (!SetEdge(fromVertex, toVertex))
-            assert(false);
     }
+  #endif
 
+  public:
     bool ClearEdge(VertexID fromVertex, VertexID toVertex) {
       #if DIRECTEDACYCLICGRAPH_CONSISTENCY_CHECK
         ConsistencyCheck cc (*this);
@@ -640,13 +1021,15 @@ public:
         VertexType vertexTypeFrom = m_canreach.GetVertexType(fromVertex);
         if ((vertexTypeFrom == canreachClean) && (extra == isReachableWithoutEdge)) {
             m_canreach.AddEdge(fromVertex, toVertex);
-            return true;
+            return true; // (reach is unchanged, nothing else to tell)
         }
       #else
         if (!OrientedGraph::ClearEdge(fromVertex, toVertex))
             return false;
       #endif
 
+        NoteEdgeRemoved(fromVertex, toVertex);
+
       #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
         // removing a edge calls into question all of our canreach vertices, and all the canreach vertices of vertices that
         // canreach us... however, anything downstream of us is guaranteed to not have its reachability affected
@@ -664,7 +1047,7 @@ public:
         std::set<OrientedGraph::VertexID>::iterator canreachFromIter = canreachFrom.begin();
         while (canreachFromIter != canreachFrom.end()) {
             OrientedGraph::VertexID canreachFromVertex = (*canreachFromIter);
-            m_canreach.SetVertexType(canreachFromVertex, canreachMayHaveFalsePositives);
+            MarkReachDirty(canreachFromVertex);
             canreachFromIter++;
         }
 
@@ -673,6 +1056,27 @@ public:
         if (m_canreach.EdgeExists(toVertex, fromVertex))
             m_canreach.RemoveEdge(toVertex, fromVertex);
         m_canreach.SetEdge(fromVertex, toVertex);
+
+        // When few pairs could have lost their reachability, fixing them now
+        // is cheap and saves a later query from paying for it.  What toVertex
+        // led to is counted off its canreach row and its physical edges (the
+        // slots of its edges may get counted as well, erring toward waiting).
+        bool cleanNow = (canreachFrom.size() <= m_eagerCleanThreshold);
+        if (cleanNow) {
+            VertexBitset toCanreach = m_canreach.NeighborsForVertex(toVertex, searchOutgoing);
+            toCanreach.OrWith(NeighborsForVertex(toVertex, searchOutgoing));
+            cleanNow = (canreachFrom.size() * (toCanreach.Count() + 1) <= m_eagerCleanThreshold);
+        }
+        if (cleanNow) {
+            canreachFromIter = canreachFrom.begin();
+            while (canreachFromIter != canreachFrom.end()) {
+                OrientedGraph::VertexID canreachFromVertex = (*canreachFromIter++);
+                if (m_canreach.GetVertexType(canreachFromVertex) == canreachMayHaveFalsePositives)
+                    CleanUpReachability(canreachFromVertex, canreachFromVertex);
+            }
+        }
+
+        SpendCleaningBudget();
       #endif
         return true;
     }
@@ -681,6 +1085,1390 @@ public:
             assert(false);
     }
 
+    // Turning fromVertex->toVertex around is a cycle exactly when fromVertex
+    // can still reach toVertex some other way, so that is the only question
+    // that needs asking (instead of the reachability question an AddEdge asks
+    // after a RemoveEdge).  Throws bad_cycle and leaves the edge as it was if
+    // so, returns false if there was no fromVertex->toVertex edge.
+    bool ReverseEdge(VertexID fromVertex, VertexID toVertex) {
+      #if DIRECTEDACYCLICGRAPH_CONSISTENCY_CHECK
+        ConsistencyCheck cc (*this);
+      #endif
+
+        if (!EdgeExists(fromVertex, toVertex))
+            return false;
+
+        // Settle the cycle question before anything changes, so a refusal
+        // leaves the graph as it was (with the closure cache, answering may
+        // clean some rows...but cleaning never loses anything)
+        if (CanReachWithoutEdge(fromVertex, toVertex)) {
+            bad_cycle bc;
+            throw bc;
+        }
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        // Nothing else leads from fromVertex to toVertex, so only the rows of
+        // what could reach toVertex change.  Those that went through fromVertex
+        // (and fromVertex itself) may lose reach, the rest gain fromVertex's.
+        std::set<VertexID> canreachFrom = IncomingReachForVertexIncludingSelf(fromVertex);
+
+        // Neither vertex reaches the other except by the edge, so the slot
+        // under it starts out empty in the new direction
+        SetTristateForConnection(fromVertex, toVertex, 0);
+      #endif
+
+        if (!OrientedGraph::ReverseEdge(fromVertex, toVertex))
+            assert(false);
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        // The old rows above fromVertex are still supersets, which is what a
+        // dirty row is allowed to be.  fromVertex's own row is rebuilt from
+        // its remaining children right away, since it is about to be handed
+        // to everything that canreach toVertex.
+        std::set<VertexID>::iterator canreachFromIter = canreachFrom.begin();
+        while (canreachFromIter != canreachFrom.end()) {
+            VertexID canreachFromVertex = (*canreachFromIter++);
+            if (canreachFromVertex != fromVertex)
+                MarkReachDirty(canreachFromVertex);
+        }
+        m_canreach.SetVertexType(fromVertex, canreachMayHaveFalsePositives);
+        CleanUpReachability(fromVertex, fromVertex);
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK
+        SetTristateForConnection(toVertex, fromVertex, notReachableWithoutEdge);
+      #endif
+        AddReachForNewEdge(toVertex, fromVertex);
+      #endif
+
+        NoteEdgeRemoved(fromVertex, toVertex);
+        NoteEdgeAdded(toVertex, fromVertex);
+        return true;
+    }
+
+    //
+    // TOPOLOGICAL ORDER
+    //
+  private:
+    // The in-degree counts and the lists of children, gathered in a single
+    // pass over the buffer instead of asking each vertex for its edge sets
+    void ChildrenAndIncomingCounts(std::vector<std::vector<VertexID> >& children, std::vector<unsigned>& incomingCount) const {
+        VertexID firstInvalid = GetFirstInvalidVertexID();
+        incomingCount.assign(firstInvalid, 0);
+        children.assign(firstInvalid, std::vector<VertexID>());
+        ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+            children[fromVertex].push_back(toVertex);
+            incomingCount[toVertex]++;
+        });
+    }
+
+    // Kahn's algorithm.  Children are handed back since the algorithms that
+    // want an order usually want those too.
+    void TopologicalOrderAndChildren(std::vector<VertexID>& order, std::vector<std::vector<VertexID> >& children) const {
+        std::vector<unsigned> incomingCount;
+        ChildrenAndIncomingCounts(children, incomingCount);
+
+        order.clear();
+        for (VertexID vertex = 0; vertex < GetFirstInvalidVertexID(); vertex++) {
+            if (VertexExists(vertex) && (incomingCount[vertex] == 0))
+                order.push_back(vertex);
+        }
+
+        // order doubles as the queue; everything before 'next' has been visited
+        for (size_t next = 0; next < order.size(); next++) {
+            std::vector<VertexID>& childrenOfNext = children[order[next]];
+            for (size_t index = 0; index < childrenOfNext.size(); index++) {
+                VertexID childVertex = childrenOfNext[index];
+                if (--incomingCount[childVertex] == 0)
+                    order.push_back(childVertex);
+            }
+        }
+    }
+
+  public:
+    // Every vertex appears after all of the vertices that can reach it
+    std::vector<VertexID> TopologicalOrder() const {
+        std::vector<VertexID> order;
+        std::vector<std::vector<VertexID> > children;
+        TopologicalOrderAndChildren(order, children);
+        return order;
+    }
+
+    // Calls back with successive "levels" of the graph: first all the vertices
+    // with no incoming edges, then all those whose incoming edges are only from
+    // the first level, and so on.  Nothing in a level can reach anything else in
+    // it, so a scheduler can hand out the whole batch at once (and the callback
+    // can process its contents in parallel).  The callback must not modify the
+    // graph.
+    template<class Callback>
+    void ForEachLevel(Callback callback) const {
+        std::vector<std::vector<VertexID> > children;
+        std::vector<unsigned> incomingCount;
+        ChildrenAndIncomingCounts(children, incomingCount);
+
+        std::vector<VertexID> level;
+        for (VertexID vertex = 0; vertex < GetFirstInvalidVertexID(); vertex++) {
+            if (VertexExists(vertex) && (incomingCount[vertex] == 0))
+                level.push_back(vertex);
+        }
+
+        std::vector<VertexID> nextLevel;
+        while (!level.empty()) {
+            callback(level);
+
+            nextLevel.clear();
+            for (size_t levelIndex = 0; levelIndex < level.size(); levelIndex++) {
+                std::vector<VertexID>& childrenOfVertex = children[level[levelIndex]];
+                for (size_t index = 0; index < childrenOfVertex.size(); index++) {
+                    VertexID childVertex = childrenOfVertex[index];
+                    if (--incomingCount[childVertex] == 0)
+                        nextLevel.push_back(childVertex);
+                }
+            }
+            level.swap(nextLevel);
+        }
+    }
+
+    //
+    // LAZY TRAVERSAL
+    //
+    // Cursors that hand back one vertex per call to Next(), for callers that
+    // may stop long before the whole answer is known (e.g. looking for the
+    // first descendant with some property).  All the memory a cursor needs is
+    // allocated when it is made, so stepping doesn't allocate.  The graph must
+    // not be modified while a cursor is in use.
+    //
+  public:
+    // Breadth-first over descendants or ancestors, not including the start.
+    // A vertex's neighbors are only scanned for once the vertices found
+    // before them have all been handed out.
+    class ReachCursor {
+      private:
+        const DirectedAcyclicGraph& m_graph;
+        SearchDirection m_direction;
+        VertexBitset m_visited;
+        std::vector<VertexID> m_found; // in the order they were found
+        size_t m_nextToReturn;
+        size_t m_nextToExpand;
+
+      public:
+        bool Next(VertexID& vertex) {
+            while (m_nextToReturn == m_found.size()) {
+                if (m_nextToExpand == m_found.size())
+                    return false;
+                m_graph.ForEachNeighborUntil(m_found[m_nextToExpand++], m_direction, [&](VertexID neighbor) {
+                    if (!m_visited.Test(neighbor)) {
+                        m_visited.Set(neighbor);
+                        m_found.push_back(neighbor); // reserved, never reallocates
+                    }
+                    return false;
+                });
+            }
+            vertex = m_found[m_nextToReturn++];
+            return true;
+        }
+
+      public:
+        ReachCursor(const DirectedAcyclicGraph& graph, VertexID startVertex, SearchDirection direction) :
+            m_graph (graph),
+            m_direction (direction),
+            m_visited (graph.GetFirstInvalidVertexID()),
+            m_nextToReturn (1),
+            m_nextToExpand (0)
+        {
+            assert(graph.VertexExists(startVertex));
+            m_found.reserve(graph.GetFirstInvalidVertexID());
+            m_visited.Set(startVertex);
+            m_found.push_back(startVertex);
+        }
+    };
+
+    // Same order as TopologicalOrder(), produced as it is consumed.  The one
+    // pass over the buffer to count incoming edges still happens up front.
+    class TopologicalCursor {
+      private:
+        std::vector<std::vector<VertexID> > m_children;
+        std::vector<unsigned> m_incomingCount;
+        std::vector<VertexID> m_order; // doubles as the queue, as in Kahn's
+        size_t m_next;
+
+      public:
+        bool Next(VertexID& vertex) {
+            if (m_next == m_order.size())
+                return false;
+            vertex = m_order[m_next++];
+            std::vector<VertexID>& childrenOfVertex = m_children[vertex];
+            for (size_t index = 0; index < childrenOfVertex.size(); index++) {
+                VertexID childVertex = childrenOfVertex[index];
+                if (--m_incomingCount[childVertex] == 0)
+                    m_order.push_back(childVertex); // reserved, never reallocates
+            }
+            return true;
+        }
+
+      public:
+        TopologicalCursor(const DirectedAcyclicGraph& graph) :
+            m_next (0)
+        {
+            graph.ChildrenAndIncomingCounts(m_children, m_incomingCount);
+            m_order.reserve(graph.GetFirstInvalidVertexID());
+            for (VertexID vertex = 0; vertex < graph.GetFirstInvalidVertexID(); vertex++) {
+                if (graph.VertexExists(vertex) && (m_incomingCount[vertex] == 0))
+                    m_order.push_back(vertex);
+            }
+        }
+    };
+
+    ReachCursor DescendantCursor(VertexID vertex) const {
+        return ReachCursor(*this, vertex, searchOutgoing);
+    }
+    ReachCursor AncestorCursor(VertexID vertex) const {
+        return ReachCursor(*this, vertex, searchIncoming);
+    }
+    TopologicalCursor TopologicalOrderCursor() const {
+        return TopologicalCursor(*this);
+    }
+
+
+    //
+    // SUBGRAPHS
+    //
+    // Any induced subgraph of a DAG is acyclic, so nothing is checked while
+    // copying.  The closure rows in m_canreach are cut down to the chosen
+    // vertices the same way as the edges.  What is reachable in the whole
+    // graph is a superset of what is reachable in the subgraph, and cutting
+    // a transitive relation down to a subset leaves it transitive, so the
+    // projected rows are at worst dirty (false positives only).  They're
+    // exact when the set is convex: when no path leaves it and comes back.
+    //
+  #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+  private:
+    // Looks at the children of the set that are outside it, and whether
+    // any of them reach back in.  Dirty rows may answer "no" when the set
+    // is convex, which only costs cleaning later.
+    bool IsConvexSubset(const std::vector<VertexID>& vertices) const {
+        VertexBitset inside (GetFirstInvalidVertexID());
+        for (size_t index = 0; index < vertices.size(); index++)
+            inside.Set(vertices[index]);
+        VertexBitset exits (GetFirstInvalidVertexID());
+        for (size_t index = 0; index < vertices.size(); index++) {
+            ForEachNeighborUntil(vertices[index], searchOutgoing, [&](VertexID child) {
+                if (!inside.Test(child))
+                    exits.Set(child);
+                return false;
+            });
+        }
+
+        bool convex = true;
+        exits.ForEach([&](VertexID exit) {
+            if (!convex)
+                return;
+            if (ForEachNeighborUntil(exit, searchOutgoing, [&](VertexID child) { return inside.Test(child); })) {
+                convex = false;
+                return;
+            }
+            std::set<VertexID> reach = m_canreach.OutgoingEdgesForVertex(exit);
+            for (std::set<VertexID>::iterator reachIter = reach.begin(); reachIter != reach.end(); reachIter++) {
+                if (inside.Test(*reachIter)) {
+                    convex = false;
+                    return;
+                }
+            }
+        });
+        return convex;
+    }
+  #endif
+
+  public:
+    // The sub-DAG induced by vertices (see OrientedGraph::ExtractSubgraph()),
+    // with its sidestructures ready to use
+    DirectedAcyclicGraph ExtractSubgraph(const std::set<VertexID>& vertices, std::vector<VertexID>* remap = NULL) const {
+        std::vector<VertexID> sorted (vertices.begin(), vertices.end());
+        VertexID numVertices = static_cast<VertexID>(sorted.size());
+        DirectedAcyclicGraph subgraph (numVertices);
+        ExtractSubgraphInto(sorted, subgraph);
+        FillSubgraphRemap(sorted, remap);
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        subgraph.m_cleaningBudget = m_cleaningBudget;
+        subgraph.m_eagerCleanThreshold = m_eagerCleanThreshold;
+        m_canreach.ExtractSubgraphInto(sorted, subgraph.m_canreach);
+        if (!IsConvexSubset(sorted)) {
+            for (VertexID vertex = 0; vertex < numVertices; vertex++)
+                subgraph.m_canreach.SetVertexType(vertex, canreachMayHaveFalsePositives);
+        }
+        if (m_cleaningBudget != 0) {
+            for (VertexID vertex = 0; vertex < numVertices; vertex++) {
+                if (subgraph.m_canreach.GetVertexType(vertex) == canreachMayHaveFalsePositives)
+                    subgraph.m_dirtyQueue.push_back(vertex);
+            }
+        }
+      #endif
+
+        // The other sidestructures are cheaper to build over than to project
+        for (VertexID vertex = 0; vertex < numVertices; vertex++)
+            subgraph.NoteVertexCreated(vertex);
+      #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+        for (unsigned direction = 0; direction < 2; direction++)
+            subgraph.m_sketchDirty[direction].assign(numVertices, true);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+        subgraph.RebuildReachabilityLabels();
+      #endif
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        subgraph.RebuildDescendantSignatures();
+      #endif
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        subgraph.ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+            subgraph.m_counting.AddEdge(fromVertex, toVertex);
+        });
+      #endif
+        return subgraph;
+    }
+
+    //
+    // MERGING
+    //
+    // Bringing another DAG's edges in with SetEdge() asks the cycle question
+    // once per edge, and which edges get refused depends on the order they
+    // are tried in.  Here the union of the two graphs is searched once for
+    // its strongly connected components instead.  Every cycle lies inside
+    // one component, so edges between components are all kept.  Inside a
+    // component the vertices are put in an order that this graph's own edges
+    // all agree with, and the incoming edges which point backwards in it are
+    // the ones left out.
+    //
+  private:
+    // Tarjan's algorithm, without recursion.  Components are numbered as they
+    // are finished, which is a reverse topological order: if a->b joins two
+    // different components, the number for a is the larger.
+    static void StronglyConnectedComponents(const std::vector<std::vector<VertexID> >& children, std::vector<VertexID>& component) {
+        const VertexID unvisited = std::numeric_limits<VertexID>::max();
+        VertexID numVertices = static_cast<VertexID>(children.size());
+        std::vector<VertexID> visitIndex (numVertices, unvisited);
+        std::vector<VertexID> lowLink (numVertices, 0);
+        std::vector<bool> onStack (numVertices, false);
+        std::vector<VertexID> stack;
+        std::vector<std::pair<VertexID, size_t> > path; // vertex, and the next of its children to look at
+        component.assign(numVertices, unvisited);
+        VertexID nextVisit = 0;
+        VertexID nextComponent = 0;
+
+        for (VertexID root = 0; root < numVertices; root++) {
+            if (visitIndex[root] != unvisited)
+                continue;
+            visitIndex[root] = lowLink[root] = nextVisit++;
+            stack.push_back(root);
+            onStack[root] = true;
+            path.push_back(std::make_pair(root, 0));
+
+            while (!path.empty()) {
+                VertexID vertex = path.back().first;
+                if (path.back().second < children[vertex].size()) {
+                    VertexID child = children[vertex][path.back().second++];
+                    if (visitIndex[child] == unvisited) {
+                        visitIndex[child] = lowLink[child] = nextVisit++;
+                        stack.push_back(child);
+                        onStack[child] = true;
+                        path.push_back(std::make_pair(child, 0));
+                    } else if (onStack[child]) {
+                        lowLink[vertex] = std::min(lowLink[vertex], visitIndex[child]);
+                    }
+                    continue;
+                }
+
+                path.pop_back();
+                if (!path.empty()) {
+                    VertexID parent = path.back().first;
+                    lowLink[parent] = std::min(lowLink[parent], lowLink[vertex]);
+                }
+                if (lowLink[vertex] == visitIndex[vertex]) {
+                    VertexID member;
+                    do {
+                        member = stack.back();
+                        stack.pop_back();
+                        onStack[member] = false;
+                        component[member] = nextComponent;
+                    } while (member != vertex);
+                    nextComponent++;
+                }
+            }
+        }
+    }
+
+    // Kahn's algorithm within each component of more than one vertex, giving
+    // each its place in the order.  The first ownCount[vertex] children of a
+    // vertex are this graph's edges, and the rest are incoming.  When every
+    // vertex left has a parent left, one with none through this graph's edges
+    // is taken anyway (such a vertex exists, since those edges are acyclic),
+    // preferring the one whose incoming edges would lose the fewest.
+    static void OrderWithinComponents(const std::vector<std::vector<VertexID> >& children, const std::vector<size_t>& ownCount, const std::vector<VertexID>& component, std::vector<VertexID>& position) {
+        VertexID numVertices = static_cast<VertexID>(children.size());
+        std::vector<std::vector<VertexID> > members (numVertices);
+        for (VertexID vertex = 0; vertex < numVertices; vertex++)
+            members[component[vertex]].push_back(vertex);
+
+        std::vector<unsigned> ownParents (numVertices, 0);
+        std::vector<unsigned> incomingParents (numVertices, 0);
+        for (VertexID vertex = 0; vertex < numVertices; vertex++) {
+            for (size_t index = 0; index < children[vertex].size(); index++) {
+                VertexID child = children[vertex][index];
+                if (component[child] != component[vertex])
+                    continue;
+                if (index < ownCount[vertex])
+                    ownParents[child]++;
+                else
+                    incomingParents[child]++;
+            }
+        }
+
+        const VertexID unplaced = std::numeric_limits<VertexID>::max();
+        position.assign(numVertices, unplaced);
+        std::vector<VertexID> ready;
+        for (VertexID which = 0; which < numVertices; which++) {
+            std::vector<VertexID>& group = members[which];
+            if (group.size() < 2)
+                continue;
+            for (size_t index = 0; index < group.size(); index++) {
+                if ((ownParents[group[index]] == 0) && (incomingParents[group[index]] == 0))
+                    ready.push_back(group[index]);
+            }
+            for (VertexID nextPosition = 0; nextPosition < group.size(); nextPosition++) {
+                VertexID vertex = unplaced;
+                while (!ready.empty() && (vertex == unplaced)) {
+                    vertex = ready.back();
+                    ready.pop_back();
+                    if (position[vertex] != unplaced)
+                        vertex = unplaced;
+                }
+                if (vertex == unplaced) {
+                    for (size_t index = 0; index < group.size(); index++) {
+                        VertexID candidate = group[index];
+                        if ((position[candidate] == unplaced) && (ownParents[candidate] == 0)
+                            && ((vertex == unplaced) || (incomingParents[candidate] < incomingParents[vertex])))
+                            vertex = candidate;
+                    }
+                    assert(vertex != unplaced);
+                }
+
+                position[vertex] = nextPosition;
+                for (size_t index = 0; index < children[vertex].size(); index++) {
+                    VertexID child = children[vertex][index];
+                    if ((component[child] != which) || (position[child] != unplaced))
+                        continue;
+                    if (index < ownCount[vertex])
+                        ownParents[child]--;
+                    else
+                        incomingParents[child]--;
+                    if ((ownParents[child] == 0) && (incomingParents[child] == 0))
+                        ready.push_back(child);
+                }
+            }
+            ready.clear();
+        }
+    }
+
+  public:
+    // Adds the vertices and edges of other to this graph.  remap gives what
+    // each of other's vertex IDs becomes here (in the form ExtractSubgraph()
+    // hands back, so max() leaves a vertex out); without one, IDs are kept.
+    // Vertices that don't exist here yet are created with other's vertex
+    // type.  Rather than throwing bad_cycle, the edges of other which would
+    // close a cycle are left out and returned, in this graph's IDs.  Each
+    // of those is on a cycle of the union, but not every edge on a cycle is
+    // left out: just enough of them to break all of the cycles.
+    //
+    // The accepted edges go in deepest first.  By the time an edge is added,
+    // the closure row of its target already holds everything it will, so
+    // each ancestor's row is brought up to date from it in one pass instead
+    // of again for every edge further down.
+    std::vector<std::pair<VertexID, VertexID> > Merge(const DirectedAcyclicGraph& other, const std::vector<VertexID>* remap = NULL) {
+      #if DIRECTEDACYCLICGRAPH_CONSISTENCY_CHECK
+        ConsistencyCheck cc (*this);
+      #endif
+
+        const VertexID leftOut = std::numeric_limits<VertexID>::max();
+        std::vector<VertexID> mapped (other.GetFirstInvalidVertexID(), leftOut);
+        VertexID firstInvalid = GetFirstInvalidVertexID();
+        for (VertexID vertex = 0; vertex < other.GetFirstInvalidVertexID(); vertex++) {
+            if (!other.VertexExists(vertex))
+                continue;
+            assert((remap == NULL) || (vertex < remap->size()));
+            mapped[vertex] = (remap == NULL) ? vertex : (*remap)[vertex];
+            if ((mapped[vertex] != leftOut) && (mapped[vertex] >= firstInvalid))
+                firstInvalid = mapped[vertex] + 1;
+        }
+        if (firstInvalid > GetFirstInvalidVertexID())
+            GrowCapacityForMaxValidVertexID(firstInvalid - 1);
+        for (VertexID vertex = 0; vertex < other.GetFirstInvalidVertexID(); vertex++) {
+            VertexType vertexType;
+            if ((mapped[vertex] != leftOut) && !VertexExists(mapped[vertex]) && other.VertexExistsEx(vertex, vertexType))
+                CreateVertexEx(mapped[vertex], vertexType);
+        }
+
+        // Only the edges which aren't here already take part (a remap which
+        // sends two connected vertices to one ID makes a loop, left out too)
+        std::vector<std::pair<VertexID, VertexID> > incoming;
+        other.ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+            VertexID mappedFrom = mapped[fromVertex];
+            VertexID mappedTo = mapped[toVertex];
+            if ((mappedFrom == leftOut) || (mappedTo == leftOut))
+                return;
+            if ((mappedFrom == mappedTo) || !EdgeExists(mappedFrom, mappedTo))
+                incoming.push_back(std::make_pair(mappedFrom, mappedTo));
+        });
+
+        std::vector<std::vector<VertexID> > children;
+        std::vector<unsigned> incomingCount;
+        ChildrenAndIncomingCounts(children, incomingCount);
+        std::vector<size_t> ownCount (children.size());
+        for (size_t vertex = 0; vertex < children.size(); vertex++)
+            ownCount[vertex] = children[vertex].size();
+        for (size_t index = 0; index < incoming.size(); index++)
+            children[incoming[index].first].push_back(incoming[index].second);
+        std::vector<VertexID> component;
+        StronglyConnectedComponents(children, component);
+        std::vector<VertexID> position;
+        OrderWithinComponents(children, ownCount, component, position);
+
+        std::vector<std::pair<VertexID, VertexID> > conflicts;
+        std::vector<std::pair<VertexID, VertexID> > accepted;
+        for (size_t index = 0; index < incoming.size(); index++) {
+            VertexID fromVertex = incoming[index].first;
+            VertexID toVertex = incoming[index].second;
+            if ((component[fromVertex] == component[toVertex]) && !(position[fromVertex] < position[toVertex]))
+                conflicts.push_back(incoming[index]);
+            else
+                accepted.push_back(incoming[index]);
+        }
+
+        std::stable_sort(accepted.begin(), accepted.end(),
+            [&](const std::pair<VertexID, VertexID>& left, const std::pair<VertexID, VertexID>& right) {
+                if (component[left.first] != component[right.first])
+                    return component[left.first] < component[right.first];
+                return position[left.first] > position[right.first];
+            }
+        );
+        for (size_t index = 0; index < accepted.size(); index++)
+            SetEdgeKnownAcyclic(accepted[index].first, accepted[index].second);
+        return conflicts;
+    }
+
+    //
+    // CONTRACTION
+    //
+    // Folding one vertex into another can only make a cycle if there is a
+    // path between them that goes through some third vertex, which would
+    // close up on itself once the two ends are the same vertex.  So one
+    // reachability question each way answers it, and the edges are moved
+    // over without asking again.
+    //
+    // Nothing stops being reachable (paths through the removed vertex go
+    // through the kept one instead), so the closure only grows: everything
+    // which could reach either vertex can now reach all that either one did.
+    // That's a single pass OR-ing the two rows into those vertices' rows,
+    // rather than a closure update for every edge moved.
+    //
+  public:
+    // Moves every edge of remove over to keep (dropping any between the two,
+    // and merging with edges keep already has), then destroys remove without
+    // compacting.  Throws bad_cycle and leaves the graph as it was if that
+    // would make a cycle.
+    void ContractVertices(VertexID keep, VertexID remove) {
+      #if DIRECTEDACYCLICGRAPH_CONSISTENCY_CHECK
+        ConsistencyCheck cc (*this);
+      #endif
+
+        assert(keep != remove);
+        assert(VertexExists(keep) && VertexExists(remove));
+
+        bool forwardEdge, reverseEdge;
+        HasLinkage(keep, remove, &forwardEdge, &reverseEdge);
+        bool wouldCauseCycle;
+        if (forwardEdge)
+            wouldCauseCycle = CanReachWithoutEdge(keep, remove);
+        else if (reverseEdge)
+            wouldCauseCycle = CanReachWithoutEdge(remove, keep);
+        else
+            wouldCauseCycle = CanReach(keep, remove) || CanReach(remove, keep);
+        if (wouldCauseCycle) {
+            bad_cycle bc;
+            throw bc;
+        }
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        // Gathered from the graph as it was, since the rows of remove go
+        // away with it
+        std::set<VertexID> canreachEither = IncomingReachForVertexIncludingSelf(keep);
+        std::set<VertexID> canreachRemove = IncomingReachForVertexIncludingSelf(remove);
+        canreachEither.insert(canreachRemove.begin(), canreachRemove.end());
+        canreachEither.erase(remove);
+        std::set<VertexID> eitherCanreach = OutgoingReachForVertexIncludingSelf(keep);
+        std::set<VertexID> removeCanreach = OutgoingReachForVertexIncludingSelf(remove);
+        eitherCanreach.insert(removeCanreach.begin(), removeCanreach.end());
+        eitherCanreach.erase(remove);
+        bool eitherDirty = (m_canreach.GetVertexType(keep) == canreachMayHaveFalsePositives)
+            || (m_canreach.GetVertexType(remove) == canreachMayHaveFalsePositives);
+      #endif
+
+        // Move the edges.  Those that are new to keep are acyclic together
+        // with the old ones (any cycle would map to one in the result), so the
+        // sidestructures can be told about each as an ordinary insertion.
+        for (unsigned direction = searchOutgoing; direction <= searchIncoming; direction++) {
+            std::vector<VertexID> neighbors;
+            ForEachNeighborUntil(remove, static_cast<SearchDirection>(direction), [&](VertexID neighbor) {
+                if (neighbor != keep)
+                    neighbors.push_back(neighbor);
+                return false;
+            });
+            for (size_t index = 0; index < neighbors.size(); index++) {
+                VertexID fromVertex = (direction == searchOutgoing) ? keep : neighbors[index];
+                VertexID toVertex = (direction == searchOutgoing) ? neighbors[index] : keep;
+                if (EdgeExists(fromVertex, toVertex))
+                    continue;
+              #if DIRECTEDACYCLICGRAPH_USER_TRISTATE
+                Nstate<3> userTristate = (direction == searchOutgoing)
+                    ? GetTristateForConnection(remove, neighbors[index])
+                    : GetTristateForConnection(neighbors[index], remove);
+              #endif
+                OrientedGraph::AddEdge(fromVertex, toVertex);
+              #if DIRECTEDACYCLICGRAPH_USER_TRISTATE
+                SetTristateForConnection(fromVertex, toVertex, userTristate);
+              #elif DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK
+                // Whether there's another way is not worked out here, so
+                // say there is and let cleaning check it
+                SetTristateForConnection(fromVertex, toVertex, isReachableWithoutEdge);
+                MarkReachDirty(fromVertex);
+              #endif
+                NoteEdgeAdded(fromVertex, toVertex);
+            }
+        }
+
+        // What reached remove reaches keep now, so unlike DestroyVertexEx
+        // this has no rows to mark dirty
+        VertexType vertexType;
+        DestroyVertexKeepingReach(remove, vertexType, false /* compactIfDestroy */);
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        std::set<VertexID>::iterator canreachEitherIter = canreachEither.begin();
+        while (canreachEitherIter != canreachEither.end()) {
+            VertexID canreachVertex = (*canreachEitherIter++);
+            if (eitherDirty)
+                MarkReachDirty(canreachVertex);
+
+            std::set<VertexID>::iterator eitherCanreachIter = eitherCanreach.begin();
+            while (eitherCanreachIter != eitherCanreach.end()) {
+                VertexID reachedVertex = (*eitherCanreachIter++);
+                if (reachedVertex == canreachVertex)
+                    continue;
+
+                bool forwardLink, reverseLink;
+                HasLinkage(canreachVertex, reachedVertex, &forwardLink, &reverseLink);
+                if (forwardLink) {
+                  #if DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK
+                    // There's now a way around this edge, through the
+                    // contracted vertex.  That's certain unless the edge is
+                    // the one getting to (or out of) the contracted vertex.
+                    if (GetTristateForConnection(canreachVertex, reachedVertex) == notReachableWithoutEdge) {
+                        SetTristateForConnection(canreachVertex, reachedVertex, isReachableWithoutEdge);
+                        if ((canreachVertex == keep) || (reachedVertex == keep))
+                            MarkReachDirty(canreachVertex);
+                    }
+                  #endif
+                } else if (reverseLink) {
+                    // only possible as a false positive, which isn't passed on
+                    assert(m_canreach.GetVertexType(reachedVertex) == canreachMayHaveFalsePositives);
+                } else {
+                    if (m_canreach.GetVertexType(reachedVertex) == canreachMayHaveFalsePositives)
+                        ClearReachEdge(reachedVertex, canreachVertex);
+                    else
+                        assert(!m_canreach.EdgeExists(reachedVertex, canreachVertex));
+                    SetReachEdge(canreachVertex, reachedVertex);
+                }
+            }
+        }
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK
+        // The way around one of keep's edges may have crossed the edge that
+        // joined the two, and folded into the edge itself
+        if (forwardEdge || reverseEdge) {
+            for (unsigned direction = searchOutgoing; direction <= searchIncoming; direction++) {
+                ForEachNeighborUntil(keep, static_cast<SearchDirection>(direction), [&](VertexID neighbor) {
+                    VertexID fromVertex = (direction == searchOutgoing) ? keep : neighbor;
+                    VertexID toVertex = (direction == searchOutgoing) ? neighbor : keep;
+                    if (GetTristateForConnection(fromVertex, toVertex) == isReachableWithoutEdge)
+                        MarkReachDirty(fromVertex);
+                    return false;
+                });
+            }
+        }
+      #endif
+      #endif
+    }
+
+    //
+    // TRANSITIVE REDUCTION
+    //
+  private:
+    // Take out an edge which we know toVertex is reachable without.  Nothing's
+    // reachability changes, so unlike ClearEdge there's nothing to dirty.
+    void RemoveRedundantEdge(VertexID fromVertex, VertexID toVertex) {
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        // give up the tristate, and leave the reach edge that the physical edge
+        // was standing in for
+        SetTristateForConnection(fromVertex, toVertex, 0);
+        OrientedGraph::RemoveEdge(fromVertex, toVertex);
+        m_canreach.AddEdge(fromVertex, toVertex);
+      #else
+        OrientedGraph::RemoveEdge(fromVertex, toVertex);
+        #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        // reach is the same, but the paths through the edge are gone
+        RemoveCountedEdge(fromVertex, toVertex);
+        #endif
+      #endif
+    }
+
+  public:
+    // An edge is redundant if its target can be reached from its source some
+    // other way.  With DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK that is
+    // exactly what the extra tristate on each physical edge records, so on a
+    // clean vertex this is O(1).  Otherwise it costs a traversal.
+    bool IsEdgeRedundant(VertexID fromVertex, VertexID toVertex) {
+        return CanReachWithoutEdge(fromVertex, toVertex);
+    }
+
+    // Calls back with (fromVertex, toVertex) for each redundant edge.  Since
+    // redundant edges never depend on each other for their redundancy, the
+    // callback is free to remove the edge it is given (but shouldn't make
+    // other changes to the graph while this runs).
+    template<class Callback>
+    void ForEachRedundantEdge(Callback callback) {
+        std::vector<std::pair<VertexID, VertexID> > redundantEdges;
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACH_WITHOUT_LINK
+        // read the tristates, cleaning the vertices they can't be trusted on
+        for (VertexID vertex = 0; vertex < GetFirstInvalidVertexID(); vertex++) {
+            if (!VertexExists(vertex))
+                continue;
+
+            std::set<VertexID> outgoing = OutgoingEdgesForVertex(vertex);
+            std::set<VertexID>::iterator outgoingIter = outgoing.begin();
+            while (outgoingIter != outgoing.end()) {
+                VertexID outgoingVertex = (*outgoingIter++);
+                if (CanReachWithoutEdge(vertex, outgoingVertex))
+                    redundantEdges.push_back(std::make_pair(vertex, outgoingVertex));
+            }
+        }
+      #else
+        // a traversal per edge would be wasteful, when one bitset pass finds them all
+        redundantEdges = TransitiveReduction(false);
+      #endif
+
+        for (size_t index = 0; index < redundantEdges.size(); index++)
+            callback(redundantEdges[index].first, redundantEdges[index].second);
+    }
+
+    // Removing all of the redundant edges at once (they don't support each other
+    // in a DAG) gives the unique minimal graph with the same reachability.
+    //
+    // Descendant bitsets are built in reverse topological order, so each is
+    // just an OR of its children's.  Visiting a vertex's children in
+    // topological order means any child reachable through a sibling is seen
+    // after that sibling, so it will already be in the bitset.
+    //
+    // A vertex's bitset is dropped once all of its parents have used it, so
+    // what is held at once is the "frontier" between the processed vertices
+    // and the rest.  That is usually far fewer than all of them, but graphs
+    // with a wide antichain (many vertices, none reaching another, whose
+    // parents come late in the order) can still need O(N^2) bits.
+    //
+    // Returns the redundant edges, and removes them unless asked not to.
+    // (Note: this bypasses the edge-level overrides of wrapper classes like
+    // RandomEdgePicker, so use it on a plain DirectedAcyclicGraph.)
+    std::vector<std::pair<VertexID, VertexID> > TransitiveReduction(bool removeRedundantEdges = true) {
+      #if DIRECTEDACYCLICGRAPH_CONSISTENCY_CHECK
+        ConsistencyCheck cc (*this);
+      #endif
+
+        std::vector<VertexID> order;
+        std::vector<std::vector<VertexID> > children;
+        TopologicalOrderAndChildren(order, children);
+
+        VertexID firstInvalid = GetFirstInvalidVertexID();
+        std::vector<size_t> orderPosition (firstInvalid, 0);
+        for (size_t position = 0; position < order.size(); position++)
+            orderPosition[order[position]] = position;
+
+        std::vector<unsigned> parentsLeft (firstInvalid, 0);
+        for (size_t position = 0; position < order.size(); position++) {
+            std::vector<VertexID>& childrenOfVertex = children[order[position]];
+            for (size_t index = 0; index < childrenOfVertex.size(); index++)
+                parentsLeft[childrenOfVertex[index]]++;
+        }
+
+        std::vector<std::pair<VertexID, VertexID> > redundantEdges;
+        std::vector<VertexBitset> descendants (firstInvalid, VertexBitset (0));
+
+        std::vector<VertexID>::reverse_iterator orderIter = order.rbegin();
+        while (orderIter != order.rend()) {
+            VertexID vertex = (*orderIter++);
+            std::vector<VertexID>& childrenOfVertex = children[vertex];
+            std::sort(childrenOfVertex.begin(), childrenOfVertex.end(),
+                [&](VertexID left, VertexID right) {
+                    return orderPosition[left] < orderPosition[right];
+                }
+            );
+
+            VertexBitset reach (firstInvalid);
+            for (size_t index = 0; index < childrenOfVertex.size(); index++) {
+                VertexID childVertex = childrenOfVertex[index];
+                if (reach.Test(childVertex)) {
+                    redundantEdges.push_back(std::make_pair(vertex, childVertex));
+                } else {
+                    reach.Set(childVertex);
+                    reach.OrWith(descendants[childVertex]);
+                }
+                if (--parentsLeft[childVertex] == 0)
+                    VertexBitset (0).Swap(descendants[childVertex]);
+            }
+            if (parentsLeft[vertex] != 0)
+                reach.Swap(descendants[vertex]);
+        }
+
+        if (removeRedundantEdges) {
+            for (size_t index = 0; index < redundantEdges.size(); index++)
+                RemoveRedundantEdge(redundantEdges[index].first, redundantEdges[index].second);
+        }
+
+        return redundantEdges;
+    }
+
+    //
+    // COMMON ANCESTORS AND DESCENDANTS
+    //
+    // These count a vertex as its own ancestor and descendant, so if a can
+    // reach b then a is one of their common ancestors (and b a common
+    // descendant).  When the transitive closure is cached and everything it
+    // would be read from is clean, the answer is an AND of two rows (or
+    // columns) of it.  Otherwise a single search marks what it reaches from a
+    // with one color and from b with another, and keeps what gets both.
+    //
+  private:
+  #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+    // Reads a vertex's row (outgoing) or column (incoming) of the closure,
+    // including the vertex itself.  Returns false without touching reach if
+    // any of the closure data involved may have false positives.  The slots
+    // for physical edges in the canreach graph hold the extra tristate instead
+    // of reachability, so those are masked out and the edges added back.
+    bool ClosureReachIfClean(VertexID vertex, SearchDirection direction, VertexBitset& reach) {
+        if (direction == searchOutgoing) {
+            if (m_canreach.GetVertexType(vertex) != canreachClean)
+                return false;
+        }
+
+        VertexBitset physical = NeighborsForVertex(vertex, direction);
+        VertexBitset linked = NeighborsForVertex(vertex, (direction == searchOutgoing) ? searchIncoming : searchOutgoing);
+        linked.OrWith(physical);
+
+        VertexBitset closure = m_canreach.NeighborsForVertex(vertex, direction);
+        closure.AndNotWith(linked);
+
+        if (direction == searchIncoming) {
+            bool allClean = true;
+            closure.ForEach([&](VertexID ancestor) {
+                if (allClean && (m_canreach.GetVertexType(ancestor) != canreachClean))
+                    allClean = false;
+            });
+            if (!allClean)
+                return false;
+        }
+
+        closure.OrWith(physical);
+        closure.Set(vertex);
+        reach = closure;
+        return true;
+    }
+  #endif
+
+    VertexBitset CommonReach(VertexID vertexA, VertexID vertexB, SearchDirection direction) {
+        assert(VertexExists(vertexA));
+        assert(VertexExists(vertexB));
+
+      #if DIRECTEDACYCLICGRAPH_CACHE_REACHABILITY
+        VertexBitset reachA;
+        VertexBitset reachB;
+        if (ClosureReachIfClean(vertexA, direction, reachA) && ClosureReachIfClean(vertexB, direction, reachB)) {
+            reachA.AndWith(reachB);
+            return reachA;
+        }
+      #endif
+
+        // Each vertex is pushed at most twice, once per color it picks up
+        const unsigned char colorA = 1;
+        const unsigned char colorB = 2;
+        std::vector<unsigned char> colors (GetFirstInvalidVertexID(), 0);
+        std::stack<VertexID> searchStack;
+        colors[vertexA] |= colorA;
+        searchStack.push(vertexA);
+        colors[vertexB] |= colorB;
+        searchStack.push(vertexB);
+
+        while (!searchStack.empty()) {
+            VertexID searchVertex = searchStack.top();
+            searchStack.pop();
+            unsigned char color = colors[searchVertex];
+
+            ForEachNeighborUntil(searchVertex, direction, [&](VertexID neighbor) {
+                if ((colors[neighbor] | color) != colors[neighbor]) {
+                    colors[neighbor] |= color;
+                    searchStack.push(neighbor);
+                }
+                return false;
+            });
+        }
+
+        VertexBitset common (GetFirstInvalidVertexID());
+        for (VertexID vertex = 0; vertex < colors.size(); vertex++) {
+            if (colors[vertex] == (colorA | colorB))
+                common.Set(vertex);
+        }
+        return common;
+    }
+
+  public:
+    // Everything that can reach both vertexA and vertexB
+    VertexBitset CommonAncestors(VertexID vertexA, VertexID vertexB) {
+        return CommonReach(vertexA, vertexB, searchIncoming);
+    }
+
+    // Everything that both vertexA and vertexB can reach
+    VertexBitset CommonDescendants(VertexID vertexA, VertexID vertexB) {
+        return CommonReach(vertexA, vertexB, searchOutgoing);
+    }
+
+    // The common ancestors that don't reach any other common ancestor.  If one
+    // common ancestor reached another, the child it went through would be a
+    // common ancestor too...so it's enough to look at the direct children.
+    VertexBitset LowestCommonAncestors(VertexID vertexA, VertexID vertexB) {
+        VertexBitset common = CommonAncestors(vertexA, vertexB);
+        VertexBitset lowest (GetFirstInvalidVertexID());
+        common.ForEach([&](VertexID ancestor) {
+            bool commonChild = ForEachNeighborUntil(ancestor, searchOutgoing, [&](VertexID child) {
+                return common.Test(child);
+            });
+            if (!commonChild)
+                lowest.Set(ancestor);
+        });
+        return lowest;
+    }
+
+
+    //
+    // SIDESTRUCTURE NOTIFICATIONS
+    //
+    // The optional sidestructures (besides the closure, which is woven into
+    // the edge routines) hear about changes to the graph through these.  A
+    // removal known not to change what can reach what, like dropping a
+    // redundant edge, doesn't need to report anything.
+    //
+  private:
+    void NoteCapacityChanged(size_t firstInvalid) {
+      #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+        ResizeSketches(firstInvalid);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+        m_labels.Resize(firstInvalid);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        m_signatures.resize(firstInvalid, 0);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        m_counting.Resize(firstInvalid);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+        m_hotSources.Clear(); // bitsets are sized to the old capacity
+      #endif
+    }
+    void NoteVertexCreated(VertexID vertex) {
+      #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+        for (unsigned direction = 0; direction < 2; direction++) {
+            m_sketches[direction][vertex].Clear();
+            m_sketches[direction][vertex].Add(vertex);
+            m_sketchDirty[direction][vertex] = false;
+        }
+      #endif
+      #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+        m_labels.AddVertex(vertex);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        m_signatures[vertex] = SignatureBit(vertex);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        m_counting.ClearVertex(vertex);
+      #endif
+    }
+    void NoteVertexDestroyed(VertexID vertex) {
+      #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+        // everything upstream or downstream might lose reach through this vertex
+        MarkSketchesDirtyFrom(vertex, searchOutgoing);
+        MarkSketchesDirtyFrom(vertex, searchIncoming);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+        m_hotSources.Clear(); // destroying may compact the capacity
+      #endif
+      #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+        m_labels.RemoveVertex(vertex);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        m_signatureRemovals++;
+      #endif
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        // The edges are still there, so take them out of the counts one at a
+        // time as if they were gone: outgoing first, then incoming
+        VertexBitset removed[2] = {
+            VertexBitset(GetFirstInvalidVertexID()),
+            VertexBitset(GetFirstInvalidVertexID())
+        };
+        for (unsigned direction = searchOutgoing; direction <= searchIncoming; direction++) {
+            std::vector<VertexID> neighbors;
+            ForEachNeighborUntil(vertex, static_cast<SearchDirection>(direction), [&](VertexID neighbor) {
+                neighbors.push_back(neighbor);
+                return false;
+            });
+            for (size_t index = 0; index < neighbors.size(); index++) {
+                removed[direction].Set(neighbors[index]);
+                if (direction == searchOutgoing)
+                    RemoveCountedEdge(vertex, neighbors[index], &vertex, removed);
+                else
+                    RemoveCountedEdge(neighbors[index], vertex, &vertex, removed);
+            }
+        }
+      #endif
+    }
+    void NoteEdgeAdded(VertexID fromVertex, VertexID toVertex) {
+      #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+        MergeSketchesForNewEdge(fromVertex, toVertex);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+        PatchHotSourcesForNewEdge(fromVertex, toVertex);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+        m_labels.AddEdge(fromVertex, toVertex,
+            [&](VertexID vertex, auto callback) {
+                ForEachNeighborUntil(vertex, searchIncoming, [&](VertexID parent) {
+                    callback(parent);
+                    return false;
+                });
+            },
+            [&](VertexID vertex, auto callback) {
+                ForEachNeighborUntil(vertex, searchOutgoing, [&](VertexID child) {
+                    callback(child);
+                    return false;
+                });
+            }
+        );
+      #endif
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        MergeSignatureUpstream(fromVertex, toVertex);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        m_counting.AddEdge(fromVertex, toVertex);
+      #endif
+    }
+    void NoteEdgeRemoved(VertexID fromVertex, VertexID toVertex) {
+      #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+        MarkSketchesDirtyForRemovedEdge(fromVertex, toVertex);
+      #endif
+      #if DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+        m_hotSources.Invalidate();
+      #endif
+      #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+        m_labels.NoteRemoval();
+      #endif
+      #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+        m_signatureRemovals++;
+      #endif
+      #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+        RemoveCountedEdge(fromVertex, toVertex);
+      #endif
+    }
+
+  #if DIRECTEDACYCLICGRAPH_COUNTING_CLOSURE
+    //
+    // COUNTING CLOSURE
+    //
+  private:
+    // While a vertex is being destroyed its edges are still in the graph, so
+    // the ones already taken out of the counts have to be skipped.  Those are
+    // given as the dying vertex's children and parents (indexed by direction).
+    void RemoveCountedEdge(
+        VertexID fromVertex,
+        VertexID toVertex,
+        const VertexID* dyingVertex = NULL,
+        const VertexBitset* removed = NULL
+    ) {
+        m_counting.RemoveEdge(fromVertex, toVertex, [&](VertexID vertex, auto callback) {
+            ForEachNeighborUntil(vertex, searchOutgoing, [&](VertexID child) {
+                if (dyingVertex) {
+                    if ((vertex == *dyingVertex) && removed[searchOutgoing].Test(child))
+                        return false;
+                    if ((child == *dyingVertex) && removed[searchIncoming].Test(vertex))
+                        return false;
+                }
+                callback(child);
+                return false;
+            });
+        });
+    }
+
+  public:
+    const CountingClosure& GetCountingClosure() const {
+        return m_counting;
+    }
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_HOT_SOURCE_CACHE
+    //
+    // HOT SOURCE CACHE
+    //
+  private:
+    // Insertions only add reach, so the cached entries that could reach
+    // fromVertex (or are fromVertex) pick up toVertex and its descendants.
+    // Those are only searched for if some entry needs them.
+    void PatchHotSourcesForNewEdge(VertexID fromVertex, VertexID toVertex) {
+        VertexBitset reached;
+        bool searched = false;
+        m_hotSources.ForEachCurrentEntry([&](VertexID source, VertexBitset& descendants) {
+            if ((source != fromVertex) && !descendants.Test(fromVertex))
+                return;
+            if (!searched) {
+                reached = Descendants(toVertex);
+                reached.Set(toVertex);
+                searched = true;
+            }
+            descendants.OrWith(reached);
+        });
+    }
+
+  public:
+    // How many vertices' descendants to keep; 0 turns the cache off
+    void SetHotSourceCacheCapacity(size_t capacity) {
+        m_hotSources.SetCapacity(capacity);
+    }
+    const HotSourceCache& GetHotSourceCache() const {
+        return m_hotSources;
+    }
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_REACHABILITY_LABELS
+    //
+    // REACHABILITY LABELS
+    //
+  public:
+    // Throws away the labels and builds them again from scratch, splitting
+    // the work across the threads allowed by SetSearchThreads().  CanReach
+    // does this on its own once enough edges have been removed.
+    void RebuildReachabilityLabels() {
+        VertexID firstInvalid = GetFirstInvalidVertexID();
+        std::vector<bool> exists (firstInvalid, false);
+        std::vector<std::vector<VertexID> > children (firstInvalid);
+        std::vector<std::vector<VertexID> > parents (firstInvalid);
+        for (VertexID vertex = 0; vertex < firstInvalid; vertex++)
+            exists[vertex] = VertexExists(vertex);
+        ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+            children[fromVertex].push_back(toVertex);
+            parents[toVertex].push_back(fromVertex);
+        });
+        m_labels.Build(exists, children, parents, SearchThreadCount());
+    }
+
+    // How many edge removals to tolerate (double checking positive answers
+    // with a search) before CanReach rebuilds the labels
+    void SetLabelRebuildThreshold(size_t removals) {
+        m_labels.SetRebuildThreshold(removals);
+    }
+    const ReachabilityLabels& GetReachabilityLabels() const {
+        return m_labels;
+    }
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_DESCENDANT_SIGNATURES
+    //
+    // DESCENDANT SIGNATURES
+    //
+    // Removing edges never clears bits, since a bit may have come from more
+    // than one descendant.  Signatures that are too big only make the filter
+    // less useful (the subset property still holds, because they grew while
+    // the reach was there), so they are rebuilt once there have been as many
+    // removals as vertices.
+    //
+  private:
+    static uint64_t SignatureBit(VertexID vertex) {
+        uint64_t hash = vertex * 0x9E3779B97F4A7C15ULL;
+        return static_cast<uint64_t>(1) << (hash >> 58);
+    }
+
+    void MergeSignatureUpstream(VertexID fromVertex, VertexID toVertex) {
+        uint64_t added = m_signatures[toVertex] & ~m_signatures[fromVertex];
+        if (added == 0)
+            return;
+
+        // ancestors that already have all the new bits had them pushed up
+        // from somewhere else, and so have their own ancestors
+        std::stack<VertexID> mergeStack;
+        m_signatures[fromVertex] |= added;
+        mergeStack.push(fromVertex);
+        while (!mergeStack.empty()) {
+            VertexID mergeVertex = mergeStack.top();
+            mergeStack.pop();
+            ForEachNeighborUntil(mergeVertex, searchIncoming, [&](VertexID parent) {
+                if ((m_signatures[parent] & added) != added) {
+                    m_signatures[parent] |= added;
+                    mergeStack.push(parent);
+                }
+                return false;
+            });
+        }
+    }
+
+  public:
+    void RebuildDescendantSignatures() {
+        std::vector<VertexID> order;
+        std::vector<std::vector<VertexID> > children;
+        TopologicalOrderAndChildren(order, children);
+
+        for (size_t position = order.size(); position-- > 0; ) {
+            VertexID vertex = order[position];
+            uint64_t signature = SignatureBit(vertex);
+            for (size_t index = 0; index < children[vertex].size(); index++)
+                signature |= m_signatures[children[vertex][index]];
+            m_signatures[vertex] = signature;
+        }
+        m_signatureRemovals = 0;
+    }
+
+    // If this returns false then fromVertex definitely can't reach toVertex.
+    // If it returns true it might.
+    bool MightReach(VertexID fromVertex, VertexID toVertex) {
+        if (m_signatureRemovals > GetFirstInvalidVertexID())
+            RebuildDescendantSignatures();
+        return (m_signatures[toVertex] & ~m_signatures[fromVertex]) == 0;
+    }
+  #endif
+
+  #if DIRECTEDACYCLICGRAPH_REACH_SKETCH
+    //
+    // APPROXIMATE REACH COUNTS
+    //
+    // For an edge fromVertex->toVertex, the descendant sketches flow from
+    // toVertex to fromVertex and on to fromVertex's ancestors, while the
+    // ancestor sketches flow from fromVertex to toVertex and on to its
+    // descendants.  So "upstream" for a sketch direction is the opposite
+    // search direction.
+    //
+  private:
+    static SearchDirection Opposite(SearchDirection direction) {
+        return (direction == searchOutgoing) ? searchIncoming : searchOutgoing;
+    }
+
+    void ResizeSketches(size_t firstInvalid) {
+        for (unsigned direction = 0; direction < 2; direction++) {
+            m_sketches[direction].resize(firstInvalid);
+            m_sketchDirty[direction].resize(firstInvalid, false);
+        }
+    }
+
+    // Marks vertex and everything upstream of it dirty.  No need to go past a
+    // vertex that is already dirty, since everything upstream of it is too.
+    void MarkSketchesDirtyFrom(VertexID vertex, SearchDirection direction) {
+        std::stack<VertexID> markStack;
+        markStack.push(vertex);
+        while (!markStack.empty()) {
+            VertexID markVertex = markStack.top();
+            markStack.pop();
+            if (m_sketchDirty[direction][markVertex])
+                continue;
+            m_sketchDirty[direction][markVertex] = true;
+            ForEachNeighborUntil(markVertex, Opposite(direction), [&](VertexID upstreamVertex) {
+                if (!m_sketchDirty[direction][upstreamVertex])
+                    markStack.push(upstreamVertex);
+                return false;
+            });
+        }
+    }
+
+    // Merges the sketch of targetVertex into sourceVertex, and then keeps
+    // pushing upstream until a merge changes nothing.
+    void MergeSketchUpstream(VertexID sourceVertex, VertexID targetVertex, SearchDirection direction) {
+        if (m_sketchDirty[direction][targetVertex]) {
+            MarkSketchesDirtyFrom(sourceVertex, direction);
+            return;
+        }
+        if (m_sketchDirty[direction][sourceVertex])
+            return; // will be rebuilt anyway
+
+        if (!m_sketches[direction][sourceVertex].MergeWith(m_sketches[direction][targetVertex]))
+            return;
+
+        std::stack<VertexID> mergeStack;
+        mergeStack.push(sourceVertex);
+        while (!mergeStack.empty()) {
+            VertexID mergeVertex = mergeStack.top();
+            mergeStack.pop();
+            ForEachNeighborUntil(mergeVertex, Opposite(direction), [&](VertexID upstreamVertex) {
+                if (m_sketchDirty[direction][upstreamVertex])
+                    return false;
+                if (m_sketches[direction][upstreamVertex].MergeWith(m_sketches[direction][mergeVertex]))
+                    mergeStack.push(upstreamVertex);
+                return false;
+            });
+        }
+    }
+
+    void MergeSketchesForNewEdge(VertexID fromVertex, VertexID toVertex) {
+        MergeSketchUpstream(fromVertex, toVertex, searchOutgoing);
+        MergeSketchUpstream(toVertex, fromVertex, searchIncoming);
+    }
+
+    void MarkSketchesDirtyForRemovedEdge(VertexID fromVertex, VertexID toVertex) {
+        MarkSketchesDirtyFrom(fromVertex, searchOutgoing);
+        MarkSketchesDirtyFrom(toVertex, searchIncoming);
+    }
+
+    // Rebuilding a sketch needs the sketches downstream of it to be clean
+    // first (there will be no loops because it's acyclic)
+    const ReachSketch& CleanSketch(VertexID vertex, SearchDirection direction) {
+        if (m_sketchDirty[direction][vertex]) {
+            ReachSketch sketch;
+            sketch.Add(vertex);
+            ForEachNeighborUntil(vertex, direction, [&](VertexID downstreamVertex) {
+                sketch.MergeWith(CleanSketch(downstreamVertex, direction));
+                return false;
+            });
+            m_sketches[direction][vertex] = sketch;
+            m_sketchDirty[direction][vertex] = false;
+        }
+        return m_sketches[direction][vertex];
+    }
+
+    size_t ApproximateReachCount(VertexID vertex, SearchDirection direction) {
+        assert(VertexExists(vertex));
+        double estimate = CleanSketch(vertex, direction).Estimate();
+        size_t countIncludingSelf = static_cast<size_t>(estimate + 0.5);
+        return (countIncludingSelf > 0) ? countIncludingSelf - 1 : 0;
+    }
+
+  public:
+    // Estimates of how many vertices this one can reach, and how many can
+    // reach it.  (These are within about 13% typically, but may be off by
+    // more.)  Constant time unless an edge removal made the sketch dirty.
+    size_t ApproximateDescendantCount(VertexID vertex) {
+        return ApproximateReachCount(vertex, searchOutgoing);
+    }
+    size_t ApproximateAncestorCount(VertexID vertex) {
+        return ApproximateReachCount(vertex, searchIncoming);
+    }
+  #endif
+
 
     //
     // DEBUGGING ROUTINES
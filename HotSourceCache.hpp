@@ -0,0 +1,209 @@
+//
+//  HotSourceCache.hpp - Bounded cache of descendant sets for the vertices
+//     that reachability questions are most often asked about.  It is an
+//     alternative to caching the whole transitive closure when a small
+//     fraction of the vertices get most of the queries.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <list>
+#include <unordered_map>
+#include <cassert>
+
+#include "VertexBitset.hpp"
+
+namespace nocycle {
+
+// Entries are kept in least-recently-used order, but a vertex is only
+// admitted once it has been asked about a few times...so a scan over many
+// vertices asked about once each won't flush out the hot ones.  Query counts
+// are halved every so often, so vertices that used to be hot fade away.
+//
+// Every entry is stamped with the epoch it was computed in.  Bumping the
+// epoch (which the graph does when it loses an edge) makes all the entries
+// stale at once without touching them; they are dropped as they are found.
+//
+class HotSourceCache {
+  public:
+    typedef unsigned VertexID;
+
+  private:
+    struct Entry {
+        VertexBitset descendants;
+        unsigned epoch;
+        std::list<VertexID>::iterator recentIter;
+    };
+
+    std::unordered_map<VertexID, Entry> m_entries;
+    std::list<VertexID> m_recent; // most recently used at the front
+    std::unordered_map<VertexID, unsigned> m_queryCounts;
+    size_t m_capacity;
+    unsigned m_admitAfter;
+    unsigned m_epoch;
+    size_t m_hits;
+    size_t m_misses;
+
+  private:
+    void Evict(VertexID source) {
+        std::unordered_map<VertexID, Entry>::iterator entryIter = m_entries.find(source);
+        assert(entryIter != m_entries.end());
+        m_recent.erase((*entryIter).second.recentIter);
+        m_entries.erase(entryIter);
+    }
+
+    void CountQuery(VertexID source) {
+        m_queryCounts[source]++;
+        if (m_queryCounts.size() <= 8 * m_capacity + 64)
+            return;
+
+        std::unordered_map<VertexID, unsigned>::iterator countIter = m_queryCounts.begin();
+        while (countIter != m_queryCounts.end()) {
+            (*countIter).second /= 2;
+            if ((*countIter).second == 0)
+                countIter = m_queryCounts.erase(countIter);
+            else
+                countIter++;
+        }
+    }
+
+  public:
+    void SetCapacity(size_t capacity) {
+        m_capacity = capacity;
+        while (m_entries.size() > m_capacity)
+            Evict(m_recent.back());
+    }
+    size_t GetCapacity() const {
+        return m_capacity;
+    }
+    size_t Size() const {
+        return m_entries.size();
+    }
+    size_t Hits() const {
+        return m_hits;
+    }
+    size_t Misses() const {
+        return m_misses;
+    }
+
+    // Counts this as a query about source, and returns its descendants if
+    // they are cached and up to date (NULL otherwise)
+    const VertexBitset* Lookup(VertexID source) {
+        CountQuery(source);
+
+        std::unordered_map<VertexID, Entry>::iterator entryIter = m_entries.find(source);
+        if (entryIter != m_entries.end()) {
+            Entry& entry = (*entryIter).second;
+            if (entry.epoch == m_epoch) {
+                m_recent.splice(m_recent.begin(), m_recent, entry.recentIter);
+                m_hits++;
+                return &entry.descendants;
+            }
+            Evict(source);
+        }
+        m_misses++;
+        return NULL;
+    }
+
+    bool WantsToAdmit(VertexID source) const {
+        if (m_capacity == 0)
+            return false;
+        std::unordered_map<VertexID, unsigned>::const_iterator countIter = m_queryCounts.find(source);
+        return (countIter != m_queryCounts.end()) && ((*countIter).second >= m_admitAfter);
+    }
+
+    const VertexBitset& Admit(VertexID source, const VertexBitset& descendants) {
+        assert(m_capacity > 0);
+        if (m_entries.find(source) != m_entries.end())
+            Evict(source);
+        while (m_entries.size() >= m_capacity)
+            Evict(m_recent.back());
+
+        m_recent.push_front(source);
+        Entry& entry = m_entries[source];
+        entry.descendants = descendants;
+        entry.epoch = m_epoch;
+        entry.recentIter = m_recent.begin();
+        return entry.descendants;
+    }
+
+    // Calls back with (source, descendants) for each entry that is still
+    // current, letting the caller patch the descendants in place.
+    template<class Callback>
+    void ForEachCurrentEntry(Callback callback) {
+        std::unordered_map<VertexID, Entry>::iterator entryIter = m_entries.begin();
+        while (entryIter != m_entries.end()) {
+            Entry& entry = (*entryIter++).second;
+            if (entry.epoch == m_epoch)
+                callback(*entry.recentIter, entry.descendants);
+        }
+    }
+
+    void Invalidate() {
+        m_epoch++;
+    }
+    void Clear() {
+        m_entries.clear();
+        m_recent.clear();
+    }
+
+  public:
+    HotSourceCache(size_t capacity = 64, unsigned admitAfter = 2) :
+        m_capacity (capacity),
+        m_admitAfter (admitAfter),
+        m_epoch (0),
+        m_hits (0),
+        m_misses (0)
+    {
+    }
+
+    // The list iterators in the entries point into m_recent, so a copy has
+    // to rebuild them against its own list
+    HotSourceCache(const HotSourceCache& other) :
+        m_queryCounts (other.m_queryCounts),
+        m_capacity (other.m_capacity),
+        m_admitAfter (other.m_admitAfter),
+        m_epoch (other.m_epoch),
+        m_hits (other.m_hits),
+        m_misses (other.m_misses)
+    {
+        std::list<VertexID>::const_reverse_iterator recentIter = other.m_recent.rbegin();
+        while (recentIter != other.m_recent.rend()) {
+            VertexID source = (*recentIter++);
+            const Entry& otherEntry = (*other.m_entries.find(source)).second;
+            m_recent.push_front(source);
+            Entry& entry = m_entries[source];
+            entry.descendants = otherEntry.descendants;
+            entry.epoch = otherEntry.epoch;
+            entry.recentIter = m_recent.begin();
+        }
+    }
+    HotSourceCache& operator= (const HotSourceCache& other) {
+        if (this != &other) {
+            HotSourceCache copy (other);
+            m_entries.swap(copy.m_entries);
+            m_recent.swap(copy.m_recent);
+            m_queryCounts.swap(copy.m_queryCounts);
+            m_capacity = copy.m_capacity;
+            m_admitAfter = copy.m_admitAfter;
+            m_epoch = copy.m_epoch;
+            m_hits = copy.m_hits;
+            m_misses = copy.m_misses;
+        }
+        return *this;
+    }
+    virtual ~HotSourceCache() {
+    }
+};
+
+} // end namespace nocycle
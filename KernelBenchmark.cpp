@@ -0,0 +1,155 @@
+//
+//  KernelBenchmark.cpp - Reports which of the vectorized bulk kernels
+//      were picked for the machine it is run on, and times each kernel
+//      (and the graph operations built on them) under every path the
+//      CPU supports, so the choice can be checked against the others.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+const unsigned NUM_PACKED_WORDS = 1 << 20;
+const unsigned NUM_BITSET_WORDS = 1 << 16;
+const unsigned NUM_GRAPH_NODES = 4096;
+const unsigned NUM_REPETITIONS = 16;
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "BulkKernels.hpp"
+#include "OrientedGraph.hpp"
+#include "DirectedAcyclicGraph.hpp"
+#include "RandomEdgePicker.hpp"
+
+using nocycle::BulkKernels;
+
+// Runs the work once to warm up, then NUM_REPETITIONS times more, and gives
+// back the average in microseconds.  The sink keeps the optimizer from
+// throwing the work away.
+template<class Work>
+double TimeMicroseconds(Work work, size_t& sink) {
+    sink += work();
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned repetition = 0; repetition < NUM_REPETITIONS; repetition++)
+        sink += work();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::micro>(elapsed).count() / NUM_REPETITIONS;
+}
+
+int main (int argc, char * const argv[]) {
+    (void)argc;
+    (void)argv;
+
+    std::cout << "Bulk kernel paths on this machine:" << std::endl;
+    for (int path = BulkKernels::pathScalar; path < BulkKernels::numPaths; path++) {
+        std::cout << "    " << std::setw(8) << BulkKernels::PathName(static_cast<BulkKernels::Path>(path))
+            << (BulkKernels::PathSupported(static_cast<BulkKernels::Path>(path)) ? "  supported" : "  not supported")
+            << std::endl;
+    }
+    std::cout << "Chosen at startup: " << BulkKernels::PathName(BulkKernels::ActivePath()) << std::endl;
+    std::cout << std::endl;
+
+    // Packed tristates a quarter of which are nonzero, in runs, which is
+    // about what the buffer of a sparse graph looks like
+    std::vector<uint32_t> packed (NUM_PACKED_WORDS, 0);
+    for (size_t index = 0; index < packed.size(); index++) {
+        if ((index / 64) % 4 == 0)
+            packed[index] = static_cast<uint32_t>(rand()) % 3486784401u; // 3^20
+    }
+    std::vector<uint32_t> ones (NUM_PACKED_WORDS);
+    std::vector<uint32_t> twos (NUM_PACKED_WORDS);
+
+    std::vector<uint64_t> left (NUM_BITSET_WORDS);
+    std::vector<uint64_t> right (NUM_BITSET_WORDS);
+    for (size_t index = 0; index < left.size(); index++) {
+        left[index] = (static_cast<uint64_t>(rand()) << 32) ^ static_cast<uint64_t>(rand());
+        right[index] = (static_cast<uint64_t>(rand()) << 32) ^ static_cast<uint64_t>(rand());
+    }
+    std::vector<uint64_t> sparse (NUM_BITSET_WORDS, 0);
+    sparse[NUM_BITSET_WORDS - 1] = 1;
+
+    typedef nocycle::RandomEdgePicker<nocycle::DirectedAcyclicGraph> DAGType;
+    DAGType dag (NUM_GRAPH_NODES);
+    for (DAGType::VertexID vertex = 0; vertex < NUM_GRAPH_NODES; vertex++)
+        dag.CreateVertex(vertex);
+    for (unsigned index = 0; index < NUM_GRAPH_NODES * 4; index++) {
+        DAGType::VertexID fromVertex;
+        DAGType::VertexID toVertex;
+        dag.GetRandomNonEdge(fromVertex, toVertex);
+        if (fromVertex > toVertex)
+            std::swap(fromVertex, toVertex); // lower to higher can't make a cycle
+        dag.SetEdge(fromVertex, toVertex);
+    }
+
+    std::cout << "Microseconds per call (" << NUM_PACKED_WORDS << " packed words, "
+        << NUM_BITSET_WORDS << " bitset words, " << NUM_GRAPH_NODES << " vertices):" << std::endl;
+    std::cout << std::setw(10) << "path"
+        << std::setw(10) << "decode" << std::setw(10) << "count"
+        << std::setw(10) << "skip" << std::setw(10) << "or"
+        << std::setw(10) << "and" << std::setw(10) << "popcount"
+        << std::setw(10) << "edges" << std::setw(12) << "forEachEdge"
+        << std::setw(13) << "descendants" << std::endl;
+
+    size_t sink = 0;
+    for (int path = BulkKernels::pathScalar; path < BulkKernels::numPaths; path++) {
+        if (!BulkKernels::PathSupported(static_cast<BulkKernels::Path>(path)))
+            continue;
+        BulkKernels::SetPath(static_cast<BulkKernels::Path>(path));
+
+        double decode = TimeMicroseconds([&]() {
+            BulkKernels::DecodeTrits(&packed[0], packed.size(), &ones[0], &twos[0]);
+            return static_cast<size_t>(ones[packed.size() / 2]);
+        }, sink);
+        double count = TimeMicroseconds([&]() {
+            return BulkKernels::CountNonzeroTrits(&packed[0], packed.size());
+        }, sink);
+        double skip = TimeMicroseconds([&]() {
+            return BulkKernels::SkipZeroWords(&sparse[0], sparse.size());
+        }, sink);
+        double orWords = TimeMicroseconds([&]() {
+            BulkKernels::OrWords(&left[0], &right[0], left.size());
+            return static_cast<size_t>(left[0]);
+        }, sink);
+        double andWords = TimeMicroseconds([&]() {
+            BulkKernels::AndWords(&left[0], &right[0], left.size());
+            return static_cast<size_t>(left[0]);
+        }, sink);
+        double popcount = TimeMicroseconds([&]() {
+            return BulkKernels::PopcountWords(&right[0], right.size());
+        }, sink);
+        double edges = TimeMicroseconds([&]() {
+            return dag.EdgeCount();
+        }, sink);
+        double forEachEdge = TimeMicroseconds([&]() {
+            size_t walked = 0;
+            dag.ForEachEdge([&](DAGType::VertexID fromVertex, DAGType::VertexID toVertex) {
+                (void)fromVertex;
+                (void)toVertex;
+                walked++;
+            });
+            return walked;
+        }, sink);
+        double descendants = TimeMicroseconds([&]() {
+            return dag.Descendants(0).Count();
+        }, sink);
+
+        std::cout << std::fixed << std::setprecision(1)
+            << std::setw(10) << BulkKernels::PathName(static_cast<BulkKernels::Path>(path))
+            << std::setw(10) << decode << std::setw(10) << count
+            << std::setw(10) << skip << std::setw(10) << orWords
+            << std::setw(10) << andWords << std::setw(10) << popcount
+            << std::setw(10) << edges << std::setw(12) << forEachEdge
+            << std::setw(13) << descendants << std::endl;
+    }
+
+    std::cout << std::endl << "(checksum " << sink << ")" << std::endl;
+    return 0;
+}
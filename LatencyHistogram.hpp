@@ -0,0 +1,88 @@
+//
+//  LatencyHistogram.hpp - Counts operation latencies in buckets a quarter
+//     of a power of two wide, for the benchmark programs to report
+//     percentiles without keeping every sample.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include <algorithm> // fill
+#include <cstdint>
+#include <vector>
+
+namespace nocycle {
+
+// Every operation can be counted without storing them, and percentiles
+// come out within about 20%.  Histograms kept by separate threads (or for
+// separate stretches of a run) can be merged afterward.
+class LatencyHistogram {
+  public:
+    static constexpr unsigned numBuckets = 64 * 4;
+
+  private:
+    std::vector<size_t> m_counts;
+
+    static unsigned BucketFor(uint64_t nanoseconds) {
+        if (nanoseconds < 4)
+            return static_cast<unsigned>(nanoseconds);
+        unsigned highBit = 63;
+        while (!(nanoseconds & (static_cast<uint64_t>(1) << highBit)))
+            highBit--;
+        return highBit * 4 + static_cast<unsigned>((nanoseconds >> (highBit - 2)) & 3);
+    }
+    static double BucketTopMicroseconds(unsigned bucket) {
+        if (bucket < 4)
+            return (bucket + 1) / 1000.0;
+        unsigned highBit = bucket / 4;
+        uint64_t top = (static_cast<uint64_t>(4 + bucket % 4 + 1)) << (highBit - 2);
+        return static_cast<double>(top) / 1000.0;
+    }
+
+  public:
+    void Add(uint64_t nanoseconds) {
+        m_counts[BucketFor(nanoseconds)]++;
+    }
+    void Merge(const LatencyHistogram& other) {
+        for (unsigned bucket = 0; bucket < numBuckets; bucket++)
+            m_counts[bucket] += other.m_counts[bucket];
+    }
+    void Clear() {
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+    }
+    size_t Total() const {
+        size_t total = 0;
+        for (unsigned bucket = 0; bucket < numBuckets; bucket++)
+            total += m_counts[bucket];
+        return total;
+    }
+    // Upper edge of the bucket the given fraction of operations fall under
+    double PercentileMicroseconds(double fraction) const {
+        size_t total = Total();
+        if (total == 0)
+            return 0;
+        size_t wanted = static_cast<size_t>(fraction * static_cast<double>(total));
+        size_t seen = 0;
+        for (unsigned bucket = 0; bucket < numBuckets; bucket++) {
+            seen += m_counts[bucket];
+            if (seen > wanted)
+                return BucketTopMicroseconds(bucket);
+        }
+        return BucketTopMicroseconds(numBuckets - 1);
+    }
+
+  public:
+    LatencyHistogram() :
+        m_counts (numBuckets, 0)
+    {
+    }
+};
+
+} // end namespace nocycle
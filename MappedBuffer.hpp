@@ -0,0 +1,223 @@
+//
+//  MappedBuffer.hpp - Growable array of plain values kept in anonymous
+//     memory mapped straight from the operating system, rather than on
+//     the heap.  Pages that are never written take no physical memory,
+//     and pages that have gone back to all zeros can be handed back.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#if defined(_WIN32)
+    #error "MappedBuffer needs mmap and madvise (turn off NSTATE_MMAP_STORAGE)"
+#endif
+
+#include <algorithm> // min, max
+#include <cstdint>
+#include <cstring> // memcpy, memset
+#include <new> // bad_alloc
+#include <type_traits>
+#include <vector>
+#include <cassert>
+
+#include <sys/mman.h>
+#include <unistd.h> // sysconf
+
+#include "BulkKernels.hpp"
+
+namespace nocycle {
+
+// This offers the part of the std::vector interface that NstateArray uses.
+// A std::vector never gives memory back to the system, so after a graph has
+// had most of its vertices destroyed (or if its IDs are sparse) the buffer
+// stays as big as it ever was.  Here the mapping is only backed by physical
+// pages once they are written, and ReleaseZeroPages() uses madvise() to drop
+// the ones which have been zeroed out since.
+//
+// Every element past size() is kept zero, so growing never has to fill.
+// Growth doubles the mapping (with mremap() on Linux, which moves the page
+// tables instead of copying), and shrinking drops the pages past the end.
+//
+template<class T>
+class MappedBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "MappedBuffer copies its contents as raw memory");
+
+  public:
+    typedef T value_type;
+
+  private:
+    T* m_data;
+    size_t m_size;
+    size_t m_capacity; // whole pages' worth of elements
+
+  private:
+    static size_t PageSize() {
+        static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return pageSize;
+    }
+    static size_t ElementsPerPage() {
+        return PageSize() / sizeof(T);
+    }
+    static size_t BytesForElements(size_t numElements) {
+        size_t bytes = numElements * sizeof(T);
+        return ((bytes + PageSize() - 1) / PageSize()) * PageSize();
+    }
+
+    static T* Map(size_t bytes) {
+        if (bytes == 0)
+            return NULL;
+        void* address = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (address == MAP_FAILED)
+            throw std::bad_alloc();
+        return static_cast<T*>(address);
+    }
+    static void Unmap(T* data, size_t capacity) {
+        if (data != NULL)
+            munmap(data, capacity * sizeof(T));
+    }
+
+    static bool IsZero(const T* elements, size_t numElements) {
+        if constexpr (std::is_same<T, uint32_t>::value) {
+            return BulkKernels::SkipZeroPacked(elements, numElements) == numElements;
+        } else {
+            for (size_t index = 0; index < numElements; index++) {
+                if (elements[index] != T())
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    // Copies a page at a time, leaving out pages that are zero so they
+    // don't get committed in the new mapping
+    static void CopyNonzeroPages(T* target, const T* source, size_t numElements) {
+        for (size_t begin = 0; begin < numElements; begin += ElementsPerPage()) {
+            size_t count = std::min(ElementsPerPage(), numElements - begin);
+            if (!IsZero(source + begin, count))
+                memcpy(target + begin, source + begin, count * sizeof(T));
+        }
+    }
+
+    void Reallocate(size_t capacity) {
+        size_t newBytes = BytesForElements(capacity);
+      #if defined(__linux__)
+        if ((m_data != NULL) && (newBytes != 0)) {
+            void* address = mremap(m_data, m_capacity * sizeof(T), newBytes, MREMAP_MAYMOVE);
+            if (address == MAP_FAILED)
+                throw std::bad_alloc();
+            m_data = static_cast<T*>(address);
+            m_capacity = newBytes / sizeof(T);
+            return;
+        }
+      #endif
+        T* data = Map(newBytes);
+        CopyNonzeroPages(data, m_data, std::min(m_size, newBytes / sizeof(T)));
+        Unmap(m_data, m_capacity);
+        m_data = data;
+        m_capacity = newBytes / sizeof(T);
+    }
+
+  public:
+    size_t size() const {
+        return m_size;
+    }
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    T& operator[](size_t index) {
+        assert(index < m_size);
+        return m_data[index];
+    }
+    const T& operator[](size_t index) const {
+        assert(index < m_size);
+        return m_data[index];
+    }
+
+    // Only zero filling is supported, since that's what comes for free
+    void resize(size_t size, const T& fill = T()) {
+        assert(fill == T());
+        (void)fill;
+
+        if (size > m_capacity) {
+            Reallocate(std::max(size, m_capacity * 2));
+        } else if (size < m_size) {
+            // Zero up to the end of the page holding the new end, and give
+            // back the whole pages after that
+            size_t pageEnd = std::min(m_size, ((size + ElementsPerPage() - 1) / ElementsPerPage()) * ElementsPerPage());
+            memset(m_data + size, 0, (pageEnd - size) * sizeof(T));
+            if (pageEnd < m_size)
+                madvise(m_data + pageEnd, BytesForElements(m_size) - pageEnd * sizeof(T), MADV_DONTNEED);
+        }
+        m_size = size;
+    }
+
+    // Gives back the physical memory behind every page that is all zeros,
+    // and returns how many bytes of the buffer those pages cover (whether or
+    // not they were resident).  Reading the pages back gives zeros, and
+    // writing one commits a fresh page.
+    size_t ReleaseZeroPages() {
+        size_t released = 0;
+        for (size_t begin = 0; begin < m_capacity; begin += ElementsPerPage()) {
+            if (IsZero(m_data + begin, ElementsPerPage())) {
+                madvise(m_data + begin, PageSize(), MADV_DONTNEED);
+                released += PageSize();
+            }
+        }
+        return released;
+    }
+
+    // How much of the mapping is backed by physical memory right now
+    size_t ResidentBytes() const {
+        if (m_data == NULL)
+            return 0;
+        size_t numPages = m_capacity / ElementsPerPage();
+        std::vector<unsigned char> resident (numPages);
+        if (mincore(m_data, numPages * PageSize(), &resident[0]) != 0)
+            return 0;
+        size_t bytes = 0;
+        for (size_t page = 0; page < numPages; page++) {
+            if (resident[page] & 1)
+                bytes += PageSize();
+        }
+        return bytes;
+    }
+
+  public:
+    MappedBuffer() :
+        m_data (NULL),
+        m_size (0),
+        m_capacity (0)
+    {
+    }
+    MappedBuffer(const MappedBuffer& other) :
+        m_data (Map(BytesForElements(other.m_size))),
+        m_size (other.m_size),
+        m_capacity (BytesForElements(other.m_size) / sizeof(T))
+    {
+        CopyNonzeroPages(m_data, other.m_data, m_size);
+    }
+    MappedBuffer& operator= (const MappedBuffer& other) {
+        if (this != &other) {
+            MappedBuffer copy (other);
+            std::swap(m_data, copy.m_data);
+            std::swap(m_size, copy.m_size);
+            std::swap(m_capacity, copy.m_capacity);
+        }
+        return *this;
+    }
+    virtual ~MappedBuffer() {
+        Unmap(m_data, m_capacity);
+    }
+};
+
+} // end namespace nocycle
@@ -19,13 +19,27 @@
 
 #include <vector>
 #include <map>
+#include <algorithm> // min, max
 #include <exception>
 #include <cmath>
+#include <cstdint>
+#include <type_traits> // is_same
 
 // REVIEW: std::numeric_limits?
 #include <climits>
 #include <cassert>
 
+#include "BulkKernels.hpp"
+#if NSTATE_MMAP_STORAGE
+    #include "MappedBuffer.hpp"
+#endif
+#if NSTATE_TILED_FILE_STORAGE
+    #include "TiledFileBuffer.hpp"
+#endif
+#if NSTATE_POOLED_STORAGE
+    #include "PooledBuffer.hpp"
+#endif
+
 //
 // NSTATE
 //
@@ -122,7 +136,15 @@ class NstateArray {
   private:
     // Note: Typical library limits of the STL for vector lengths
     // are things like 1,073,741,823...
+  #if NSTATE_MMAP_STORAGE
+    MappedBuffer<PackedTypeForNstate> m_buffer;
+  #elif NSTATE_TILED_FILE_STORAGE
+    TiledFileBuffer<PackedTypeForNstate> m_buffer;
+  #elif NSTATE_POOLED_STORAGE
+    PooledBuffer<PackedTypeForNstate> m_buffer;
+  #else
     std::vector<PackedTypeForNstate> m_buffer;
+  #endif
     size_t m_max;
 
   private:
@@ -144,6 +166,36 @@ class NstateArray {
         return GetPowerTableInstance().PowerForDigit(digit);
     }
 
+  private:
+    // Packed words are only ever read and written by value through these,
+    // since the tiled buffer can't hand out references that stay good
+    PackedTypeForNstate GetPacked(size_t indexIntoBuffer) const {
+      #if NSTATE_TILED_FILE_STORAGE
+        return m_buffer.Get(indexIntoBuffer);
+      #else
+        return m_buffer[indexIntoBuffer];
+      #endif
+    }
+    void SetPacked(size_t indexIntoBuffer, PackedTypeForNstate packed) {
+      #if NSTATE_TILED_FILE_STORAGE
+        m_buffer.Set(indexIntoBuffer, packed);
+      #else
+        m_buffer[indexIntoBuffer] = packed;
+      #endif
+    }
+
+    // Points at packed words starting at indexIntoBuffer for the bulk
+    // kernels.  The tiled buffer cuts numWords short at the end of a tile,
+    // and the pointer is only good until the buffer is next accessed.
+    const PackedTypeForNstate* PackedRun(size_t indexIntoBuffer, size_t& numWords) const {
+      #if NSTATE_TILED_FILE_STORAGE
+        return m_buffer.Run(indexIntoBuffer, numWords);
+      #else
+        (void)numWords;
+        return &m_buffer[indexIntoBuffer];
+      #endif
+    }
+
   private:
     Nstate<radix> GetDigitInPackedValue(PackedTypeForNstate packed, unsigned digit) const;
     PackedTypeForNstate SetDigitInPackedValue(PackedTypeForNstate packed, unsigned digit, Nstate<radix> t) const;
@@ -169,8 +221,8 @@ class NstateArray {
 
         void operator&(); // not defined
         void do_assign(Nstate<radix> x) {
-            m_na.m_buffer[m_indexIntoBuffer] =
-                m_na.SetDigitInPackedValue(m_na.m_buffer[m_indexIntoBuffer], m_digit, x);
+            m_na.SetPacked(m_indexIntoBuffer,
+                m_na.SetDigitInPackedValue(m_na.GetPacked(m_indexIntoBuffer), m_digit, x));
         }
       public:
         // An automatically generated copy constructor.
@@ -178,10 +230,10 @@ class NstateArray {
         reference& operator=(const reference& rhs) { do_assign(rhs); return *this; } // for b[i] = b[j]
 
         operator Nstate<radix>() const {
-            return m_na.GetDigitInPackedValue(m_na.m_buffer[m_indexIntoBuffer], m_digit);
+            return m_na.GetDigitInPackedValue(m_na.GetPacked(m_indexIntoBuffer), m_digit);
         }
         operator unsigned() const {
-            return m_na.GetDigitInPackedValue(m_na.m_buffer[m_indexIntoBuffer], m_digit);
+            return m_na.GetDigitInPackedValue(m_na.GetPacked(m_indexIntoBuffer), m_digit);
         }
     };
 
@@ -196,7 +248,7 @@ class NstateArray {
         assert(pos < m_max); // STL will only check bounds on integer boundaries.
         size_t indexIntoBuffer = pos / NstatesInPackedType();
         unsigned digit = pos % NstatesInPackedType();
-        return GetDigitInPackedValue(m_buffer[indexIntoBuffer], digit);
+        return GetDigitInPackedValue(GetPacked(indexIntoBuffer), digit);
     }
 
     // by convention, we resize and fill available space with zeros if expanding
@@ -223,8 +275,8 @@ class NstateArray {
             // the trailing unused nstates to zero if we are using fewer nstates
             // than we were before
             for (auto eraseDigit = newMaxDigitNeeded; eraseDigit < oldMaxDigitNeeded; eraseDigit++) {
-                m_buffer[newBufferSize - 1] =
-                    SetDigitInPackedValue(m_buffer[newBufferSize - 1], eraseDigit, 0);
+                SetPacked(newBufferSize - 1,
+                    SetDigitInPackedValue(GetPacked(newBufferSize - 1), eraseDigit, 0));
             }
 
         } else if ((newBufferSize < oldBufferSize) && (newMaxDigitNeeded > 0)) {
@@ -233,8 +285,8 @@ class NstateArray {
             // # of states that fit in a packed type, then shrinking will leave some
             // residual values we need to reset to zero in the last element of the vector.
             for (auto eraseDigit = newMaxDigitNeeded; eraseDigit < NstatesInPackedType(); eraseDigit++) {
-                m_buffer[newBufferSize - 1] =
-                    SetDigitInPackedValue(m_buffer[newBufferSize - 1], eraseDigit, 0);
+                SetPacked(newBufferSize - 1,
+                    SetDigitInPackedValue(GetPacked(newBufferSize - 1), eraseDigit, 0));
             }
         }
     }
@@ -243,6 +295,174 @@ class NstateArray {
         return m_max;
     }
 
+    //
+    // BULK ACCESS
+    //
+    // Tristate arrays are read a packed word at a time by the vectorized
+    // kernels in BulkKernels.hpp.  Packed words that are zero are skipped
+    // without being decoded, which is most of them in a sparse graph.
+    //
+
+    // Calls back with (position, value) for each nonzero nstate in [begin, end)
+    // in increasing order of position, stopping early if the callback returns
+    // true.  The array must not be changed by the callback.
+    template<class Callback>
+    bool ForEachNonzeroUntil(size_t begin, size_t end, Callback callback) const {
+        assert(end <= m_max);
+        if (begin >= end)
+            return false;
+
+        const size_t perWord = NstatesInPackedType();
+        size_t word = begin / perWord;
+        size_t lastWord = (end - 1) / perWord + 1;
+
+        if constexpr (radix == 3) {
+            static_assert(std::is_same<PackedTypeForNstate, uint32_t>::value, "kernels decode 32-bit words");
+            assert(perWord == BulkKernels::tritsInPacked);
+
+            const size_t blockWords = 32;
+            uint32_t ones[blockWords];
+            uint32_t twos[blockWords];
+            while (word < lastWord) {
+                size_t numWords = lastWord - word;
+                const PackedTypeForNstate* run = PackedRun(word, numWords);
+                size_t skipped = BulkKernels::SkipZeroPacked(run, numWords);
+                word += skipped;
+                if (skipped == numWords)
+                    continue;
+                numWords = std::min(blockWords, numWords - skipped);
+                BulkKernels::DecodeTrits(run + skipped, numWords, ones, twos);
+                for (size_t index = 0; index < numWords; index++) {
+                    size_t base = (word + index) * perWord;
+                    uint32_t digits = ones[index] | twos[index];
+                    if (base < begin)
+                        digits &= ~static_cast<uint32_t>(0) << (begin - base);
+                    if (end - base < perWord)
+                        digits &= (static_cast<uint32_t>(1) << (end - base)) - 1;
+                    while (digits != 0) {
+                        unsigned digit = static_cast<unsigned>(__builtin_ctz(digits));
+                        if (callback(base + digit, ((ones[index] >> digit) & 1) ? 1u : 2u))
+                            return true;
+                        digits &= digits - 1;
+                    }
+                }
+                word += numWords;
+            }
+        } else {
+            for (; word < lastWord; word++) {
+                PackedTypeForNstate packed = GetPacked(word);
+                if (packed == 0)
+                    continue;
+                size_t base = word * perWord;
+                for (size_t pos = std::max(base, begin); pos < std::min(base + perWord, end); pos++) {
+                    unsigned value = GetDigitInPackedValue(packed, static_cast<unsigned>(pos - base));
+                    if ((value != 0) && callback(pos, value))
+                        return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    size_t CountNonzero(size_t begin, size_t end) const {
+        assert(end <= m_max);
+        if (begin >= end)
+            return 0;
+
+        if constexpr (radix == 3) {
+            // Count whole packed words, then take away what is outside the
+            // range in the first and last of them
+            const size_t perWord = NstatesInPackedType();
+            size_t firstWord = begin / perWord;
+            size_t lastWord = (end - 1) / perWord + 1;
+            size_t count = 0;
+            for (size_t word = firstWord; word < lastWord; ) {
+                size_t numWords = lastWord - word;
+                const PackedTypeForNstate* run = PackedRun(word, numWords);
+                count += BulkKernels::CountNonzeroTrits(run, numWords);
+                word += numWords;
+            }
+
+            uint32_t ones, twos;
+            PackedTypeForNstate packed = GetPacked(firstWord);
+            BulkKernels::DecodeTrits(&packed, 1, &ones, &twos);
+            uint32_t before = (static_cast<uint32_t>(1) << (begin - firstWord * perWord)) - 1;
+            count -= static_cast<size_t>(__builtin_popcount((ones | twos) & before));
+
+            packed = GetPacked(lastWord - 1);
+            BulkKernels::DecodeTrits(&packed, 1, &ones, &twos);
+            uint32_t after = ~static_cast<uint32_t>(0) << (end - (lastWord - 1) * perWord);
+            count -= static_cast<size_t>(__builtin_popcount((ones | twos) & after));
+            return count;
+        } else {
+            size_t count = 0;
+            ForEachNonzeroUntil(begin, end, [&](size_t pos, unsigned value) {
+                (void)pos;
+                (void)value;
+                count++;
+                return false;
+            });
+            return count;
+        }
+    }
+
+    // Adds the nonzero nstates of source in [sourceBegin, sourceEnd) into
+    // this array starting at targetBegin, in the same order.  The target
+    // range has to be all zeros (as a freshly sized array is), so each
+    // value can go straight into its packed word without taking out what
+    // was there.  Zero words of the source are skipped without decoding.
+    void AddNonzeroFrom(const NstateArray<radix>& source, size_t sourceBegin, size_t sourceEnd, size_t targetBegin) {
+        assert(targetBegin + (sourceEnd - sourceBegin) <= m_max);
+        const size_t perWord = NstatesInPackedType();
+        source.ForEachNonzeroUntil(sourceBegin, sourceEnd, [&](size_t pos, unsigned value) {
+            size_t target = targetBegin + (pos - sourceBegin);
+            size_t indexIntoBuffer = target / perWord;
+            unsigned digit = static_cast<unsigned>(target % perWord);
+            assert(GetDigitInPackedValue(GetPacked(indexIntoBuffer), digit) == 0);
+            SetPacked(indexIntoBuffer, GetPacked(indexIntoBuffer) + value * PowerForDigit(digit));
+            return false;
+        });
+    }
+
+    // Bytes the storage has set aside for the packed values, which can be
+    // more than Length() needs (a std::vector keeps its memory when it is
+    // shrunk).  A tiled buffer's bytes are in its file, not in memory.
+    size_t CapacityBytes() const {
+      #if NSTATE_TILED_FILE_STORAGE
+        return m_buffer.size() * sizeof(PackedTypeForNstate);
+      #else
+        return m_buffer.capacity() * sizeof(PackedTypeForNstate);
+      #endif
+    }
+
+  #if NSTATE_MMAP_STORAGE
+    // Hands the physical memory behind all-zero pages of the buffer back to
+    // the system, returning how many bytes were let go
+    size_t ReleaseZeroPages() {
+        return m_buffer.ReleaseZeroPages();
+    }
+    size_t ResidentBytes() const {
+        return m_buffer.ResidentBytes();
+    }
+  #endif
+
+  #if NSTATE_TILED_FILE_STORAGE
+    // Hint that the nstate at pos will be wanted soon, so the tile holding
+    // it can be read in the background
+    void Prefetch(size_t pos) const {
+        m_buffer.Prefetch(pos / NstatesInPackedType());
+    }
+    void SetTileCacheSize(size_t cacheTiles, size_t readahead = 1) {
+        m_buffer.SetCacheTiles(cacheTiles, readahead);
+    }
+    void FlushTiles() {
+        m_buffer.Flush();
+    }
+    typename TiledFileBuffer<PackedTypeForNstate>::Stats TileCacheStats() const {
+        return m_buffer.GetStats();
+    }
+  #endif
+
 // Constructors and destructors
 
   public:
@@ -374,6 +594,40 @@ bool NstateArray<radix>::SelfTest() {
             }
         }
 
+        // Bulk reads of a random range should see the same values, whichever
+        // kernels are doing the decoding
+        size_t rangeBegin = (initialSize == 0) ? 0 : static_cast<size_t>(rand()) % initialSize;
+        size_t rangeEnd = rangeBegin + ((initialSize == rangeBegin) ? 0 : static_cast<size_t>(rand()) % (initialSize - rangeBegin + 1));
+        size_t expectedCount = 0;
+        for (size_t index = rangeBegin; index < rangeEnd; index++) {
+            if (v[index] != 0)
+                expectedCount++;
+        }
+        for (int path = BulkKernels::pathScalar; path < BulkKernels::numPaths; path++) {
+            if (!BulkKernels::PathSupported(static_cast<BulkKernels::Path>(path)))
+                continue;
+            BulkKernels::SetPath(static_cast<BulkKernels::Path>(path));
+
+            size_t expectedPos = rangeBegin;
+            bool matches = true;
+            nv.ForEachNonzeroUntil(rangeBegin, rangeEnd, [&](size_t pos, unsigned value) {
+                while ((expectedPos < pos) && (v[expectedPos] == 0))
+                    expectedPos++;
+                matches = matches && (pos == expectedPos) && (value == v[pos]);
+                expectedPos = pos + 1;
+                return false;
+            });
+            while ((expectedPos < rangeEnd) && (v[expectedPos] == 0))
+                expectedPos++;
+            if (!matches || (expectedPos < rangeEnd) || (nv.CountNonzero(rangeBegin, rangeEnd) != expectedCount)) {
+                std::cout << "FAILURE: On NstateArray[" << initialSize << "], bulk reads of [" << rangeBegin
+                    << ", " << rangeEnd << ") with " << BulkKernels::PathName(static_cast<BulkKernels::Path>(path))
+                    << " kernels did not match the values that were set" << std::endl;
+                return false;
+            }
+        }
+        BulkKernels::SetPath(BulkKernels::BestPath());
+
         // Try resizing it to some smaller size
         size_t newSmallerSize;
         if (initialSize == 0)
@@ -20,6 +20,7 @@
 #if ORIENTEDGRAPH_SELFTEST
 
 #include <iostream>
+#include <stack>
 #include "BoostImplementation.hpp"
 #include "RandomEdgePicker.hpp"
 
@@ -71,12 +72,400 @@ bool OrientedGraph::SelfTest() {
         og.AddEdge(vertexSource, vertexDest);
     }
 
+    // turn some of them around
+    for (unsigned index = 0; index < NUM_TEST_NODES; index++) {
+        OGType::VertexID vertexSource;
+        OGType::VertexID vertexDest;
+
+        og.GetRandomEdge(vertexSource, vertexDest);
+
+        if (!og.ReverseEdge(vertexSource, vertexDest)) {
+            std::cout << "FAILURE: Could not reverse edge " << vertexSource << "->" << vertexDest << std::endl;
+            return false;
+        }
+        bog.ReverseEdge(vertexSource, vertexDest);
+
+        if (og.EdgeExists(vertexSource, vertexDest) || !og.EdgeExists(vertexDest, vertexSource)) {
+            std::cout << "FAILURE: Reversing edge " << vertexSource << "->" << vertexDest << " did not flip it" << std::endl;
+            return false;
+        }
+    }
+
     // Graphs should be identical after this
     if (bog != og) {
         std::cout << "FAILURE: OrientedGraph not equivalent to version of OrientedGraph implemented via Boost Graph library." << std::endl;
         return false;
     }
 
+    // the bitset searches should find the same vertices as following the edge
+    // sets one at a time, whether run on one thread or split across several
+    for (unsigned numThreads = 1; numThreads <= 4; numThreads += 3) {
+        og.SetSearchThreads(numThreads);
+
+        for (OGType::VertexID vertex = 0; vertex < NUM_TEST_NODES; vertex++) {
+            if (!og.VertexExists(vertex))
+                continue;
+
+            for (unsigned direction = 0; direction < 2; direction++) {
+                bool outgoing = (direction == 0);
+
+                std::set<OGType::VertexID> reached;
+                std::stack<OGType::VertexID> searchStack;
+                searchStack.push(vertex);
+                while (!searchStack.empty()) {
+                    OGType::VertexID searchVertex = searchStack.top();
+                    searchStack.pop();
+                    std::set<OGType::VertexID> neighbors = outgoing ?
+                        og.OutgoingEdgesForVertex(searchVertex) : og.IncomingEdgesForVertex(searchVertex);
+                    std::set<OGType::VertexID>::iterator neighborIter = neighbors.begin();
+                    while (neighborIter != neighbors.end()) {
+                        OGType::VertexID neighbor = (*neighborIter++);
+                        if ((neighbor != vertex) && reached.insert(neighbor).second)
+                            searchStack.push(neighbor);
+                    }
+                }
+
+                VertexBitset found = outgoing ? og.Descendants(vertex) : og.Ancestors(vertex);
+                bool matches = (found.Count() == reached.size());
+                found.ForEach([&](OGType::VertexID foundVertex) {
+                    if (reached.find(foundVertex) == reached.end())
+                        matches = false;
+                });
+                if (!matches) {
+                    std::cout << "FAILURE: " << (outgoing ? "Descendants" : "Ancestors") << " of vertex #" << vertex <<
+                        " using " << numThreads << " threads did not match a depth-first search" << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    // each vectorized path should decode and count the same edges, and
+    // combine bitsets the same way that the scalar one does
+    for (int path = BulkKernels::pathScalar; path < BulkKernels::numPaths; path++) {
+        if (!BulkKernels::PathSupported(static_cast<BulkKernels::Path>(path)))
+            continue;
+        BulkKernels::SetPath(static_cast<BulkKernels::Path>(path));
+        const char* pathName = BulkKernels::PathName(static_cast<BulkKernels::Path>(path));
+
+        size_t expectedEdges = 0;
+        for (OGType::VertexID vertex = 0; vertex < NUM_TEST_NODES; vertex++) {
+            if (og.VertexExists(vertex))
+                expectedEdges += og.OutgoingEdgesForVertex(vertex).size();
+        }
+        size_t walkedEdges = 0;
+        bool edgesExist = true;
+        og.ForEachEdge([&](OGType::VertexID fromVertex, OGType::VertexID toVertex) {
+            walkedEdges++;
+            if (!og.EdgeExists(fromVertex, toVertex))
+                edgesExist = false;
+        });
+        if (!edgesExist || (walkedEdges != expectedEdges) || (og.EdgeCount() != expectedEdges)) {
+            std::cout << "FAILURE: With " << pathName << " kernels, ForEachEdge found " << walkedEdges
+                << " and EdgeCount() said " << og.EdgeCount() << " when there are " << expectedEdges << " edges" << std::endl;
+            return false;
+        }
+
+        for (unsigned trial = 0; trial < 64; trial++) {
+            size_t capacity = static_cast<size_t>(rand() % 1024);
+            VertexBitset left (capacity);
+            VertexBitset right (capacity);
+            std::vector<bool> leftBits (capacity);
+            std::vector<bool> rightBits (capacity);
+            for (OGType::VertexID vertex = 0; vertex < capacity; vertex++) {
+                // sparse on one side, so the zero skipping gets exercised
+                if (rand() % 3 == 0) {
+                    left.Set(vertex);
+                    leftBits[vertex] = true;
+                }
+                if (rand() % 50 == 0) {
+                    right.Set(vertex);
+                    rightBits[vertex] = true;
+                }
+            }
+
+            VertexBitset orred = left;
+            orred.OrWith(right);
+            VertexBitset anded = left;
+            anded.AndWith(right);
+            VertexBitset andNotted = left;
+            andNotted.AndNotWith(right);
+
+            size_t rightCount = 0;
+            bool matches = true;
+            for (OGType::VertexID vertex = 0; vertex < capacity; vertex++) {
+                if (rightBits[vertex])
+                    rightCount++;
+                matches = matches && (orred.Test(vertex) == (leftBits[vertex] || rightBits[vertex]));
+                matches = matches && (anded.Test(vertex) == (leftBits[vertex] && rightBits[vertex]));
+                matches = matches && (andNotted.Test(vertex) == (leftBits[vertex] && !rightBits[vertex]));
+            }
+            size_t walked = 0;
+            OGType::VertexID previous = 0;
+            right.ForEach([&](OGType::VertexID vertex) {
+                if (!rightBits[vertex] || ((walked > 0) && (vertex <= previous)))
+                    matches = false;
+                previous = vertex;
+                walked++;
+            });
+            if (!matches || (right.Count() != rightCount) || (walked != rightCount) || (right.Any() != (rightCount > 0))) {
+                std::cout << "FAILURE: With " << pathName << " kernels, VertexBitset operations on "
+                    << capacity << " vertices did not match the expected bits" << std::endl;
+                return false;
+            }
+        }
+    }
+    BulkKernels::SetPath(BulkKernels::BestPath());
+
+    if (true) { // destroying a vertex takes its connections along with it
+        OrientedGraph small (4);
+        for (VertexID vertex = 0; vertex < 4; vertex++)
+            small.CreateVertex(vertex);
+        small.AddEdge(0, 1);
+        small.AddEdge(1, 2);
+        small.AddEdge(3, 1);
+        small.AddEdge(0, 3);
+
+        small.DestroyVertexDontCompact(1);
+        small.CreateVertex(1);
+        if ((small.EdgeCount() != 1) || small.EdgeExists(0, 1) || small.EdgeExists(1, 2) || small.EdgeExists(3, 1)) {
+            std::cout << "FAILURE: Vertex #1 came back with the connections it had before it was destroyed" << std::endl;
+            return false;
+        }
+    }
+
+    if (true) { // vertex property columns follow the vertices they belong to
+        OrientedGraph graph (16);
+        VertexColumnHandle<NstateVertexColumn<8>> priority = graph.AddNstateColumn<8>();
+        for (VertexID vertex = 0; vertex < 16; vertex++)
+            graph.CreateVertex(vertex);
+        VertexColumnHandle<ValueVertexColumn<unsigned>> retries = graph.AddValueColumn<unsigned>();
+        for (VertexID vertex = 0; vertex < 16; vertex++) {
+            graph.SetVertexProperty(priority, vertex, vertex % 8);
+            graph.SetVertexProperty(retries, vertex, vertex * 1000);
+        }
+
+        OrientedGraph snapshot (graph);
+        graph.DestroyVertex(3);
+        graph.SetVertexProperty(retries, 4, 7);
+        graph.CreateVertex(3);
+
+        bool matches = (graph.GetVertexProperty(priority, 3) == 0) && (graph.GetVertexProperty(retries, 3) == 0)
+            && (graph.GetVertexProperty(retries, 4) == 7);
+        for (VertexID vertex = 0; vertex < 16; vertex++) {
+            matches = matches && (snapshot.GetVertexProperty(priority, vertex) == vertex % 8);
+            matches = matches && (snapshot.GetVertexProperty(retries, vertex) == vertex * 1000);
+        }
+
+        // compacting away the top vertices drops their values, so they
+        // come back as zero when the capacity grows again
+        graph.DestroyVertex(15);
+        graph.DestroyVertex(14);
+        graph.SetCapacityForMaxValidVertexID(31);
+        graph.CreateVertex(15);
+        graph.CreateVertex(31);
+        matches = matches && (graph.GetFirstInvalidVertexID() == 32) && (graph.GetVertexProperty(priority, 15) == 0)
+            && (graph.GetVertexProperty(retries, 15) == 0) && (graph.GetVertexProperty(retries, 31) == 0)
+            && (graph.GetVertexProperty(priority, 13) == 5);
+
+        snapshot = graph;
+        graph.SetVertexProperty(priority, 13, 1);
+        matches = matches && (snapshot.GetVertexProperty(priority, 13) == 5) && (snapshot.GetFirstInvalidVertexID() == 32);
+        if (!matches) {
+            std::cout << "FAILURE: Vertex property columns did not follow creation, destruction, capacity and copying" << std::endl;
+            return false;
+        }
+    }
+
+    if (true) { // induced subgraphs keep the edges, types and properties among the chosen vertices
+        const unsigned NUM_SUBGRAPH_NODES = 150;
+        OrientedGraph graph (NUM_SUBGRAPH_NODES);
+        VertexColumnHandle<ValueVertexColumn<unsigned>> weights = graph.AddValueColumn<unsigned>();
+        for (VertexID vertex = 0; vertex < NUM_SUBGRAPH_NODES; vertex++) {
+            graph.CreateVertexEx(vertex, (vertex % 3 == 0) ? vertexTypeTwo : vertexTypeOne);
+            graph.SetVertexProperty(weights, vertex, vertex + 7);
+        }
+        for (unsigned index = 0; index < NUM_SUBGRAPH_NODES * 8; index++) {
+            VertexID fromVertex = static_cast<VertexID>(rand()) % NUM_SUBGRAPH_NODES;
+            VertexID toVertex = static_cast<VertexID>(rand()) % NUM_SUBGRAPH_NODES;
+            if ((fromVertex != toVertex) && !graph.HasLinkage(fromVertex, toVertex))
+                graph.AddEdge(fromVertex, toVertex);
+        }
+
+        // runs of neighboring IDs as well as scattered ones
+        std::set<VertexID> chosen;
+        for (VertexID vertex = 20; vertex < 45; vertex++)
+            chosen.insert(vertex);
+        for (VertexID vertex = 90; vertex < 130; vertex++)
+            chosen.insert(vertex);
+        for (unsigned index = 0; index < 30; index++)
+            chosen.insert(static_cast<VertexID>(rand()) % NUM_SUBGRAPH_NODES);
+
+        std::vector<VertexID> remap;
+        OrientedGraph subgraph = graph.ExtractSubgraph(chosen, &remap);
+        bool matches = (subgraph.GetFirstInvalidVertexID() == chosen.size()) && (remap.size() == NUM_SUBGRAPH_NODES);
+        size_t inducedEdges = 0;
+        for (std::set<VertexID>::iterator fromIter = chosen.begin(); matches && (fromIter != chosen.end()); fromIter++) {
+            VertexID newFrom = remap[*fromIter];
+            matches = matches && (subgraph.GetVertexType(newFrom) == graph.GetVertexType(*fromIter))
+                && (subgraph.GetVertexProperty(weights, newFrom) == *fromIter + 7);
+            for (std::set<VertexID>::iterator toIter = chosen.begin(); toIter != chosen.end(); toIter++) {
+                if (*fromIter == *toIter)
+                    continue;
+                bool edge = graph.EdgeExists(*fromIter, *toIter);
+                if (edge)
+                    inducedEdges++;
+                matches = matches && (subgraph.EdgeExists(newFrom, remap[*toIter]) == edge);
+            }
+        }
+        for (VertexID vertex = 0; vertex < NUM_SUBGRAPH_NODES; vertex++)
+            matches = matches && ((chosen.count(vertex) != 0) == (remap[vertex] != std::numeric_limits<VertexID>::max()));
+        if (!matches || (subgraph.EdgeCount() != inducedEdges)) {
+            std::cout << "FAILURE: Subgraph of " << chosen.size() << " vertices has " << subgraph.EdgeCount()
+                << " edges, expected " << inducedEdges << " (or its types, properties or remap are off)" << std::endl;
+            return false;
+        }
+    }
+
+  #if NSTATE_MMAP_STORAGE
+    if (true) { // pages zeroed by destroying vertices should be given back
+        const unsigned NUM_SPARSE_NODES = 2048;
+        OrientedGraph sparse (NUM_SPARSE_NODES);
+        for (VertexID vertex = 0; vertex < NUM_SPARSE_NODES; vertex++)
+            sparse.CreateVertex(vertex);
+        for (VertexID vertex = 1; vertex < NUM_SPARSE_NODES; vertex++)
+            sparse.AddEdge(0, vertex); // one write in every row of the triangle
+
+        size_t residentBefore = sparse.ResidentBytes();
+
+        // keeping the last vertex stops the destroys from compacting
+        for (VertexID vertex = 16; vertex < NUM_SPARSE_NODES - 1; vertex++)
+            sparse.DestroyVertexDontCompact(vertex);
+        size_t released = sparse.ReleaseZeroPages();
+        size_t residentAfter = sparse.ResidentBytes();
+
+        if ((released == 0) || (residentAfter * 4 > residentBefore)) {
+            std::cout << "FAILURE: Releasing zero pages took resident memory from " << residentBefore
+                << " to " << residentAfter << " bytes (" << released << " released)" << std::endl;
+            return false;
+        }
+        if ((sparse.EdgeCount() != 16) || !sparse.EdgeExists(0, 15) || !sparse.EdgeExists(0, NUM_SPARSE_NODES - 1)) {
+            std::cout << "FAILURE: Releasing zero pages lost some of the edges that were left" << std::endl;
+            return false;
+        }
+
+        // released pages read as zero and can be written again
+        sparse.CreateVertex(1000);
+        sparse.AddEdge(1000, 15);
+        if ((sparse.EdgeCount() != 17) || !sparse.EdgeExists(1000, 15) || sparse.EdgeExists(0, 1000)) {
+            std::cout << "FAILURE: Could not reuse the buffer after releasing zero pages" << std::endl;
+            return false;
+        }
+    }
+  #endif
+
+  #if NSTATE_TILED_FILE_STORAGE
+    if (true) { // a graph many tiles big should survive going through a tiny cache
+        const unsigned NUM_TILED_NODES = 4096; // about 26 tiles of packed tristates
+        OrientedGraph tiled (NUM_TILED_NODES);
+        tiled.SetTileCacheSize(2);
+        std::set<std::pair<VertexID, VertexID>> edges;
+        for (VertexID vertex = 0; vertex < NUM_TILED_NODES; vertex++)
+            tiled.CreateVertex(vertex);
+        for (unsigned index = 0; index < NUM_TILED_NODES * 2; index++) {
+            VertexID fromVertex = static_cast<VertexID>(rand()) % NUM_TILED_NODES;
+            VertexID toVertex = static_cast<VertexID>(rand()) % NUM_TILED_NODES;
+            if ((fromVertex == toVertex) || tiled.HasLinkage(fromVertex, toVertex))
+                continue;
+            tiled.AddEdge(fromVertex, toVertex);
+            edges.insert(std::make_pair(fromVertex, toVertex));
+        }
+
+        // every vertex has a column that crosses all the tiles below it
+        size_t walked = 0;
+        for (VertexID vertex = 0; vertex < NUM_TILED_NODES; vertex += 64)
+            walked += tiled.OutgoingEdgesForVertex(vertex).size() + tiled.IncomingEdgesForVertex(vertex).size();
+        size_t expected = 0;
+        for (const std::pair<VertexID, VertexID>& edge : edges) {
+            if ((edge.first % 64 == 0) || (edge.second % 64 == 0))
+                expected += ((edge.first % 64 == 0) && (edge.second % 64 == 0)) ? 2 : 1;
+        }
+
+        OrientedGraph copy (tiled);
+        bool matches = (walked == expected) && (tiled.EdgeCount() == edges.size()) && (copy.EdgeCount() == edges.size());
+        tiled.ForEachEdge([&](VertexID fromVertex, VertexID toVertex) {
+            if ((edges.count(std::make_pair(fromVertex, toVertex)) == 0) || !copy.EdgeExists(fromVertex, toVertex))
+                matches = false;
+        });
+        TiledFileBuffer<PackedTypeForNstate>::Stats stats = tiled.TileCacheStats();
+        if (!matches || (stats.misses == 0) || (stats.writeBacks == 0)) {
+            std::cout << "FAILURE: Tiled graph of " << edges.size() << " edges came back with "
+                << tiled.EdgeCount() << " (" << stats.misses << " misses, " << stats.writeBacks << " write backs)" << std::endl;
+            return false;
+        }
+
+        // shrinking drops tiles from the file, and growing back reads zeros
+        tiled.FlushTiles();
+        tiled.SetCapacityForMaxValidVertexID(100);
+        tiled.SetCapacityForMaxValidVertexID(NUM_TILED_NODES - 1);
+        size_t kept = 0;
+        for (const std::pair<VertexID, VertexID>& edge : edges) {
+            if ((edge.first <= 100) && (edge.second <= 100))
+                kept++;
+        }
+        if ((tiled.EdgeCount() != kept) || tiled.VertexExists(NUM_TILED_NODES - 1)) {
+            std::cout << "FAILURE: Tiled graph had " << tiled.EdgeCount() << " edges after shrinking and growing, not "
+                << kept << std::endl;
+            return false;
+        }
+    }
+  #endif
+
+  #if NSTATE_POOLED_STORAGE
+    if (true) { // small graphs made after others are gone should only reuse their blocks
+        const unsigned NUM_POOLED_GRAPHS = 64;
+        const unsigned NUM_POOLED_NODES = 24;
+        SlabPool<PackedTypeForNstate>& pool = SlabPool<PackedTypeForNstate>::Shared();
+        SlabPool<PackedTypeForNstate>::Stats statsBefore = pool.GetStats();
+        for (unsigned round = 0; round < 2; round++) {
+            if (round == 1)
+                statsBefore = pool.GetStats();
+
+            std::vector<OrientedGraph*> graphs;
+            bool fresh = true;
+            for (unsigned index = 0; index < NUM_POOLED_GRAPHS; index++) {
+                OrientedGraph* graph = new OrientedGraph(NUM_POOLED_NODES);
+                fresh = fresh && (graph->EdgeCount() == 0);
+                for (VertexID vertex = 0; vertex < NUM_POOLED_NODES; vertex++)
+                    graph->CreateVertex(vertex);
+                for (VertexID vertex = 0; vertex + 1 < NUM_POOLED_NODES; vertex++)
+                    graph->AddEdge(vertex, vertex + 1);
+                graphs.push_back(graph);
+            }
+
+            // growing moves to a bigger block and shrinking back to a smaller one
+            graphs[0]->SetCapacityForMaxValidVertexID(NUM_POOLED_NODES * 8);
+            graphs[0]->CreateVertex(NUM_POOLED_NODES * 8);
+            graphs[0]->AddEdge(3, NUM_POOLED_NODES * 8);
+            graphs[0]->SetCapacitySoVertexIsFirstInvalidID(NUM_POOLED_NODES);
+            bool kept = (graphs[0]->EdgeCount() == NUM_POOLED_NODES - 1) && graphs[0]->EdgeExists(3, 4);
+
+            for (unsigned index = 0; index < NUM_POOLED_GRAPHS; index++)
+                delete graphs[index];
+            if (!fresh || !kept) {
+                std::cout << "FAILURE: Pooled graphs had edges they shouldn't, or lost some growing and shrinking" << std::endl;
+                return false;
+            }
+        }
+        SlabPool<PackedTypeForNstate>::Stats statsAfter = pool.GetStats();
+        if ((statsAfter.carved != statsBefore.carved) || (statsAfter.reused < statsBefore.reused + NUM_POOLED_GRAPHS)) {
+            std::cout << "FAILURE: Second round of pooled graphs carved " << (statsAfter.carved - statsBefore.carved)
+                << " new blocks and reused " << (statsAfter.reused - statsBefore.reused) << std::endl;
+            return false;
+        }
+    }
+  #endif
+
     return true;
 }
 
@@ -21,9 +21,14 @@
 
 #include <limits> // numeric_limits
 #include <set>
+#include <vector>
+#include <thread>
 #include <cassert>
 
 #include "Nstate.hpp"
+#include "VertexBitset.hpp"
+#include "WorkerTeam.hpp"
+#include "VertexColumns.hpp"
 //#include "nstate/Nstate.hpp"
 
 namespace nocycle {
@@ -53,8 +58,23 @@ class OrientedGraph {
         vertexTypeTwo
     };
 
+  public:
+    enum SearchDirection {
+        searchOutgoing,
+        searchIncoming
+    };
+
   private:
     NstateArray<3> m_buffer;
+    unsigned m_searchThreads;
+    std::vector<VertexColumn*> m_columns; // owned, see AddNstateColumn()
+
+  #if NSTATE_TILED_FILE_STORAGE
+    // How far down a column to ask for tiles ahead of the one being scanned.
+    // Past the first few thousand vertices each row is a tile or more, so
+    // this is about how many background reads are kept underway.
+    static const VertexID columnPrefetchRows = 8;
+  #endif
 
   private:
     // E(N) => N*(N-1)/2
@@ -135,12 +155,16 @@ class OrientedGraph {
     void SetCapacityForMaxValidVertexID(VertexID vertexL) {
         assert(vertexL < std::numeric_limits<unsigned>::max()); // max is reserved for max invalid vertex ID
         m_buffer.ResizeWithZeros(TristateIndexForExistence(vertexL + 1));
+        for (size_t index = 0; index < m_columns.size(); index++)
+            m_columns[index]->Resize(vertexL + 1);
     }
     void SetCapacitySoVertexIsFirstInvalidID(VertexID vertexL) {
         if (vertexL == 0)
             m_buffer.ResizeWithZeros(0);
         else
             m_buffer.ResizeWithZeros(TristateIndexForExistence(vertexL));
+        for (size_t index = 0; index < m_columns.size(); index++)
+            m_columns[index]->Resize(vertexL);
     }
     void GrowCapacityForMaxValidVertexID(VertexID vertexL) {
         assert(vertexL >= GetFirstInvalidVertexID());
@@ -151,6 +175,40 @@ class OrientedGraph {
         SetCapacitySoVertexIsFirstInvalidID(vertexL);
     }
 
+    // What the buffer is holding on to, which compacting doesn't always
+    // give back (see NstateArray::CapacityBytes)
+    size_t BufferCapacityBytes() const {
+        return m_buffer.CapacityBytes();
+    }
+
+  #if NSTATE_MMAP_STORAGE
+    // Destroying vertices without compacting (or using sparse IDs) leaves
+    // long runs of zeros in the buffer.  This gives the memory behind them
+    // back, so what stays resident follows the edges instead of the capacity.
+    size_t ReleaseZeroPages() {
+        return m_buffer.ReleaseZeroPages();
+    }
+    size_t ResidentBytes() const {
+        return m_buffer.ResidentBytes();
+    }
+  #endif
+
+  #if NSTATE_TILED_FILE_STORAGE
+    // The buffer lives in a temporary file, and this many tiles of it are
+    // kept in memory (see TiledFileBuffer::tileBytes for how big one is).
+    // readahead is how many tiles after one that is read from the file get
+    // fetched in the background, with 0 turning background reads off.
+    void SetTileCacheSize(size_t cacheTiles, size_t readahead = 1) {
+        m_buffer.SetTileCacheSize(cacheTiles, readahead);
+    }
+    void FlushTiles() {
+        m_buffer.FlushTiles();
+    }
+    TiledFileBuffer<PackedTypeForNstate>::Stats TileCacheStats() const {
+        return m_buffer.TileCacheStats();
+    }
+  #endif
+
     // This core routine is used to get vertex information, and it can also delete vertices and their connections while doing so
   private:
     void GetVertexInfoMaybeDestroy(
@@ -165,10 +223,6 @@ class OrientedGraph {
         bool compactIfDestroy = true
     ){
         switch (m_buffer[TristateIndexForExistence(vertexE)]) {
-          case doesNotExist:
-            exists = false;
-            break;
-
           case existsAsTypeOne:
             exists = true;
             vertexType = vertexTypeOne;
@@ -181,6 +235,11 @@ class OrientedGraph {
 
           default:
             assert(false);
+            // fall through (so an optimized build never leaves these unset)
+          case doesNotExist:
+            exists = false;
+            vertexType = vertexTypeOne; // meaningless, but not uninitialized
+            break;
         }
 
         if (outgoingEdgeCount != NULL)
@@ -191,8 +250,8 @@ class OrientedGraph {
         if (!exists)
             return;
 
-        // check connections, if requested
-        if ((incomingEdgeCount != NULL) || (outgoingEdgeCount != NULL) || (incomingEdges != NULL) || (outgoingEdges != NULL)) {
+        // check connections, if requested (or if they have to be destroyed)
+        if ((incomingEdgeCount != NULL) || (outgoingEdgeCount != NULL) || (incomingEdges != NULL) || (outgoingEdges != NULL) || destroyIfExists) {
             for (VertexID vertexT = 0; vertexT < GetFirstInvalidVertexID(); vertexT++) {
                 if (vertexT == vertexE)
                     continue;
@@ -244,6 +303,8 @@ class OrientedGraph {
 
         if (destroyIfExists && exists) {
             m_buffer[TristateIndexForExistence(vertexE)] = doesNotExist;
+            for (size_t index = 0; index < m_columns.size(); index++)
+                m_columns[index]->Clear(vertexE);
 
             // caller can tell us to make a destruction do a compaction
             // (because not all destroys compact, we may have trailing data...)
@@ -392,6 +453,140 @@ class OrientedGraph {
         DestroyIsolatedVertexEx(vertex, vertexType, true /* compactIfDestroy */ );
     }
 
+    //
+    // VERTEX PROPERTIES
+    //
+    // Columns of small per-vertex values, indexed directly by vertex ID.
+    // They grow and shrink with the capacity, go back to zero when their
+    // vertex is destroyed, and are copied along with the graph.  Columns
+    // can be added at any time but not removed.
+    //
+  private:
+    template<class Column>
+    VertexColumnHandle<Column> AddColumn(Column* column) {
+        m_columns.push_back(column);
+        return VertexColumnHandle<Column> (m_columns.size() - 1);
+    }
+
+  public:
+    template<int radix>
+    VertexColumnHandle<NstateVertexColumn<radix>> AddNstateColumn() {
+        return AddColumn(new NstateVertexColumn<radix> (GetFirstInvalidVertexID()));
+    }
+    template<class T>
+    VertexColumnHandle<ValueVertexColumn<T>> AddValueColumn() {
+        return AddColumn(new ValueVertexColumn<T> (GetFirstInvalidVertexID()));
+    }
+
+    template<class Column>
+    Column& GetColumn(VertexColumnHandle<Column> handle) {
+        assert(handle.m_index < m_columns.size());
+        return *static_cast<Column*>(m_columns[handle.m_index]);
+    }
+    template<class Column>
+    const Column& GetColumn(VertexColumnHandle<Column> handle) const {
+        assert(handle.m_index < m_columns.size());
+        return *static_cast<const Column*>(m_columns[handle.m_index]);
+    }
+
+    template<class Column>
+    typename Column::ValueType GetVertexProperty(VertexColumnHandle<Column> handle, VertexID vertex) const {
+        assert(VertexExists(vertex));
+        return GetColumn(handle).Get(vertex);
+    }
+    template<class Column>
+    void SetVertexProperty(VertexColumnHandle<Column> handle, VertexID vertex, typename Column::ValueType value) {
+        assert(VertexExists(vertex));
+        GetColumn(handle).Set(vertex, value);
+    }
+
+    //
+    // SUBGRAPHS
+    //
+    // The subgraph induced by a set of vertices is copied tristate by
+    // tristate out of the packed buffer, rather than edge by edge through
+    // AddEdge().  New IDs are handed out in increasing order of the old
+    // ones, which keeps every pair in the same relative order, so the
+    // connection tristates carry over without being flipped.  A run of
+    // consecutive old IDs is also a run of consecutive new ones, and within
+    // one row of the triangle that's one contiguous range on each side.
+    //
+  protected:
+    void FillSubgraphRemap(const std::vector<VertexID>& vertices, std::vector<VertexID>* remap) const {
+        if (remap == NULL)
+            return;
+        remap->assign(GetFirstInvalidVertexID(), std::numeric_limits<VertexID>::max());
+        for (size_t index = 0; index < vertices.size(); index++)
+            (*remap)[vertices[index]] = static_cast<VertexID>(index);
+    }
+
+  public:
+    // vertices must be in increasing order and exist, and subgraph must have
+    // a capacity of exactly vertices.size() with nothing in it yet.  Vertex
+    // vertices[index] becomes vertex index, with its type, its edges to the
+    // others and its property columns.
+    void ExtractSubgraphInto(const std::vector<VertexID>& vertices, OrientedGraph& subgraph) const {
+        assert(subgraph.GetFirstInvalidVertexID() == vertices.size());
+        assert(subgraph.m_buffer.CountNonzero(0, subgraph.m_buffer.Length()) == 0);
+        assert(subgraph.m_columns.empty());
+
+        struct Run {
+            VertexID first; // old IDs [first, end)
+            VertexID end;
+            VertexID newFirst;
+        };
+        std::vector<Run> runs;
+        for (size_t index = 0; index < vertices.size(); index++) {
+            assert(VertexExists(vertices[index]));
+            assert((index == 0) || (vertices[index - 1] < vertices[index]));
+            if (runs.empty() || (runs.back().end != vertices[index])) {
+                Run run = {vertices[index], vertices[index], static_cast<VertexID>(index)};
+                runs.push_back(run);
+            }
+            runs.back().end++;
+        }
+
+        for (size_t current = 0; current < runs.size(); current++) {
+            for (VertexID vertexL = runs[current].first; vertexL < runs[current].end; vertexL++) {
+                VertexID newL = runs[current].newFirst + (vertexL - runs[current].first);
+                size_t tife = TristateIndexForExistence(vertexL);
+                size_t newTife = TristateIndexForExistence(newL);
+
+                // The existence tristate and the connections to lower IDs in
+                // the same run, C(S,L) for S = L-1 down to the run's first
+                subgraph.m_buffer.AddNonzeroFrom(m_buffer, tife, tife + (vertexL - runs[current].first) + 1, newTife);
+
+                // Connections to each earlier run, whose S from end-1 down to
+                // first sit at offsets L-S that count up in both rows
+                for (size_t earlier = 0; earlier < current; earlier++) {
+                    const Run& run = runs[earlier];
+                    VertexID newEnd = run.newFirst + (run.end - run.first);
+                    subgraph.m_buffer.AddNonzeroFrom(
+                        m_buffer,
+                        tife + (vertexL - run.end) + 1,
+                        tife + (vertexL - run.first) + 1,
+                        newTife + (newL - newEnd) + 1
+                    );
+                }
+            }
+        }
+
+        for (size_t index = 0; index < m_columns.size(); index++)
+            subgraph.m_columns.push_back(m_columns[index]->Extract(vertices));
+        subgraph.m_searchThreads = m_searchThreads;
+    }
+
+    // The subgraph induced by vertices, which must all exist.  If remap is
+    // given it is filled in with the new ID of each old one, or the maximum
+    // VertexID for the ones that were left out.
+    OrientedGraph ExtractSubgraph(const std::set<VertexID>& vertices, std::vector<VertexID>* remap = NULL) const {
+        std::vector<VertexID> sorted (vertices.begin(), vertices.end());
+        OrientedGraph subgraph (sorted.size());
+        ExtractSubgraphInto(sorted, subgraph);
+        FillSubgraphRemap(sorted, remap);
+        return subgraph;
+    }
+
     //
     // ITERATION ROUTINES
     //
@@ -414,6 +609,54 @@ class OrientedGraph {
         return incomingEdges;
     }
 
+    // Calls back with (fromVertex, toVertex) for every edge in the graph.  This
+    // walks the buffer front to back once, instead of making the 2*N passes
+    // that asking each vertex for its outgoing and incoming sets would take.
+    template<class Callback>
+    void ForEachEdge(Callback callback) const {
+        // C(S,L) => E(L) + (L - S), so counting S down walks forward, and
+        // the existence tristate of L+1 comes right after C(0,L)
+        VertexID vertexL = 0;
+        size_t tife = 0;
+        size_t tifeNext = 1;
+        m_buffer.ForEachNonzeroUntil(0, m_buffer.Length(), [&](size_t pos, unsigned value) {
+            while (pos >= tifeNext) {
+                vertexL++;
+                tife = tifeNext;
+                tifeNext = TristateIndexForExistence(vertexL + 1);
+            }
+            if (pos == tife)
+                return false; // existence, not connection
+
+            VertexID vertexS = vertexL - static_cast<VertexID>(pos - tife);
+            switch (value) {
+              case lowPointsToHigh:
+                callback(vertexS, vertexL);
+                break;
+
+              case highPointsToLow:
+                callback(vertexL, vertexS);
+                break;
+
+              default:
+                assert(false);
+            }
+            return false;
+        });
+    }
+
+    // Counts the nonzero tristates with the vectorized kernels, and takes
+    // away the ones that are recording existence
+    size_t EdgeCount() const {
+        size_t nonzero = m_buffer.CountNonzero(0, m_buffer.Length());
+        VertexID firstInvalid = GetFirstInvalidVertexID();
+        for (VertexID vertex = 0; vertex < firstInvalid; vertex++) {
+            if (VertexExists(vertex))
+                nonzero--;
+        }
+        return nonzero;
+    }
+
 public:
     bool HasLinkage(VertexID fromVertex, VertexID toVertex, bool* forwardEdge = NULL, bool* reverseEdge = NULL) const {
         assert(fromVertex != toVertex);
@@ -555,15 +798,246 @@ public:
             assert(false);
     }
 
+    // Since the direction of a connection is encoded in its tristate, turning
+    // fromVertex->toVertex into toVertex->fromVertex is just a matter of swapping
+    // lowPointsToHigh for highPointsToLow (or vice versa).  Returns false if there
+    // was no fromVertex->toVertex edge to reverse.
+    bool ReverseEdge(VertexID fromVertex, VertexID toVertex) {
+        assert(fromVertex != toVertex);
+        assert(VertexExists(fromVertex));
+        assert(VertexExists(toVertex));
+
+        VertexID vertexL = fromVertex > toVertex ? fromVertex : toVertex;
+        VertexID vertexS = fromVertex > toVertex ? toVertex : fromVertex;
+
+        size_t tifc = TristateIndexForConnection(vertexS, vertexL);
+        VertexConnectionTristate forward = (toVertex > fromVertex) ? lowPointsToHigh : highPointsToLow;
+        VertexConnectionTristate reverse = (toVertex > fromVertex) ? highPointsToLow : lowPointsToHigh;
+
+        if (m_buffer[tifc] != forward)
+            return false;
+
+        m_buffer[tifc] = reverse;
+        return true;
+    }
+
+    //
+    // REACHABILITY SEARCH
+    //
+    // A level-synchronous breadth-first search with bitmap frontiers, which
+    // switches direction each level based on which is cheaper (in the manner
+    // of Beamer's "direction-optimizing" BFS).  Top-down, each frontier vertex
+    // scans its own row and column of the matrix for unvisited neighbors.
+    // Bottom-up, each unvisited vertex scans for any neighbor in the frontier,
+    // and can stop at the first one.  Since finding the neighbors of a vertex
+    // costs a full row and column scan here no matter how few edges it has,
+    // the cost of a step is just proportional to how many vertices scan.
+    //
+    // Vertices are split among threads in runs of 64, so that each thread
+    // writes its own words of the bitsets.
+    //
+  protected:
+    // Calls back with each neighbor of vertex in the given direction, stopping
+    // early if the callback returns true
+    template<class Callback>
+    bool ForEachNeighborUntil(VertexID vertex, SearchDirection direction, Callback callback) const {
+        VertexConnectionTristate lowerNeighbor = (direction == searchOutgoing) ? highPointsToLow : lowPointsToHigh;
+        VertexConnectionTristate higherNeighbor = (direction == searchOutgoing) ? lowPointsToHigh : highPointsToLow;
+
+        // neighbors with lower IDs are in vertex's own row of the triangle,
+        // which is contiguous and can be decoded a packed word at a time
+        size_t tife = TristateIndexForExistence(vertex);
+        bool stopped = m_buffer.ForEachNonzeroUntil(tife + 1, tife + vertex + 1, [&](size_t pos, unsigned value) {
+            if (value != static_cast<unsigned>(lowerNeighbor))
+                return false;
+            return static_cast<bool>(callback(vertex - static_cast<VertexID>(pos - tife)));
+        });
+        if (stopped)
+            return true;
+
+        // neighbors with higher IDs are found down the column
+        VertexID firstInvalid = GetFirstInvalidVertexID();
+        for (VertexID vertexL = vertex + 1; vertexL < firstInvalid; vertexL++) {
+          #if NSTATE_TILED_FILE_STORAGE
+            // Each step down the column is a row further into the file, so
+            // ask for the tile a few rows ahead while this one is scanned
+            if (vertexL + columnPrefetchRows < firstInvalid)
+                m_buffer.Prefetch(TristateIndexForConnection(vertex, vertexL + columnPrefetchRows));
+          #endif
+            if (m_buffer[TristateIndexForConnection(vertex, vertexL)] == higherNeighbor) {
+                if (callback(vertexL))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    size_t SearchThreadCount() const {
+      #if NSTATE_TILED_FILE_STORAGE
+        return 1; // the tile cache changes on every read, so it can't be shared
+      #else
+        size_t numThreads = (m_searchThreads == 0) ? std::thread::hardware_concurrency() : m_searchThreads;
+        return (numThreads == 0) ? 1 : numThreads;
+      #endif
+    }
+
+    // Returns the set of vertices reached from startVertex (not including it).
+    // If stopVertex is given, this may stop early once it has been reached.  If
+    // ignoreEdgeTo is given, the direct edge between startVertex and it is not
+    // followed.
+    VertexBitset SearchFrom(
+        VertexID startVertex,
+        SearchDirection direction,
+        const VertexID* stopVertex = NULL,
+        const VertexID* ignoreEdgeTo = NULL
+    ) const {
+        assert(VertexExists(startVertex));
+        SearchDirection reverseDirection = (direction == searchOutgoing) ? searchIncoming : searchOutgoing;
+
+        VertexID firstInvalid = GetFirstInvalidVertexID();
+        VertexBitset visited (firstInvalid);
+        VertexBitset frontier (firstInvalid);
+        VertexBitset next (firstInvalid);
+        visited.Set(startVertex);
+        frontier.Set(startVertex);
+        size_t frontierCount = 1;
+        size_t unvisitedCount = firstInvalid - 1;
+
+        // The team lives for the whole search, and so does each member's
+        // bitset for the top down steps (member 0 writes straight into next)
+        WorkerTeam team (SearchThreadCount());
+        std::vector<VertexBitset> discovered (team.Size());
+        for (size_t memberIndex = 1; memberIndex < team.Size(); memberIndex++)
+            VertexBitset (firstInvalid).Swap(discovered[memberIndex]);
+        std::vector<VertexID> frontierVertices;
+
+        while (frontierCount > 0) {
+            next.Clear();
+
+            if (frontierCount * 2 < unvisitedCount) {
+                // top down: each member gathers what its share of the frontier
+                // reaches, and those get merged afterward
+                frontierVertices.clear();
+                frontier.ForEach([&](VertexID vertex) {
+                    frontierVertices.push_back(vertex);
+                });
+
+                team.Run([&](size_t memberIndex) {
+                    VertexBitset& reached = (memberIndex == 0) ? next : discovered[memberIndex];
+                    size_t begin, end;
+                    team.RangeForMember(frontierVertices.size(), memberIndex, 0, begin, end);
+                    for (size_t index = begin; index < end; index++) {
+                        VertexID vertex = frontierVertices[index];
+                        ForEachNeighborUntil(vertex, direction, [&](VertexID neighbor) {
+                            if ((vertex != startVertex) || !ignoreEdgeTo || (neighbor != *ignoreEdgeTo))
+                                reached.Set(neighbor);
+                            return false;
+                        });
+                    }
+                });
+                for (size_t memberIndex = 1; memberIndex < discovered.size(); memberIndex++) {
+                    next.OrWith(discovered[memberIndex]);
+                    discovered[memberIndex].Clear();
+                }
+                next.AndNotWith(visited);
+
+            } else {
+                // bottom up: each member owns a run of words in next, and checks
+                // the unvisited vertices in its run for a neighbor in the frontier
+                team.Run([&](size_t memberIndex) {
+                    size_t begin, end;
+                    team.RangeForMember(firstInvalid, memberIndex, VertexBitset::bitsInWord, begin, end);
+                    for (size_t index = begin; index < end; index++) {
+                        VertexID vertex = static_cast<VertexID>(index);
+                        if (visited.Test(vertex) || !VertexExists(vertex))
+                            continue;
+                        bool reached = ForEachNeighborUntil(vertex, reverseDirection, [&](VertexID neighbor) {
+                            if (!frontier.Test(neighbor))
+                                return false;
+                            return (neighbor != startVertex) || !ignoreEdgeTo || (vertex != *ignoreEdgeTo);
+                        });
+                        if (reached)
+                            next.Set(vertex);
+                    }
+                });
+            }
+
+            visited.OrWith(next);
+            frontier.Swap(next);
+            frontierCount = frontier.Count();
+            unvisitedCount -= frontierCount;
+
+            if (stopVertex && visited.Test(*stopVertex))
+                break;
+        }
+
+        visited.Reset(startVertex);
+        return visited;
+    }
+
+  public:
+    // How many threads a search may use, with 0 meaning one per core.  The
+    // default of 1 does everything on the calling thread.
+    void SetSearchThreads(unsigned numThreads) {
+        m_searchThreads = numThreads;
+    }
+    unsigned GetSearchThreads() const {
+        return m_searchThreads;
+    }
+
+    // Direct neighbors only, as a bitset to combine with search results
+    VertexBitset NeighborsForVertex(VertexID vertex, SearchDirection direction) const {
+        VertexBitset neighbors (GetFirstInvalidVertexID());
+        ForEachNeighborUntil(vertex, direction, [&](VertexID neighbor) {
+            neighbors.Set(neighbor);
+            return false;
+        });
+        return neighbors;
+    }
+
+    VertexBitset Descendants(VertexID vertex) const {
+        return SearchFrom(vertex, searchOutgoing);
+    }
+    VertexBitset Ancestors(VertexID vertex) const {
+        return SearchFrom(vertex, searchIncoming);
+    }
+    bool CanReach(VertexID fromVertex, VertexID toVertex) const {
+        assert(fromVertex != toVertex);
+        return SearchFrom(fromVertex, searchOutgoing, &toVertex).Test(toVertex);
+    }
+
 // Construction and destruction
 public:
     OrientedGraph(const size_t initial_size) :
-        m_buffer (0) // fills with zeros
+        m_buffer (0), // fills with zeros
+        m_searchThreads (1)
     {
         SetCapacitySoVertexIsFirstInvalidID(initial_size);
     }
+    OrientedGraph(const OrientedGraph& other) :
+        m_buffer (other.m_buffer),
+        m_searchThreads (other.m_searchThreads)
+    {
+        for (size_t index = 0; index < other.m_columns.size(); index++)
+            m_columns.push_back(other.m_columns[index]->Clone());
+    }
+    OrientedGraph& operator= (const OrientedGraph& other) {
+        if (this != &other) {
+            std::vector<VertexColumn*> columns;
+            for (size_t index = 0; index < other.m_columns.size(); index++)
+                columns.push_back(other.m_columns[index]->Clone());
+            for (size_t index = 0; index < m_columns.size(); index++)
+                delete m_columns[index];
+            m_columns.swap(columns);
+            m_buffer = other.m_buffer;
+            m_searchThreads = other.m_searchThreads;
+        }
+        return *this;
+    }
 
     virtual ~OrientedGraph() {
+        for (size_t index = 0; index < m_columns.size(); index++)
+            delete m_columns[index];
     }
 
   #if ORIENTEDGRAPH_SELFTEST
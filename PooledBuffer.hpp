@@ -0,0 +1,251 @@
+//
+//  PooledBuffer.hpp - Growable array of plain values whose memory comes
+//     from a process-wide pool of slabs, carved into blocks by power of
+//     two size classes.  Blocks that are let go are kept for the next
+//     buffer of that class instead of being handed back to the heap.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <algorithm> // min, swap
+#include <climits> // CHAR_BIT
+#include <cstring> // memcpy, memset
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#include <cassert>
+
+namespace nocycle {
+
+// Programs that keep many small graphs around (say one per request) would
+// otherwise do a malloc and a free for every buffer of every graph, as well
+// as for each time one of them grows.  Here a block of 2^sizeClass elements
+// is taken from the free list for its class when there is one, or carved
+// off the end of the current slab when there isn't.
+//
+// Free blocks are always all zeros: a buffer zeroes what it used when it
+// gives a block back, so taking one doesn't have to.
+//
+// Blocks bigger than a slab aren't pooled, and go to the heap as usual.
+//
+template<class T>
+class SlabPool {
+    static_assert(std::is_trivially_copyable<T>::value, "SlabPool hands out raw memory");
+
+  public:
+    static constexpr unsigned minSizeClass = 3;
+    static constexpr unsigned slabSizeClass = 16; // 2^16 elements per slab
+    static constexpr unsigned numSizeClasses = sizeof(size_t) * CHAR_BIT;
+
+    struct Stats {
+        size_t reused; // blocks taken from a free list
+        size_t carved; // blocks cut from a slab
+        size_t unpooled; // blocks too big for a slab
+        size_t slabs;
+    };
+
+  private:
+    std::mutex m_mutex;
+    std::vector<T*> m_free[numSizeClasses];
+    std::vector<T*> m_slabs;
+    size_t m_slabUsed; // elements of the newest slab carved off so far
+    Stats m_stats;
+
+  private:
+    SlabPool() :
+        m_slabUsed (static_cast<size_t>(1) << slabSizeClass)
+    {
+        m_stats.reused = 0;
+        m_stats.carved = 0;
+        m_stats.unpooled = 0;
+        m_stats.slabs = 0;
+    }
+
+    // The rest of a slab too small for the block being asked for is split
+    // into the largest blocks that fit, so it isn't wasted.  Blocks are
+    // carved in sizes that are powers of two, so the rest splits cleanly.
+    void FreeRestOfSlab() {
+        size_t slabSize = static_cast<size_t>(1) << slabSizeClass;
+        for (unsigned sizeClass = slabSizeClass; sizeClass-- > minSizeClass; ) {
+            size_t blockSize = static_cast<size_t>(1) << sizeClass;
+            if (slabSize - m_slabUsed >= blockSize) {
+                m_free[sizeClass].push_back(m_slabs.back() + m_slabUsed);
+                m_slabUsed += blockSize;
+            }
+        }
+    }
+
+  public:
+    // The pool is never destroyed, so buffers in objects with static storage
+    // duration can still give their blocks back at exit
+    static SlabPool& Shared() {
+        static SlabPool* pool = new SlabPool();
+        return *pool;
+    }
+
+    static unsigned SizeClassFor(size_t numElements) {
+        unsigned sizeClass = minSizeClass;
+        while ((static_cast<size_t>(1) << sizeClass) < numElements)
+            sizeClass++;
+        return sizeClass;
+    }
+
+    T* Take(unsigned sizeClass) {
+        assert((sizeClass >= minSizeClass) && (sizeClass < numSizeClasses));
+        size_t blockSize = static_cast<size_t>(1) << sizeClass;
+        if (sizeClass > slabSizeClass) {
+            std::lock_guard<std::mutex> lock (m_mutex);
+            m_stats.unpooled++;
+            return new T[blockSize]();
+        }
+
+        std::lock_guard<std::mutex> lock (m_mutex);
+        if (!m_free[sizeClass].empty()) {
+            T* block = m_free[sizeClass].back();
+            m_free[sizeClass].pop_back();
+            m_stats.reused++;
+            return block;
+        }
+        if (m_slabUsed + blockSize > (static_cast<size_t>(1) << slabSizeClass)) {
+            if (!m_slabs.empty())
+                FreeRestOfSlab();
+            m_slabs.push_back(new T[static_cast<size_t>(1) << slabSizeClass]());
+            m_slabUsed = 0;
+            m_stats.slabs++;
+        }
+        T* block = m_slabs.back() + m_slabUsed;
+        m_slabUsed += blockSize;
+        m_stats.carved++;
+        return block;
+    }
+
+    // Only the first numUsed elements may be nonzero
+    void Give(T* block, unsigned sizeClass, size_t numUsed) {
+        assert((sizeClass >= minSizeClass) && (sizeClass < numSizeClasses));
+        if (sizeClass > slabSizeClass) {
+            delete[] block;
+            return;
+        }
+        memset(block, 0, numUsed * sizeof(T));
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_free[sizeClass].push_back(block);
+    }
+
+    Stats GetStats() {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        return m_stats;
+    }
+};
+
+// This offers the part of the std::vector interface that NstateArray uses.
+// Capacity is always a whole size class, and every element past size() is
+// kept zero (as in MappedBuffer), so growing within a block never fills.
+// Shrinking to a quarter of the block or less moves to a smaller one, so
+// blocks go back to the pool as graphs are cut down, and resizing to zero
+// gives the block back entirely.
+//
+template<class T>
+class PooledBuffer {
+  public:
+    typedef T value_type;
+
+  private:
+    T* m_data;
+    size_t m_size;
+    unsigned m_sizeClass; // meaningless when m_data is NULL
+
+  private:
+    void MoveToSizeClass(unsigned sizeClass, size_t numToKeep) {
+        T* data = SlabPool<T>::Shared().Take(sizeClass);
+        if (m_data != NULL) {
+            memcpy(data, m_data, numToKeep * sizeof(T));
+            SlabPool<T>::Shared().Give(m_data, m_sizeClass, m_size);
+        }
+        m_data = data;
+        m_sizeClass = sizeClass;
+    }
+    void Release() {
+        if (m_data != NULL)
+            SlabPool<T>::Shared().Give(m_data, m_sizeClass, m_size);
+        m_data = NULL;
+        m_size = 0;
+    }
+
+  public:
+    size_t size() const {
+        return m_size;
+    }
+    size_t capacity() const {
+        return (m_data == NULL) ? 0 : (static_cast<size_t>(1) << m_sizeClass);
+    }
+
+    T& operator[](size_t index) {
+        assert(index < m_size);
+        return m_data[index];
+    }
+    const T& operator[](size_t index) const {
+        assert(index < m_size);
+        return m_data[index];
+    }
+
+    // Only zero filling is supported, since that's what comes for free
+    void resize(size_t size, const T& fill = T()) {
+        assert(fill == T());
+        (void)fill;
+
+        if (size == 0) {
+            Release();
+            return;
+        }
+
+        unsigned sizeClass = SlabPool<T>::SizeClassFor(size);
+        if (size < m_size)
+            memset(m_data + size, 0, (m_size - size) * sizeof(T));
+        if ((m_data == NULL) || (sizeClass > m_sizeClass) || (sizeClass + 2 <= m_sizeClass))
+            MoveToSizeClass(sizeClass, std::min(size, m_size));
+        m_size = size;
+    }
+
+  public:
+    PooledBuffer() :
+        m_data (NULL),
+        m_size (0),
+        m_sizeClass (0)
+    {
+    }
+    PooledBuffer(const PooledBuffer& other) :
+        m_data (NULL),
+        m_size (0),
+        m_sizeClass (0)
+    {
+        if (other.m_size != 0) {
+            MoveToSizeClass(SlabPool<T>::SizeClassFor(other.m_size), 0);
+            memcpy(m_data, other.m_data, other.m_size * sizeof(T));
+            m_size = other.m_size;
+        }
+    }
+    PooledBuffer& operator= (const PooledBuffer& other) {
+        if (this != &other) {
+            PooledBuffer copy (other);
+            std::swap(m_data, copy.m_data);
+            std::swap(m_size, copy.m_size);
+            std::swap(m_sizeClass, copy.m_sizeClass);
+        }
+        return *this;
+    }
+    virtual ~PooledBuffer() {
+        Release();
+    }
+};
+
+} // end namespace nocycle
@@ -79,6 +79,18 @@ class RandomEdgePicker : public Base {
         if (!RandomEdgePicker::ClearEdge(fromVertex, toVertex))
             assert(false);
     }
+    bool ReverseEdge(VertexID fromVertex, VertexID toVertex) {
+        if (Base::ReverseEdge(fromVertex, toVertex)) {
+            unsigned numOutgoingFrom = Base::OutgoingEdgesForVertex(fromVertex).size();
+            m_verticesByOutgoingEdgeCount[numOutgoingFrom+1].erase(fromVertex);
+            m_verticesByOutgoingEdgeCount[numOutgoingFrom].insert(fromVertex);
+            unsigned numOutgoingTo = Base::OutgoingEdgesForVertex(toVertex).size();
+            m_verticesByOutgoingEdgeCount[numOutgoingTo-1].erase(toVertex);
+            m_verticesByOutgoingEdgeCount[numOutgoingTo].insert(toVertex);
+            return true;
+        }
+        return false;
+    }
 
   public:
     size_t NumEdges() const {
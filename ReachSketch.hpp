@@ -0,0 +1,133 @@
+//
+//  ReachSketch.hpp - HyperLogLog cardinality sketch for estimating how
+//     many vertices are in a set without storing the set.  Two sketches
+//     merge into the sketch of the union by taking the larger of each
+//     register, so a vertex's sketch of what it can reach can be built
+//     out of the sketches of the vertices it points to.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+
+namespace nocycle {
+
+// There are 64 registers, which gives a standard error of about 13%.  Each
+// register only needs to count up to 15 leading zeros (which is more than
+// a graph stored as an adjacency matrix will ever have vertices to need)
+// so they are packed two to a byte, for 32 bytes per sketch.
+//
+// http://algo.inria.fr/flajolet/Publications/FlFuGaMe07.pdf
+//
+class ReachSketch {
+  public:
+    typedef unsigned VertexID;
+    static const unsigned numRegisters = 64;
+    static const unsigned registerMax = 15;
+
+  private:
+    uint8_t m_registers[numRegisters / 2];
+
+  private:
+    unsigned GetRegister(unsigned index) const {
+        uint8_t pair = m_registers[index / 2];
+        return (index % 2 == 0) ? (pair & 0x0F) : (pair >> 4);
+    }
+    void SetRegister(unsigned index, unsigned value) {
+        assert(value <= registerMax);
+        uint8_t& pair = m_registers[index / 2];
+        if (index % 2 == 0)
+            pair = static_cast<uint8_t>((pair & 0xF0) | value);
+        else
+            pair = static_cast<uint8_t>((pair & 0x0F) | (value << 4));
+    }
+
+    // Vertex IDs are small consecutive integers, so they need to be mixed
+    // well before their bits can be treated as random (splitmix64 finalizer)
+    static uint64_t Hash(VertexID vertex) {
+        uint64_t hash = vertex + 0x9E3779B97F4A7C15ULL;
+        hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+        return hash ^ (hash >> 31);
+    }
+
+  public:
+    void Clear() {
+        for (unsigned index = 0; index < numRegisters / 2; index++)
+            m_registers[index] = 0;
+    }
+
+    void Add(VertexID vertex) {
+        uint64_t hash = Hash(vertex);
+        unsigned index = static_cast<unsigned>(hash >> 58); // top 6 bits pick the register
+        uint64_t rest = hash << 6;
+        unsigned rank = (rest == 0) ? registerMax : static_cast<unsigned>(__builtin_clzll(rest)) + 1;
+        if (rank > registerMax)
+            rank = registerMax;
+        if (rank > GetRegister(index))
+            SetRegister(index, rank);
+    }
+
+    // Returns true if this sketch changed, which is how propagation knows
+    // when it can stop
+    bool MergeWith(const ReachSketch& other) {
+        bool changed = false;
+        for (unsigned index = 0; index < numRegisters; index++) {
+            unsigned otherValue = other.GetRegister(index);
+            if (otherValue > GetRegister(index)) {
+                SetRegister(index, otherValue);
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // Uses linear counting while there are still empty registers and the
+    // estimate is small, which is where raw HyperLogLog is biased
+    double Estimate() const {
+        double sum = 0;
+        unsigned zeroRegisters = 0;
+        for (unsigned index = 0; index < numRegisters; index++) {
+            unsigned value = GetRegister(index);
+            sum += std::ldexp(1.0, -static_cast<int>(value));
+            if (value == 0)
+                zeroRegisters++;
+        }
+
+        const double alpha = 0.709; // correction constant for 64 registers
+        double estimate = alpha * numRegisters * numRegisters / sum;
+        if ((estimate <= 2.5 * numRegisters) && (zeroRegisters != 0))
+            estimate = numRegisters * std::log(static_cast<double>(numRegisters) / zeroRegisters);
+        return estimate;
+    }
+
+    bool operator == (const ReachSketch& other) const {
+        for (unsigned index = 0; index < numRegisters / 2; index++) {
+            if (m_registers[index] != other.m_registers[index])
+                return false;
+        }
+        return true;
+    }
+    bool operator != (const ReachSketch& other) const {
+        return !((*this) == other);
+    }
+
+  public:
+    ReachSketch() {
+        Clear();
+    }
+};
+
+} // end namespace nocycle
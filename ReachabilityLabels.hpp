@@ -0,0 +1,300 @@
+//
+//  ReachabilityLabels.hpp - A 2-hop cover of a directed acyclic graph's
+//     reachability, built by pruned landmark labeling.  Each vertex keeps
+//     the "landmarks" it can reach and the ones that can reach it, and
+//     fromVertex can reach toVertex exactly when the two lists share a
+//     landmark.  For graphs with any structure to them the lists stay
+//     short, so this is much smaller than a transitive closure matrix.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cassert>
+
+#include "WorkerTeam.hpp"
+
+namespace nocycle {
+
+// Landmarks are identified by a rank rather than their vertex ID, and the
+// lists are kept sorted by rank so a query is a merge-style intersection.
+// A vertex is always a landmark for itself, in both of its lists.
+//
+// http://arxiv.org/abs/1304.4661 (Yano et al, "Fast and Scalable Reachability
+// Queries on Graphs by Pruned Labeling with Landmarks and Paths")
+//
+// Edge insertions are folded in by labeling everything newly reachable with
+// the new edge's source vertex as a landmark.  Removals can't be handled that
+// way; afterward the labels may claim reachability that is gone (though
+// never miss any that remains), so the graph has to double check positive
+// answers until enough removals pile up to make a rebuild worth it.
+//
+class ReachabilityLabels {
+  public:
+    typedef unsigned VertexID;
+    typedef unsigned Rank;
+
+  private:
+    // A search's visited flags, kept between searches so each one only pays
+    // to reset the vertices it actually touched
+    struct SearchScratch {
+        std::vector<bool> visited;
+        std::vector<VertexID> touched;
+        std::deque<VertexID> searchQueue;
+
+        void Visit(VertexID vertex) {
+            visited[vertex] = true;
+            touched.push_back(vertex);
+            searchQueue.push_back(vertex);
+        }
+        void Reset(size_t firstInvalid) {
+            for (size_t index = 0; index < touched.size(); index++)
+                visited[touched[index]] = false;
+            touched.clear();
+            searchQueue.clear();
+            visited.resize(firstInvalid, false);
+        }
+    };
+
+  private:
+    std::vector<Rank> m_rank;
+    std::vector<std::vector<Rank> > m_outLabels; // landmarks this vertex reaches
+    std::vector<std::vector<Rank> > m_inLabels; // landmarks that reach this vertex
+    Rank m_nextRank;
+    size_t m_removalsSinceBuild;
+    size_t m_rebuildThreshold;
+    SearchScratch m_scratch; // for the searches that AddEdge does
+
+  private:
+    static bool ShareLandmark(const std::vector<Rank>& left, const std::vector<Rank>& right) {
+        std::vector<Rank>::const_iterator leftIter = left.begin();
+        std::vector<Rank>::const_iterator rightIter = right.begin();
+        while ((leftIter != left.end()) && (rightIter != right.end())) {
+            if (*leftIter == *rightIter)
+                return true;
+            if (*leftIter < *rightIter)
+                leftIter++;
+            else
+                rightIter++;
+        }
+        return false;
+    }
+
+    static void InsertLandmark(std::vector<Rank>& labels, Rank rank) {
+        std::vector<Rank>::iterator insertIter = std::lower_bound(labels.begin(), labels.end(), rank);
+        if ((insertIter == labels.end()) || (*insertIter != rank))
+            labels.insert(insertIter, rank);
+    }
+
+    // Breadth-first search out from a landmark, not going past vertices that
+    // the labels so far already say are covered.  Returns what was reached.
+    void PrunedSearch(
+        VertexID landmark,
+        const std::vector<std::vector<VertexID> >& neighbors,
+        bool forward,
+        SearchScratch& scratch,
+        std::vector<VertexID>& reached
+    ) const {
+        reached.clear();
+        scratch.Reset(neighbors.size());
+        scratch.Visit(landmark);
+
+        while (!scratch.searchQueue.empty()) {
+            VertexID searchVertex = scratch.searchQueue.front();
+            scratch.searchQueue.pop_front();
+
+            if (searchVertex != landmark) {
+                bool covered = forward ? Query(landmark, searchVertex) : Query(searchVertex, landmark);
+                if (covered)
+                    continue;
+            }
+            reached.push_back(searchVertex);
+
+            const std::vector<VertexID>& next = neighbors[searchVertex];
+            for (size_t index = 0; index < next.size(); index++) {
+                if (!scratch.visited[next[index]])
+                    scratch.Visit(next[index]);
+            }
+        }
+    }
+
+    // Labels every vertex the search reaches with rank, stopping at the ones
+    // for which stopAt returns true
+    template<class ForEachNext, class StopAt>
+    void LabelSearch(VertexID start, Rank rank, bool forward, ForEachNext forEachNext, StopAt stopAt) {
+        m_scratch.Reset(m_rank.size());
+        m_scratch.Visit(start);
+
+        while (!m_scratch.searchQueue.empty()) {
+            VertexID searchVertex = m_scratch.searchQueue.front();
+            m_scratch.searchQueue.pop_front();
+            if (stopAt(searchVertex))
+                continue;
+
+            InsertLandmark(forward ? m_inLabels[searchVertex] : m_outLabels[searchVertex], rank);
+            forEachNext(searchVertex, [&](VertexID nextVertex) {
+                if (!m_scratch.visited[nextVertex])
+                    m_scratch.Visit(nextVertex);
+            });
+        }
+    }
+
+  public:
+    void Resize(size_t firstInvalid) {
+        m_rank.resize(firstInvalid, 0);
+        m_outLabels.resize(firstInvalid);
+        m_inLabels.resize(firstInvalid);
+    }
+
+    void AddVertex(VertexID vertex) {
+        assert(vertex < m_rank.size());
+        m_rank[vertex] = m_nextRank++;
+        m_outLabels[vertex].assign(1, m_rank[vertex]);
+        m_inLabels[vertex].assign(1, m_rank[vertex]);
+    }
+    void RemoveVertex(VertexID vertex) {
+        m_outLabels[vertex].clear();
+        m_inLabels[vertex].clear();
+        m_removalsSinceBuild++;
+    }
+    void NoteRemoval() {
+        m_removalsSinceBuild++;
+    }
+
+    // When stale, a "yes" from Query may be wrong (a "no" never is)
+    bool IsStale() const {
+        return m_removalsSinceBuild > 0;
+    }
+    bool NeedsRebuild() const {
+        return m_removalsSinceBuild >= m_rebuildThreshold;
+    }
+    void SetRebuildThreshold(size_t removals) {
+        assert(removals > 0);
+        m_rebuildThreshold = removals;
+    }
+    size_t GetRebuildThreshold() const {
+        return m_rebuildThreshold;
+    }
+
+    size_t NumLabelEntries() const {
+        size_t count = 0;
+        for (size_t index = 0; index < m_rank.size(); index++)
+            count += m_outLabels[index].size() + m_inLabels[index].size();
+        return count;
+    }
+
+    bool Query(VertexID fromVertex, VertexID toVertex) const {
+        if (fromVertex == toVertex)
+            return true;
+        return ShareLandmark(m_outLabels[fromVertex], m_inLabels[toVertex]);
+    }
+
+    // Everything that can reach fromVertex must now reach everything toVertex
+    // can, and fromVertex as a landmark covers all those new pairs.  Where
+    // fromVertex could already reach something (or something could already
+    // reach toVertex) the pairs past that point were covered before.  That
+    // reasoning needs the labels to be exact, so when they are stale nothing
+    // is pruned.  The ancestors are labeled before the descendants, so the
+    // checks on both sides only see the labels as they were.
+    template<class ForEachParent, class ForEachChild>
+    void AddEdge(VertexID fromVertex, VertexID toVertex, ForEachParent forEachParent, ForEachChild forEachChild) {
+        Rank rank = m_rank[fromVertex];
+        bool prune = !IsStale();
+
+        LabelSearch(fromVertex, rank, false, forEachParent, [&](VertexID ancestor) {
+            return prune && (ancestor != fromVertex) && Query(ancestor, toVertex);
+        });
+        LabelSearch(toVertex, rank, true, forEachChild, [&](VertexID descendant) {
+            return prune && Query(fromVertex, descendant);
+        });
+    }
+
+    // Rebuilds all the labels from the graph's adjacency lists, trying the
+    // vertices as landmarks in order of how many paths likely go through them.
+    // Landmarks are processed numThreads at a time, one per member of a team
+    // that lives for the whole build (each member keeping its own search
+    // scratch).  Those in the same batch can't prune using each other's
+    // labels, which makes the labels somewhat larger than a one-at-a-time
+    // build but still a correct cover.
+    void Build(
+        const std::vector<bool>& exists,
+        const std::vector<std::vector<VertexID> >& children,
+        const std::vector<std::vector<VertexID> >& parents,
+        size_t numThreads
+    ) {
+        size_t firstInvalid = exists.size();
+        Resize(firstInvalid);
+
+        std::vector<VertexID> order;
+        for (VertexID vertex = 0; vertex < firstInvalid; vertex++) {
+            m_outLabels[vertex].clear();
+            m_inLabels[vertex].clear();
+            if (exists[vertex])
+                order.push_back(vertex);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](VertexID left, VertexID right) {
+            return (children[left].size() + 1) * (parents[left].size() + 1)
+                > (children[right].size() + 1) * (parents[right].size() + 1);
+        });
+        for (size_t position = 0; position < order.size(); position++)
+            m_rank[order[position]] = static_cast<Rank>(position);
+        m_nextRank = static_cast<Rank>(order.size());
+
+        if (numThreads == 0)
+            numThreads = 1;
+        WorkerTeam team (std::min(numThreads, std::max(order.size(), static_cast<size_t>(1))));
+        std::vector<SearchScratch> scratch (team.Size());
+        std::vector<std::vector<VertexID> > forwardReached (team.Size());
+        std::vector<std::vector<VertexID> > backwardReached (team.Size());
+
+        for (size_t batchStart = 0; batchStart < order.size(); batchStart += team.Size()) {
+            size_t batchEnd = std::min(batchStart + team.Size(), order.size());
+
+            team.Run([&](size_t memberIndex) {
+                size_t position = batchStart + memberIndex;
+                if (position >= batchEnd)
+                    return;
+                PrunedSearch(order[position], children, true, scratch[memberIndex], forwardReached[memberIndex]);
+                PrunedSearch(order[position], parents, false, scratch[memberIndex], backwardReached[memberIndex]);
+            });
+
+            // ranks only go up from batch to batch, so appending keeps it sorted
+            for (size_t position = batchStart; position < batchEnd; position++) {
+                Rank rank = static_cast<Rank>(position);
+                const std::vector<VertexID>& forward = forwardReached[position - batchStart];
+                for (size_t index = 0; index < forward.size(); index++)
+                    m_inLabels[forward[index]].push_back(rank);
+                const std::vector<VertexID>& backward = backwardReached[position - batchStart];
+                for (size_t index = 0; index < backward.size(); index++)
+                    m_outLabels[backward[index]].push_back(rank);
+            }
+        }
+
+        m_removalsSinceBuild = 0;
+    }
+
+  public:
+    ReachabilityLabels(const size_t initial_size = 0) :
+        m_nextRank (0),
+        m_removalsSinceBuild (0),
+        m_rebuildThreshold (64)
+    {
+        Resize(initial_size);
+    }
+    virtual ~ReachabilityLabels() {
+    }
+};
+
+} // end namespace nocycle
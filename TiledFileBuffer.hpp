@@ -0,0 +1,476 @@
+//
+//  TiledFileBuffer.hpp - Growable array of plain values kept on disk in
+//     fixed-size tiles, with only a bounded number of tiles in memory at
+//     once.  This lets a graph's packed triangle be larger than RAM.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#if defined(_WIN32)
+    #error "TiledFileBuffer needs pread and pwrite (turn off NSTATE_TILED_FILE_STORAGE)"
+#endif
+
+#include <algorithm> // min, max, fill
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib> // getenv
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <cassert>
+
+#include <fcntl.h>
+#include <unistd.h> // pread, pwrite, ftruncate, unlink
+
+namespace nocycle {
+
+// This offers the part of the std::vector interface that NstateArray uses,
+// except that elements are read and written by value with Get() and Set()
+// (a reference into a cached tile would dangle as soon as the tile got
+// evicted).  Runs of elements can be read in place with Run(), which stops
+// at the end of a tile.
+//
+// Why not just mmap a file?  Walking the triangle a column at a time jumps
+// forward by a row's length on each step, and the kernel's readahead takes
+// that for random access (and a row walk that crosses a page boundary for
+// sequential access that it then reads far too much of).  Here a tile is
+// big enough that a whole step of either walk tends to land in one, the
+// cache holds exactly as many tiles as it is told to, and the caller can
+// say which tiles it is going to want next.
+//
+// The backing file is a temporary in $TMPDIR (or /tmp), unlinked as soon as
+// it is opened, so it goes away with the process.  Tiles that were never
+// written aren't in the file at all and read back as zeros.  Dirty tiles
+// are written when evicted, or by Flush().
+//
+// Misses are read on the calling thread.  Prefetch() queues a tile for a
+// background thread to read into a staging area, where the next miss on it
+// picks it up.  A tile is never both cached and staged, so the worker's
+// reads can't race the write-back of a dirty tile.  The cache itself is not
+// locked, so (unlike the in-memory buffers) concurrent const access from
+// several threads is not allowed.
+//
+template<class T>
+class TiledFileBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "TiledFileBuffer writes its contents as raw bytes");
+
+  public:
+    typedef T value_type;
+
+    static constexpr size_t tileBytes = 1 << 16;
+    static constexpr size_t elementsPerTile = tileBytes / sizeof(T);
+    static constexpr size_t defaultCacheTiles = 64;
+
+    struct Stats {
+        size_t hits; // accesses to a tile that was in the cache
+        size_t misses; // accesses which had to bring a tile in
+        size_t prefetchHits; // misses which found the tile already staged
+        size_t prefetched; // tiles read by the background thread
+        size_t writeBacks; // dirty tiles written to the file
+    };
+
+  private:
+    static constexpr size_t noTile = static_cast<size_t>(-1);
+
+    struct Slot {
+        size_t tile; // noTile if the slot is free
+        size_t lastUse;
+        bool dirty;
+        std::vector<T> data;
+    };
+
+    int m_fd;
+    size_t m_size;
+    size_t m_cacheTiles;
+    size_t m_readahead; // tiles after a miss to prefetch
+
+    // All the cache state changes on reads, so it is mutable
+    mutable std::vector<Slot> m_slots;
+    mutable std::unordered_map<size_t, size_t> m_slotForTile;
+    mutable size_t m_clock;
+    mutable size_t m_lastTile; // the slot of the last tile touched is
+    mutable size_t m_lastSlot; // remembered, to skip the map lookup
+    mutable size_t m_lastHint; // so a run of hints for one tile is cheap
+    mutable Stats m_stats;
+
+    // Shared with the prefetch thread, under m_prefetchMutex
+    mutable std::mutex m_prefetchMutex;
+    mutable std::condition_variable m_prefetchWake;
+    mutable std::condition_variable m_prefetchDone;
+    mutable std::deque<size_t> m_prefetchQueue;
+    mutable std::map<size_t, std::vector<T>> m_staged;
+    mutable size_t m_inFlight;
+    mutable bool m_stopping;
+    mutable std::thread m_worker;
+
+  private:
+    static int OpenTemporaryFile() {
+        const char* directory = getenv("TMPDIR");
+        std::string path = std::string((directory != NULL && *directory != '\0') ? directory : "/tmp")
+            + "/nocycle-tiles-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0)
+            throw std::runtime_error("TiledFileBuffer could not create its backing file");
+        unlink(path.c_str());
+        return fd;
+    }
+
+    size_t NumTiles() const {
+        return (m_size + elementsPerTile - 1) / elementsPerTile;
+    }
+
+    void ReadTile(size_t tile, T* data) const {
+        char* bytes = reinterpret_cast<char*>(data);
+        size_t done = 0;
+        while (done < tileBytes) {
+            ssize_t result = pread(m_fd, bytes + done, tileBytes - done, static_cast<off_t>(tile * tileBytes + done));
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("TiledFileBuffer could not read a tile");
+            }
+            if (result == 0)
+                break; // past the end of the file, which reads as zeros
+            done += static_cast<size_t>(result);
+        }
+        std::fill(bytes + done, bytes + tileBytes, 0);
+    }
+
+    void WriteTile(size_t tile, const T* data) const {
+        const char* bytes = reinterpret_cast<const char*>(data);
+        size_t done = 0;
+        while (done < tileBytes) {
+            ssize_t result = pwrite(m_fd, bytes + done, tileBytes - done, static_cast<off_t>(tile * tileBytes + done));
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("TiledFileBuffer could not write a tile");
+            }
+            done += static_cast<size_t>(result);
+        }
+        m_stats.writeBacks++;
+    }
+
+    // Picks the slot a missing tile goes into: a free one if the cache
+    // isn't full yet, otherwise the least recently used (written back
+    // first if it is dirty)
+    size_t ClaimSlot() const {
+        if (m_slots.size() < m_cacheTiles) {
+            m_slots.push_back(Slot());
+            m_slots.back().tile = noTile;
+            m_slots.back().data.resize(elementsPerTile);
+            return m_slots.size() - 1;
+        }
+        size_t victim = 0;
+        for (size_t slot = 1; slot < m_slots.size(); slot++) {
+            if (m_slots[slot].lastUse < m_slots[victim].lastUse)
+                victim = slot;
+        }
+        Slot& evicted = m_slots[victim];
+        if (evicted.tile != noTile) {
+            if (evicted.dirty)
+                WriteTile(evicted.tile, evicted.data.data());
+            m_slotForTile.erase(evicted.tile);
+            if (evicted.tile == m_lastTile)
+                m_lastTile = noTile;
+        }
+        evicted.tile = noTile;
+        evicted.dirty = false;
+        return victim;
+    }
+
+    // If the tile was asked for with Prefetch(), waits for the read to be
+    // done if it's underway and moves the result into data
+    bool TakeStaged(size_t tile, std::vector<T>& data) const {
+        std::unique_lock<std::mutex> lock (m_prefetchMutex);
+        auto queued = std::find(m_prefetchQueue.begin(), m_prefetchQueue.end(), tile);
+        if (queued != m_prefetchQueue.end()) {
+            m_prefetchQueue.erase(queued);
+            return false;
+        }
+        m_prefetchDone.wait(lock, [&]() { return m_inFlight != tile; });
+        auto staged = m_staged.find(tile);
+        if (staged == m_staged.end())
+            return false;
+        data.swap(staged->second);
+        m_staged.erase(staged);
+        return true;
+    }
+
+    size_t Load(size_t tile) const {
+        m_stats.misses++;
+        size_t slot = ClaimSlot();
+        Slot& loaded = m_slots[slot];
+        if (TakeStaged(tile, loaded.data))
+            m_stats.prefetchHits++;
+        else
+            ReadTile(tile, loaded.data.data());
+        loaded.tile = tile;
+        m_slotForTile[tile] = slot;
+
+        for (size_t ahead = 1; ahead <= m_readahead; ahead++)
+            Prefetch((tile + ahead) * elementsPerTile);
+        return slot;
+    }
+
+    T* TileData(size_t tile, bool forWrite) const {
+        size_t slot;
+        if (tile == m_lastTile) {
+            slot = m_lastSlot;
+            m_stats.hits++;
+        } else {
+            auto found = m_slotForTile.find(tile);
+            if (found != m_slotForTile.end()) {
+                slot = found->second;
+                m_stats.hits++;
+            } else {
+                slot = Load(tile);
+            }
+            m_lastTile = tile;
+            m_lastSlot = slot;
+        }
+        Slot& used = m_slots[slot];
+        used.lastUse = ++m_clock;
+        if (forWrite)
+            used.dirty = true;
+        return used.data.data();
+    }
+
+    void WorkerLoop() const {
+        std::unique_lock<std::mutex> lock (m_prefetchMutex);
+        while (true) {
+            m_prefetchWake.wait(lock, [&]() { return m_stopping || !m_prefetchQueue.empty(); });
+            if (m_stopping)
+                return;
+            size_t tile = m_prefetchQueue.front();
+            m_prefetchQueue.pop_front();
+            m_inFlight = tile;
+            lock.unlock();
+
+            std::vector<T> data (elementsPerTile);
+            ReadTile(tile, data.data());
+
+            lock.lock();
+            m_staged[tile].swap(data);
+            m_stats.prefetched++;
+            m_inFlight = noTile;
+            m_prefetchDone.notify_all();
+        }
+    }
+
+    // Lets anything underway finish and throws away everything staged, for
+    // when the tiles on disk are about to stop meaning what they did
+    void DiscardPrefetches() {
+        std::unique_lock<std::mutex> lock (m_prefetchMutex);
+        m_prefetchQueue.clear();
+        m_prefetchDone.wait(lock, [&]() { return m_inFlight == noTile; });
+        m_staged.clear();
+    }
+
+    void StopWorker() {
+        if (!m_worker.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock (m_prefetchMutex);
+            m_stopping = true;
+        }
+        m_prefetchWake.notify_all();
+        m_worker.join();
+        m_stopping = false;
+    }
+
+    void DropCache() {
+        m_slots.clear();
+        m_slotForTile.clear();
+        m_lastTile = noTile;
+        m_lastHint = noTile;
+    }
+
+    void CopyFrom(const TiledFileBuffer& other) {
+        m_size = other.m_size;
+        m_cacheTiles = other.m_cacheTiles;
+        m_readahead = other.m_readahead;
+        for (size_t tile = 0; tile < other.NumTiles(); tile++) {
+            size_t count = std::min(elementsPerTile, m_size - tile * elementsPerTile);
+            const T* data = other.Run(tile * elementsPerTile, count);
+            if (count == elementsPerTile) {
+                WriteTile(tile, data);
+            } else {
+                std::vector<T> last (elementsPerTile); // partial tile, pad with zeros
+                std::copy(data, data + count, last.begin());
+                WriteTile(tile, last.data());
+            }
+        }
+    }
+
+  public:
+    size_t size() const {
+        return m_size;
+    }
+
+    T Get(size_t index) const {
+        assert(index < m_size);
+        return TileData(index / elementsPerTile, false)[index % elementsPerTile];
+    }
+    void Set(size_t index, T value) {
+        assert(index < m_size);
+        TileData(index / elementsPerTile, true)[index % elementsPerTile] = value;
+    }
+
+    // Points at the elements starting at index which are in the same tile,
+    // cutting count down to however many of those there are.  The pointer
+    // is only good until the next access to the buffer.
+    const T* Run(size_t index, size_t& count) const {
+        assert(index + count <= m_size);
+        size_t offset = index % elementsPerTile;
+        count = std::min(count, elementsPerTile - offset);
+        return TileData(index / elementsPerTile, false) + offset;
+    }
+
+    // Asks for the tile holding index to be read in the background, if it
+    // isn't in memory or on its way already
+    void Prefetch(size_t index) const {
+        if ((m_readahead == 0) || (index >= m_size))
+            return;
+        size_t tile = index / elementsPerTile;
+        if ((tile == m_lastHint) || (tile == m_lastTile))
+            return;
+        m_lastHint = tile;
+        if (m_slotForTile.count(tile) != 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock (m_prefetchMutex);
+            if ((tile == m_inFlight) || (m_staged.count(tile) != 0))
+                return;
+            if (std::find(m_prefetchQueue.begin(), m_prefetchQueue.end(), tile) != m_prefetchQueue.end())
+                return;
+            // Staged tiles take memory outside the cache, so hints that
+            // never got followed up make way for new ones (walks go toward
+            // higher tiles, so the lowest are the likeliest to be stale)
+            if (m_staged.size() + m_prefetchQueue.size() >= m_cacheTiles) {
+                if (!m_prefetchQueue.empty())
+                    m_prefetchQueue.pop_front();
+                else
+                    m_staged.erase(m_staged.begin());
+            }
+            m_prefetchQueue.push_back(tile);
+        }
+        if (!m_worker.joinable())
+            m_worker = std::thread(&TiledFileBuffer::WorkerLoop, this);
+        m_prefetchWake.notify_one();
+    }
+
+    // Only zero filling is supported, since that's what comes for free
+    void resize(size_t size, const T& fill = T()) {
+        assert(fill == T());
+        (void)fill;
+
+        if (size < m_size) {
+            DiscardPrefetches();
+            size_t keepTiles = (size + elementsPerTile - 1) / elementsPerTile;
+            for (Slot& slot : m_slots) {
+                if ((slot.tile != noTile) && (slot.tile >= keepTiles)) {
+                    m_slotForTile.erase(slot.tile);
+                    slot.tile = noTile;
+                    slot.dirty = false;
+                    slot.lastUse = 0;
+                }
+            }
+            m_lastTile = noTile;
+            m_lastHint = noTile;
+            if (ftruncate(m_fd, static_cast<off_t>(keepTiles * tileBytes)) != 0)
+                throw std::runtime_error("TiledFileBuffer could not shrink its backing file");
+
+            // The size has to be cut before the last tile is touched, or
+            // the miss would prefetch a tile that is being let go
+            m_size = size;
+            if (size % elementsPerTile != 0) {
+                T* data = TileData(size / elementsPerTile, true);
+                std::fill(data + size % elementsPerTile, data + elementsPerTile, T());
+            }
+        }
+        m_size = size;
+    }
+
+    // Writes every dirty tile in the cache back to the file
+    void Flush() {
+        for (Slot& slot : m_slots) {
+            if ((slot.tile != noTile) && slot.dirty) {
+                WriteTile(slot.tile, slot.data.data());
+                slot.dirty = false;
+            }
+        }
+    }
+
+    // How many tiles to keep in memory (at least one).  Readahead is how
+    // many tiles past a miss get prefetched, zero turns prefetching off.
+    void SetCacheTiles(size_t cacheTiles, size_t readahead = 1) {
+        assert(cacheTiles >= 1);
+        Flush();
+        DiscardPrefetches();
+        DropCache();
+        m_cacheTiles = cacheTiles;
+        m_readahead = readahead;
+    }
+    size_t CacheTiles() const {
+        return m_cacheTiles;
+    }
+
+    Stats GetStats() const {
+        std::lock_guard<std::mutex> lock (m_prefetchMutex);
+        return m_stats;
+    }
+
+  public:
+    TiledFileBuffer() :
+        m_fd (OpenTemporaryFile()),
+        m_size (0),
+        m_cacheTiles (defaultCacheTiles),
+        m_readahead (1),
+        m_clock (0),
+        m_lastTile (noTile),
+        m_lastSlot (0),
+        m_lastHint (noTile),
+        m_stats (),
+        m_inFlight (noTile),
+        m_stopping (false)
+    {
+    }
+    TiledFileBuffer(const TiledFileBuffer& other) :
+        TiledFileBuffer()
+    {
+        CopyFrom(other);
+    }
+    TiledFileBuffer& operator= (const TiledFileBuffer& other) {
+        if (this != &other) {
+            DiscardPrefetches();
+            DropCache();
+            if (ftruncate(m_fd, 0) != 0)
+                throw std::runtime_error("TiledFileBuffer could not clear its backing file");
+            CopyFrom(other);
+        }
+        return *this;
+    }
+    virtual ~TiledFileBuffer() {
+        StopWorker();
+        close(m_fd);
+    }
+};
+
+} // end namespace nocycle
@@ -0,0 +1,133 @@
+//
+//  VertexBitset.hpp - Fixed-capacity set of vertex IDs stored as one bit
+//     per vertex, for the algorithms that need to union or intersect
+//     whole reachability rows at a time.  The operations work on a
+//     machine word of vertices at once, which std::set<VertexID> (and
+//     even std::vector<bool>) can't offer.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+
+#include "BulkKernels.hpp"
+
+namespace nocycle {
+
+class VertexBitset {
+  public:
+    typedef unsigned VertexID;
+    typedef uint64_t WordType;
+    static const unsigned bitsInWord = 64;
+
+  private:
+    std::vector<WordType> m_words;
+    size_t m_max;
+
+  public:
+    static size_t WordsForCapacity(size_t max) {
+        return (max + bitsInWord - 1) / bitsInWord;
+    }
+
+    size_t Capacity() const {
+        return m_max;
+    }
+    size_t NumWords() const {
+        return m_words.size();
+    }
+
+    // Word-level access, for code that wants to walk the set a word at a
+    // time.  Bits past Capacity() in the last word are always zero.
+    const WordType* Words() const {
+        return m_words.empty() ? NULL : &m_words[0];
+    }
+    WordType* Words() {
+        return m_words.empty() ? NULL : &m_words[0];
+    }
+
+    bool Test(VertexID vertex) const {
+        assert(vertex < m_max);
+        return (m_words[vertex / bitsInWord] >> (vertex % bitsInWord)) & 1;
+    }
+    void Set(VertexID vertex) {
+        assert(vertex < m_max);
+        m_words[vertex / bitsInWord] |= (static_cast<WordType>(1) << (vertex % bitsInWord));
+    }
+    void Reset(VertexID vertex) {
+        assert(vertex < m_max);
+        m_words[vertex / bitsInWord] &= ~(static_cast<WordType>(1) << (vertex % bitsInWord));
+    }
+    void Clear() {
+        for (size_t index = 0; index < m_words.size(); index++)
+            m_words[index] = 0;
+    }
+
+    // These go through the vectorized kernels (see BulkKernels.hpp)
+    void OrWith(const VertexBitset& other) {
+        assert(other.m_max == m_max);
+        BulkKernels::OrWords(Words(), other.Words(), m_words.size());
+    }
+    void AndWith(const VertexBitset& other) {
+        assert(other.m_max == m_max);
+        BulkKernels::AndWords(Words(), other.Words(), m_words.size());
+    }
+    void AndNotWith(const VertexBitset& other) {
+        assert(other.m_max == m_max);
+        BulkKernels::AndNotWords(Words(), other.Words(), m_words.size());
+    }
+
+    // Exchanges contents without copying words (swapping with an empty set
+    // is how to give the memory back)
+    void Swap(VertexBitset& other) {
+        m_words.swap(other.m_words);
+        std::swap(m_max, other.m_max);
+    }
+
+    bool Any() const {
+        return BulkKernels::SkipZeroWords(Words(), m_words.size()) != m_words.size();
+    }
+    size_t Count() const {
+        return BulkKernels::PopcountWords(Words(), m_words.size());
+    }
+
+    // Calls back with each vertex in the set, in increasing order.  Runs of
+    // zero words are skipped in bulk, so sparse sets are cheap to walk.
+    template<class Callback>
+    void ForEach(Callback callback) const {
+        for (size_t index = 0; index < m_words.size(); index++) {
+            index += BulkKernels::SkipZeroWords(&m_words[index], m_words.size() - index);
+            if (index == m_words.size())
+                break;
+            WordType word = m_words[index];
+            while (word != 0) {
+                unsigned bit = static_cast<unsigned>(__builtin_ctzll(word));
+                callback(static_cast<VertexID>(index * bitsInWord + bit));
+                word &= word - 1;
+            }
+        }
+    }
+
+  public:
+    VertexBitset(const size_t max = 0) :
+        m_words (WordsForCapacity(max), 0),
+        m_max (max)
+    {
+    }
+    virtual ~VertexBitset() {
+    }
+};
+
+} // end namespace nocycle
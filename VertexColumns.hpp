@@ -0,0 +1,159 @@
+//
+//  VertexColumns.hpp - Typed per-vertex properties which an OrientedGraph
+//     keeps alongside its connection data, indexed straight by vertex ID.
+//     Small enumerations are packed into an NstateArray, and anything
+//     else goes in a plain array.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <vector>
+#include <type_traits>
+#include <cassert>
+
+#include "Nstate.hpp"
+
+namespace nocycle {
+
+// What the graph needs from a column to keep it the same length as the
+// vertex capacity, put it back to zero when a vertex goes away, and copy
+// it when the graph is copied.  Reading and writing values is left to the
+// typed columns, so that doesn't go through a virtual call.
+class VertexColumn {
+  public:
+    typedef unsigned VertexID;
+
+  public:
+    virtual void Resize(size_t max) = 0;
+    virtual void Clear(VertexID vertex) = 0;
+    virtual VertexColumn* Clone() const = 0;
+
+    // A new column holding the value of vertices[index] at index, for
+    // carrying properties over into an extracted subgraph
+    virtual VertexColumn* Extract(const std::vector<VertexID>& vertices) const = 0;
+
+  public:
+    virtual ~VertexColumn() { }
+};
+
+// A value in [0..radix-1] per vertex, e.g. a priority of 0-7 in three bits
+// rather than a whole word
+template<int radix>
+class NstateVertexColumn : public VertexColumn {
+  public:
+    typedef Nstate<radix> ValueType;
+
+  private:
+    NstateArray<radix> m_values;
+
+  public:
+    Nstate<radix> Get(VertexID vertex) const {
+        return m_values[vertex];
+    }
+    void Set(VertexID vertex, Nstate<radix> value) {
+        m_values[vertex] = value;
+    }
+
+    void Resize(size_t max) {
+        m_values.ResizeWithZeros(max);
+    }
+    void Clear(VertexID vertex) {
+        m_values[vertex] = 0;
+    }
+    VertexColumn* Clone() const {
+        return new NstateVertexColumn<radix> (*this);
+    }
+    VertexColumn* Extract(const std::vector<VertexID>& vertices) const {
+        NstateVertexColumn<radix>* column = new NstateVertexColumn<radix> (vertices.size());
+        for (size_t index = 0; index < vertices.size(); index++)
+            column->m_values[index] = Get(vertices[index]);
+        return column;
+    }
+
+  public:
+    NstateVertexColumn<radix>(size_t max) :
+        m_values (max)
+    {
+    }
+};
+
+// Any plain value per vertex (a count, a shard number...), which reads as
+// T() until it is set
+template<class T>
+class ValueVertexColumn : public VertexColumn {
+    static_assert(std::is_trivially_copyable<T>::value, "ValueVertexColumn is for plain values");
+
+  public:
+    typedef T ValueType;
+
+  private:
+    std::vector<T> m_values;
+
+  public:
+    T Get(VertexID vertex) const {
+        assert(vertex < m_values.size());
+        return m_values[vertex];
+    }
+    void Set(VertexID vertex, T value) {
+        assert(vertex < m_values.size());
+        m_values[vertex] = value;
+    }
+
+    void Resize(size_t max) {
+        m_values.resize(max, T());
+    }
+    void Clear(VertexID vertex) {
+        assert(vertex < m_values.size());
+        m_values[vertex] = T();
+    }
+    VertexColumn* Clone() const {
+        return new ValueVertexColumn<T> (*this);
+    }
+    VertexColumn* Extract(const std::vector<VertexID>& vertices) const {
+        ValueVertexColumn<T>* column = new ValueVertexColumn<T> (vertices.size());
+        for (size_t index = 0; index < vertices.size(); index++)
+            column->m_values[index] = Get(vertices[index]);
+        return column;
+    }
+
+  public:
+    ValueVertexColumn<T>(size_t max) :
+        m_values (max, T())
+    {
+    }
+};
+
+// Returned when a column is added to a graph, and used to get at it again.
+// The type of column comes along, so no cast is needed by the caller and
+// no lookup by name is done on each access.  A handle stays good for
+// copies of the graph it came from.
+template<class Column>
+class VertexColumnHandle {
+    friend class OrientedGraph;
+
+  private:
+    size_t m_index;
+
+    explicit VertexColumnHandle(size_t index) :
+        m_index (index)
+    {
+    }
+
+  public:
+    VertexColumnHandle() :
+        m_index (static_cast<size_t>(-1))
+    {
+    }
+};
+
+} // end namespace nocycle
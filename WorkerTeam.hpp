@@ -0,0 +1,131 @@
+//
+//  WorkerTeam.hpp - A fixed group of threads that run one step of an
+//     algorithm together and wait for each other at the end of it, over
+//     and over.  Starting a std::thread costs tens of microseconds, which
+//     is more than a level of a breadth-first search usually takes, so
+//     the threads are started once and parked between steps instead.
+//
+//  Copyright (c) 2009 HostileFork.com
+//
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+//  See http://hostilefork.com/nocycle for documentation.
+//
+
+#pragma once
+
+#include "NocycleConfig.hpp"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cassert>
+
+namespace nocycle {
+
+// The calling thread is member 0 of the team and does its share of every
+// step, so a team of one starts no threads at all.
+class WorkerTeam {
+  private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_stepReady;
+    std::condition_variable m_stepDone;
+    std::function<void(size_t)> m_step;
+    unsigned long m_generation;
+    size_t m_running;
+    bool m_stopping;
+
+  private:
+    void WorkerLoop(size_t memberIndex) {
+        unsigned long generationSeen = 0;
+        while (true) {
+            std::unique_lock<std::mutex> lock (m_mutex);
+            m_stepReady.wait(lock, [&]() {
+                return m_stopping || (m_generation != generationSeen);
+            });
+            if (m_stopping)
+                return;
+            generationSeen = m_generation;
+            lock.unlock();
+
+            m_step(memberIndex);
+
+            lock.lock();
+            if (--m_running == 0)
+                m_stepDone.notify_one();
+        }
+    }
+
+  public:
+    size_t Size() const {
+        return m_threads.size() + 1;
+    }
+
+    // Calls step(memberIndex) once for each member of the team, and returns
+    // when all of them have finished.  Steps must not throw.
+    template<class Step>
+    void Run(Step step) {
+        if (m_threads.empty()) {
+            step(0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock (m_mutex);
+            m_step = [&step](size_t memberIndex) {
+                step(memberIndex);
+            };
+            m_running = m_threads.size();
+            m_generation++;
+        }
+        m_stepReady.notify_all();
+
+        step(0);
+
+        std::unique_lock<std::mutex> lock (m_mutex);
+        m_stepDone.wait(lock, [&]() {
+            return m_running == 0;
+        });
+    }
+
+    // Splits [0, numItems) evenly across the team, giving memberIndex's part.
+    // Parts are a multiple of wordBits long (if it isn't 0), so members that
+    // each fill their part of a bitset never write to the same word.
+    void RangeForMember(size_t numItems, size_t memberIndex, size_t wordBits, size_t& begin, size_t& end) const {
+        size_t chunk = (numItems + Size() - 1) / Size();
+        if (wordBits != 0)
+            chunk = (chunk + wordBits - 1) / wordBits * wordBits;
+        begin = std::min(memberIndex * chunk, numItems);
+        end = std::min(begin + chunk, numItems);
+    }
+
+  public:
+    WorkerTeam(const size_t numMembers) :
+        m_generation (0),
+        m_running (0),
+        m_stopping (false)
+    {
+        assert(numMembers > 0);
+        for (size_t memberIndex = 1; memberIndex < numMembers; memberIndex++)
+            m_threads.push_back(std::thread(&WorkerTeam::WorkerLoop, this, memberIndex));
+    }
+    WorkerTeam(const WorkerTeam&) = delete;
+    WorkerTeam& operator=(const WorkerTeam&) = delete;
+    virtual ~WorkerTeam() {
+        {
+            std::lock_guard<std::mutex> lock (m_mutex);
+            m_stopping = true;
+        }
+        m_stepReady.notify_all();
+        for (size_t index = 0; index < m_threads.size(); index++)
+            m_threads[index].join();
+    }
+};
+
+} // end namespace nocycle